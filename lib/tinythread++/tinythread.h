@@ -82,6 +82,7 @@ freely, subject to the following restrictions:
   #include <sched.h>
   #include <unistd.h>
   #include <sys/time.h>
+  #include <time.h>
 #endif
 
 // Generic includes
@@ -398,7 +399,16 @@ class condition_variable {
 #else
     condition_variable()
     {
+#if defined(__APPLE__)
       pthread_cond_init(&mHandle, NULL);
+#else
+      // time outs are measured on the monotonic clock, so stepping the system clock can't stretch a wait
+      pthread_condattr_t attr;
+      pthread_condattr_init(&attr);
+      pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+      pthread_cond_init(&mHandle, &attr);
+      pthread_condattr_destroy(&attr);
+#endif
     }
 #endif
 
@@ -433,22 +443,26 @@ class condition_variable {
       aMutex.lock();
 #else
 	  if ( aTimeout != 0xffffffff )
-	  {
-		  timeval tv;
-		  gettimeofday(&tv, NULL);
-
-		  timespec ts;
-		  long long nanoseconds = ((long long)tv.tv_sec * 1000 * 1000 * 1000) + ((long long)aTimeout * 1000 * 1000) + ((long long) tv.tv_usec * 1000);
-		  ts.tv_sec = nanoseconds / (1000 * 1000 * 1000);
-		  ts.tv_nsec = nanoseconds - ((long long)ts.tv_sec * 1000 * 1000 * 1000);
-
-		  pthread_cond_timedwait( &mHandle, &aMutex.mHandle, &ts );
-	  }
+		  _timed_wait( aMutex.mHandle, (unsigned long long)aTimeout * 1000 );
 	  else
 		 pthread_cond_wait(&mHandle, &aMutex.mHandle);
 #endif
     }
 
+    /// Wait for the condition with a time out in microseconds, the wait may also
+    /// end early on a notify or a spurious wake up. Time outs are measured on a
+    /// monotonic clock, on Windows they are rounded up to milliseconds.
+    template <class _mutexT>
+    inline void wait_us(_mutexT &aMutex, unsigned long long aMicroseconds)
+    {
+#if defined(_TTHREAD_WIN32_)
+      unsigned long long ms = (aMicroseconds + 999) / 1000;
+      wait( aMutex, ms < 0xfffffffe ? (unsigned int)ms : 0xfffffffe );
+#else
+      _timed_wait( aMutex.mHandle, aMicroseconds );
+#endif
+    }
+
     /// Notify one thread that is waiting for the condition.
     /// If at least one thread is blocked waiting for this condition variable,
     /// one will be woken up.
@@ -486,6 +500,22 @@ class condition_variable {
     unsigned int mWaitersCount;         ///< Count of the number of waiters.
     CRITICAL_SECTION mWaitersCountLock; ///< Serialize access to mWaitersCount.
 #else
+    inline void _timed_wait(pthread_mutex_t &aMutex, unsigned long long aMicroseconds)
+    {
+      timespec ts;
+#if defined(__APPLE__)
+      ts.tv_sec = (time_t)(aMicroseconds / 1000000);
+      ts.tv_nsec = (long)(aMicroseconds % 1000000) * 1000;
+      pthread_cond_timedwait_relative_np( &mHandle, &aMutex, &ts );
+#else
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      long long nanoseconds = ((long long)ts.tv_sec * 1000 * 1000 * 1000) + ts.tv_nsec + ((long long)aMicroseconds * 1000);
+      ts.tv_sec = nanoseconds / (1000 * 1000 * 1000);
+      ts.tv_nsec = nanoseconds - ((long long)ts.tv_sec * 1000 * 1000 * 1000);
+      pthread_cond_timedwait( &mHandle, &aMutex, &ts );
+#endif
+    }
+
     pthread_cond_t mHandle;
 #endif
 };
@@ -58,7 +58,7 @@ bool KafkaConsumer::Stop()
 }
 
 bool KafkaConsumer::Subscribe( const std::string & a_Topic, int a_Partition,
-	Delegate<std::string *> a_MessageCallback )
+	Delegate<std::string *> a_MessageCallback, ThreadPool * a_pExecutor /*= NULL*/ )
 {
 	Subscription * pSub = &m_SubscriptionMap[ a_Topic ];
 	if ( pSub->m_bActive )
@@ -70,7 +70,10 @@ bool KafkaConsumer::Subscribe( const std::string & a_Topic, int a_Partition,
 	pSub->m_Partition = a_Partition;
 	pSub->m_Callback = a_MessageCallback;
 
-	ThreadPool::Instance()->InvokeOnThread<Subscription *>( DELEGATE( KafkaConsumer, ConsumeThread, Subscription *, this ), pSub );
+	if ( a_pExecutor == NULL )
+		a_pExecutor = ThreadPool::Instance();
+	a_pExecutor->InvokeOnThread<Subscription *>( DELEGATE( KafkaConsumer, ConsumeThread, Subscription *, this ), pSub,
+		ThreadPool::PRIORITY_BACKGROUND );
 	return true;
 }
 
@@ -96,6 +99,8 @@ bool KafkaConsumer::Unsubscribe( const std::string & a_Topic, bool a_bBlocking /
 
 void KafkaConsumer::ConsumeThread( Subscription * a_pSub )
 {
+	// we hold on to this pool thread until unsubscribed, let the pool start another in our place..
+	ThreadPool::BlockingSection blocking;
 	try {
 		if (! Consume( a_pSub ) )
 		{
@@ -153,7 +158,7 @@ bool KafkaConsumer::Consume( Subscription * a_pSub )
 		if ( pMsg->err == 0 )
 		{
 			std::string * pPayload = new std::string( (const char *)pMsg->payload, pMsg->len );
-			ThreadPool::Instance()->InvokeOnMain<std::string *>( a_pSub->m_Callback, pPayload );
+			ThreadPool::Instance()->InvokeOnMain<std::string *>( a_pSub->m_Callback, pPayload, ThreadPool::PRIORITY_BACKGROUND );
 		}
 		else if ( pMsg->err != RD_KAFKA_RESP_ERR__PARTITION_EOF )
 		{
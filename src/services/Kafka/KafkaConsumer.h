@@ -44,8 +44,9 @@ public:
 	virtual bool Stop();
 
 	//! Mutators
+	//! The consume loop for the topic runs on a_pExecutor, or on the default ThreadPool if NULL.
 	bool				Subscribe( const std::string & a_Topic, int a_Partition,
-							Delegate<std::string *> a_MessageCallback );
+							Delegate<std::string *> a_MessageCallback, ThreadPool * a_pExecutor = NULL );
 	bool				Unsubscribe( const std::string & a_Topic, bool a_bBlocking = false );
 
 protected:
@@ -0,0 +1,827 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <fstream>
+
+#include "BinaryLog.h"
+#include "FlightRecorder.h"
+#include "StringUtil.h"
+#include "Time.h"
+
+RTTI_IMPL( BinaryReactor, ILogReactor );
+
+// File layout: the header, then records that each start with a one byte type. All values are in host byte
+// order, the header has a byte order marker so a log can't be decoded on a machine with a different order.
+static const char			BINARY_LOG_MAGIC[8] = { 'W', 'D', 'C', 'B', 'L', 'O', 'G', '1' };
+static const boost::uint32_t BINARY_LOG_ORDER = 0x01020304;
+
+const char RECORD_CALLSITE = 'C';		// id, level, sub-system, file, line, format
+const char RECORD_EVENT = 'E';			// id, timestamp, argument size, arguments
+const char RECORD_TEXT = 'T';			// level, timestamp, sub-system, message
+
+const size_t MAX_RECORD = 4096;			// string arguments are cut short to fit
+const int WRITE_INTERVAL = 100;			// how often the write thread writes the buffer, in milliseconds
+
+BinaryReactor * BinaryReactor::sm_pInstance = NULL;
+
+//! Encodes values into a fixed size buffer
+struct RecordWriter
+{
+	RecordWriter( char * a_pBuffer, size_t a_Size ) : m_pStart( a_pBuffer ), m_pPos( a_pBuffer ), m_pEnd( a_pBuffer + a_Size )
+	{}
+
+	template<typename T>
+	bool Put( T a_Value )
+	{
+		return PutBytes( &a_Value, sizeof(a_Value) );
+	}
+	bool PutBytes( const void * a_pData, size_t a_Size )
+	{
+		if ( (size_t)(m_pEnd - m_pPos) < a_Size )
+			return false;
+		memcpy( m_pPos, a_pData, a_Size );
+		m_pPos += a_Size;
+		return true;
+	}
+	//! Short strings used for arguments, cut to fit the record with a_Reserve bytes left over
+	bool PutShortString( const char * a_pString, size_t a_Reserve = 0 )
+	{
+		if ( a_pString == NULL )
+			a_pString = "(null)";
+		size_t len = strlen( a_pString );
+		size_t used = sizeof(boost::uint16_t) + a_Reserve;
+		size_t room = (size_t)(m_pEnd - m_pPos) > used ? (m_pEnd - m_pPos) - used : 0;
+		if ( len > room )
+			len = room;
+		if ( len > 0xffff )
+			len = 0xffff;
+		return Put<boost::uint16_t>( (boost::uint16_t)len ) && PutBytes( a_pString, len );
+	}
+	size_t GetSize() const
+	{
+		return m_pPos - m_pStart;
+	}
+
+	char *	m_pStart;
+	char *	m_pPos;
+	char *	m_pEnd;
+};
+
+//! Appends values to a string, used for records that are not size limited
+struct StringWriter
+{
+	StringWriter( std::string & a_Output ) : m_Output( a_Output )
+	{}
+
+	template<typename T>
+	void Put( T a_Value )
+	{
+		m_Output.append( (const char *)&a_Value, sizeof(a_Value) );
+	}
+	void PutString( const std::string & a_String )
+	{
+		Put<boost::uint32_t>( (boost::uint32_t)a_String.size() );
+		m_Output += a_String;
+	}
+
+	std::string &	m_Output;
+};
+
+//! Reads values from a decoded record
+struct RecordReader
+{
+	RecordReader( const char * a_pData, size_t a_Size ) : m_pPos( a_pData ), m_pEnd( a_pData + a_Size )
+	{}
+
+	template<typename T>
+	bool Get( T & a_Value )
+	{
+		if ( (size_t)(m_pEnd - m_pPos) < sizeof(T) )
+			return false;
+		memcpy( &a_Value, m_pPos, sizeof(T) );
+		m_pPos += sizeof(T);
+		return true;
+	}
+	template<typename LENGTH>
+	bool GetString( std::string & a_Value )
+	{
+		LENGTH len = 0;
+		if (! Get( len ) || (size_t)(m_pEnd - m_pPos) < len )
+			return false;
+		a_Value.assign( m_pPos, len );
+		m_pPos += len;
+		return true;
+	}
+	//! Returns a short string argument without copying it
+	bool GetStringData( const char * & a_pValue, boost::uint16_t & a_Length )
+	{
+		if (! Get( a_Length ) || (size_t)(m_pEnd - m_pPos) < a_Length )
+			return false;
+		a_pValue = m_pPos;
+		m_pPos += a_Length;
+		return true;
+	}
+
+	const char *	m_pPos;
+	const char *	m_pEnd;
+};
+
+//! One printf conversion, e.g. "%-*.3lld"
+struct FormatSpec
+{
+	std::string		m_Flags;		// flags, width and precision, including any '*'
+	int				m_Stars;		// number of '*', each reads an int argument
+	std::string		m_Length;		// length modifier
+	char			m_Conversion;
+};
+
+//! Parses the conversion starting after a '%', returns a pointer past it or NULL if the format ends first.
+static const char * ParseSpec( const char * a_pFormat, FormatSpec & a_Spec )
+{
+	a_Spec.m_Flags.clear();
+	a_Spec.m_Length.clear();
+	a_Spec.m_Stars = 0;
+
+	const char * p = a_pFormat;
+	while( *p != 0 && strchr( "-+ #0123456789.*", *p ) != NULL )
+	{
+		if ( *p == '*' )
+			a_Spec.m_Stars += 1;
+		a_Spec.m_Flags += *p++;
+	}
+	while( *p != 0 && strchr( "hlLqjztI", *p ) != NULL )
+	{
+		a_Spec.m_Length += *p++;
+		// MSVC's I64 and I32
+		if ( a_Spec.m_Length == "I" && (p[0] == '6' || p[0] == '3') && (p[1] == '4' || p[1] == '2') )
+		{
+			a_Spec.m_Length.append( p, 2 );
+			p += 2;
+		}
+	}
+	if ( *p == 0 )
+		return NULL;
+
+	a_Spec.m_Conversion = *p++;
+	return p;
+}
+
+static bool GetArgType( const FormatSpec & a_Spec, unsigned char & a_Type )
+{
+	const std::string & len = a_Spec.m_Length;
+	switch( a_Spec.m_Conversion )
+	{
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		if ( len == "l" )
+			a_Type = BinaryReactor::ARG_LONG;
+		else if ( len == "ll" || len == "q" || len == "j" || len == "I64" )
+			a_Type = BinaryReactor::ARG_LONGLONG;
+		else if ( len == "z" || len == "t" || len == "I" )
+			a_Type = BinaryReactor::ARG_SIZE;
+		else
+			a_Type = BinaryReactor::ARG_INT;
+		return true;
+	case 'c':
+		a_Type = BinaryReactor::ARG_INT;
+		return len.empty();
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		a_Type = len == "L" ? BinaryReactor::ARG_LONGDOUBLE : BinaryReactor::ARG_DOUBLE;
+		return true;
+	case 's':
+		a_Type = BinaryReactor::ARG_STRING;
+		return len.empty();
+	case 'p':
+		a_Type = BinaryReactor::ARG_POINTER;
+		return true;
+	default:
+		// %n, wide characters and anything we don't know are logged as text
+		return false;
+	}
+}
+
+bool BinaryReactor::ParseFormat( const char * a_pFormat, ArgList & a_Args )
+{
+	a_Args.clear();
+
+	FormatSpec spec;
+	const char * p = a_pFormat;
+	while( (p = strchr( p, '%' )) != NULL )
+	{
+		if ( p[1] == '%' )
+		{
+			p += 2;
+			continue;
+		}
+		if ( (p = ParseSpec( p + 1, spec )) == NULL )
+			return false;
+
+		unsigned char type = 0;
+		if (! GetArgType( spec, type ) )
+			return false;
+		for(int i=0;i<spec.m_Stars;++i)
+			a_Args.push_back( ARG_INT );
+		a_Args.push_back( type );
+	}
+
+	return true;
+}
+
+BinaryReactor::BinaryReactor( const char * a_pLogFile, LogLevel a_MinLevel /*= LL_DEBUG_LOW*/, size_t a_MaxBuffer /*= 4MB*/ ) :
+	m_LogFile( a_pLogFile ),
+	m_MinLevel( a_MinLevel ),
+	m_MaxBuffer( a_MaxBuffer ),
+	m_Records( 0 ),
+	m_Dropped( 0 ),
+	m_bStopThread( false ),
+	m_pThread( NULL )
+{
+	if ( sm_pInstance != NULL )
+		Log::Error( "BinaryReactor", "Multiple instances of BinaryReactor created." );
+	sm_pInstance = this;
+
+	Time now;
+	m_MonotonicBase = Time::GetMonotonicMicroseconds();
+	m_EpochBase = ((boost::uint64_t)now.GetTime() * 1000000) + ((boost::uint64_t)now.GetMilliseconds() * 1000);
+
+	m_Buffer.append( BINARY_LOG_MAGIC, sizeof(BINARY_LOG_MAGIC) );
+	m_Buffer.append( (const char *)&BINARY_LOG_ORDER, sizeof(BINARY_LOG_ORDER) );
+
+	m_pThread = new boost::thread( boost::bind( &BinaryReactor::WriteThread, this ) );
+}
+
+BinaryReactor::~BinaryReactor()
+{
+	if ( sm_pInstance == this )
+		sm_pInstance = NULL;
+
+	if ( m_pThread != NULL )
+	{
+		{
+			boost::lock_guard<boost::mutex> lock( m_WakeLock );
+			m_bStopThread = true;
+		}
+		m_WakeThread.notify_one();
+		m_pThread->join();
+
+		delete m_pThread;
+		m_pThread = NULL;
+	}
+}
+
+BinaryReactor * BinaryReactor::Instance()
+{
+	return sm_pInstance;
+}
+
+void BinaryReactor::Process( const LogRecord & a_Record )
+{
+	if ( a_Record.m_Level < m_MinLevel || a_Record.m_bBinaryLogged )
+		return;
+
+	std::string record;
+	StringWriter writer( record );
+	writer.Put<char>( RECORD_TEXT );
+	writer.Put<boost::uint8_t>( (boost::uint8_t)a_Record.m_Level );
+	writer.Put<boost::uint64_t>( GetTimestamp() );
+	writer.PutString( a_Record.m_SubSystem );
+	writer.PutString( a_Record.m_Message );
+
+	Append( record.c_str(), record.size(), NULL );
+}
+
+void BinaryReactor::SetLogLevel( LogLevel a_Level )
+{
+	m_MinLevel = a_Level;
+	Log::UpdateMinLevel();
+}
+
+void BinaryReactor::Write( Callsite & a_Callsite, const char * a_pFormat, ... )
+{
+	va_list args;
+	va_start( args, a_pFormat );
+
+	if ( a_Callsite.m_Id.load( boost::memory_order_acquire ) == 0 )
+		Register( a_Callsite, a_pFormat );
+
+	BinaryReactor * pReactor = sm_pInstance;
+	if ( pReactor == NULL || a_Callsite.m_Level < pReactor->m_MinLevel || !a_Callsite.m_bBinary )
+	{
+		Log::DoLog( a_Callsite.m_Level, a_Callsite.m_pSubSystem, a_pFormat, args );
+		va_end( args );
+		return;
+	}
+	// DoLog() records the text fallback above, binary records are recorded here with the parsed argument types..
+	if ( FlightRecorder::IsRecording( a_Callsite.m_Level ) )
+		FlightRecorder::Record( a_Callsite.m_Level, a_Callsite.m_pSubSystem, a_pFormat, a_Callsite.m_Args, args );
+
+	char buffer[ MAX_RECORD ];
+	RecordWriter writer( buffer, sizeof(buffer) );
+	writer.Put<char>( RECORD_EVENT );
+	writer.Put<boost::uint32_t>( a_Callsite.m_Id );
+	writer.Put<boost::uint64_t>( pReactor->GetTimestamp() );
+	// the argument size is filled in once the arguments are written..
+	size_t sizeOffset = writer.GetSize();
+	writer.Put<boost::uint16_t>( 0 );
+
+	int encoded = EncodeArgs( a_Callsite.m_Args, args, writer.m_pPos, writer.m_pEnd - writer.m_pPos );
+	if ( encoded < 0 )
+	{
+		// the arguments don't fit in a record even with the strings cut short, so every reactor gets it as text..
+		Log::DoLogText( a_Callsite.m_Level, a_Callsite.m_pSubSystem, a_pFormat, args, false );
+		va_end( args );
+		return;
+	}
+	writer.m_pPos += encoded;
+
+	boost::uint16_t argSize = (boost::uint16_t)(writer.GetSize() - sizeOffset - sizeof(boost::uint16_t));
+	memcpy( buffer + sizeOffset, &argSize, sizeof(argSize) );
+	pReactor->Append( buffer, writer.GetSize(), &a_Callsite );
+
+	// the other reactors only pay for formatting when one of them wants the level..
+	if ( a_Callsite.m_Level >= Log::GetTextLevel() )
+		Log::DoLogText( a_Callsite.m_Level, a_Callsite.m_pSubSystem, a_pFormat, args, true );
+	va_end( args );
+}
+
+//! Returns the fewest bytes an argument of the given type is written in, strings can be cut down to their length.
+static size_t GetMinArgSize( unsigned char a_Type )
+{
+	if ( a_Type == BinaryReactor::ARG_INT )
+		return sizeof(boost::int32_t);
+	if ( a_Type == BinaryReactor::ARG_STRING )
+		return sizeof(boost::uint16_t);
+	return sizeof(boost::int64_t);
+}
+
+//! Returns the fewest bytes the arguments read by a_pFormat are written in, or -1 if the format can't be recorded.
+static int GetMinArgsSize( const char * a_pFormat )
+{
+	FormatSpec spec;
+	size_t size = 0;
+	const char * p = a_pFormat;
+	while( (p = strchr( p, '%' )) != NULL )
+	{
+		if ( p[1] == '%' )
+		{
+			p += 2;
+			continue;
+		}
+
+		unsigned char type = 0;
+		if ( (p = ParseSpec( p + 1, spec )) == NULL || !GetArgType( spec, type ) )
+			return -1;
+		size += (spec.m_Stars * GetMinArgSize( BinaryReactor::ARG_INT )) + GetMinArgSize( type );
+	}
+	return (int)size;
+}
+
+//! Reads one argument of the given type and writes it, returns false if it didn't fit. A string is cut
+//! short to leave a_Reserve bytes for the arguments after it.
+static bool PutArg( RecordWriter & a_Writer, unsigned char a_Type, va_list * a_pArgs, size_t a_Reserve )
+{
+	switch( a_Type )
+	{
+	case BinaryReactor::ARG_INT:
+		return a_Writer.Put<boost::int32_t>( va_arg( *a_pArgs, int ) );
+	case BinaryReactor::ARG_LONG:
+		return a_Writer.Put<boost::int64_t>( va_arg( *a_pArgs, long ) );
+	case BinaryReactor::ARG_LONGLONG:
+		return a_Writer.Put<boost::int64_t>( va_arg( *a_pArgs, long long ) );
+	case BinaryReactor::ARG_SIZE:
+		return a_Writer.Put<boost::int64_t>( (boost::int64_t)va_arg( *a_pArgs, size_t ) );
+	case BinaryReactor::ARG_DOUBLE:
+		return a_Writer.Put<double>( va_arg( *a_pArgs, double ) );
+	case BinaryReactor::ARG_LONGDOUBLE:
+		return a_Writer.Put<double>( (double)va_arg( *a_pArgs, long double ) );
+	case BinaryReactor::ARG_STRING:
+		return a_Writer.PutShortString( va_arg( *a_pArgs, const char * ), a_Reserve );
+	case BinaryReactor::ARG_POINTER:
+		return a_Writer.Put<boost::uint64_t>( (boost::uint64_t)(size_t)va_arg( *a_pArgs, void * ) );
+	}
+	return false;
+}
+
+int BinaryReactor::EncodeArgs( const ArgList & a_Types, va_list a_Args, char * a_pBuffer, size_t a_Size )
+{
+	// strings are cut short to leave room for everything after them, so a long string can't push out an argument..
+	size_t reserve = 0;
+	for( ArgList::const_iterator iArg = a_Types.begin(); iArg != a_Types.end(); ++iArg )
+		reserve += GetMinArgSize( *iArg );
+	if ( reserve > a_Size )
+		return -1;
+
+	// va_list can't be passed on by pointer portably, so work on a copy..
+	va_list args;
+	va_copy( args, a_Args );
+
+	RecordWriter writer( a_pBuffer, a_Size );
+	bool bEncoded = true;
+	for( ArgList::const_iterator iArg = a_Types.begin(); iArg != a_Types.end() && bEncoded; ++iArg )
+	{
+		reserve -= GetMinArgSize( *iArg );
+		bEncoded = PutArg( writer, *iArg, &args, reserve );
+	}
+	va_end( args );
+
+	return bEncoded ? (int)writer.GetSize() : -1;
+}
+
+int BinaryReactor::EncodeArgs( const char * a_pFormat, va_list a_Args, char * a_pBuffer, size_t a_Size )
+{
+	int minSize = GetMinArgsSize( a_pFormat );
+	if ( minSize < 0 || (size_t)minSize > a_Size )
+		return -1;
+	size_t reserve = (size_t)minSize;
+
+	va_list args;
+	va_copy( args, a_Args );
+
+	RecordWriter writer( a_pBuffer, a_Size );
+	FormatSpec spec;
+	bool bEncoded = true;
+	const char * p = a_pFormat;
+	while( bEncoded && (p = strchr( p, '%' )) != NULL )
+	{
+		if ( p[1] == '%' )
+		{
+			p += 2;
+			continue;
+		}
+
+		unsigned char type = 0;
+		if ( (p = ParseSpec( p + 1, spec )) == NULL || !GetArgType( spec, type ) )
+		{
+			bEncoded = false;
+			break;
+		}
+		for(int i=0;i<spec.m_Stars && bEncoded;++i)
+		{
+			reserve -= GetMinArgSize( ARG_INT );
+			bEncoded = PutArg( writer, ARG_INT, &args, reserve );
+		}
+		reserve -= GetMinArgSize( type );
+		if ( bEncoded )
+			bEncoded = PutArg( writer, type, &args, reserve );
+	}
+	va_end( args );
+
+	return bEncoded ? (int)writer.GetSize() : -1;
+}
+
+void BinaryReactor::Register( Callsite & a_Callsite, const char * a_pFormat )
+{
+	static boost::mutex lock;
+	static unsigned int nextId = 1;
+
+	boost::lock_guard<boost::mutex> guard( lock );
+	if ( a_Callsite.m_Id == 0 )
+	{
+		a_Callsite.m_pFormat = a_pFormat;
+		a_Callsite.m_bBinary = ParseFormat( a_pFormat, a_Callsite.m_Args );
+		a_Callsite.m_Id.store( nextId++, boost::memory_order_release );
+	}
+}
+
+boost::uint64_t BinaryReactor::GetTimestamp() const
+{
+	return m_EpochBase + (Time::GetMonotonicMicroseconds() - m_MonotonicBase);
+}
+
+void BinaryReactor::Append( const char * a_pRecord, size_t a_Size, const Callsite * a_pCallsite )
+{
+	boost::lock_guard<boost::mutex> lock( m_BufferLock );
+	if ( m_Buffer.size() + a_Size > m_MaxBuffer )
+	{
+		m_Dropped += 1;
+		return;
+	}
+
+	// the first time a call-site is used in this file, write it's definition ahead of the event..
+	if ( a_pCallsite != NULL )
+	{
+		unsigned int id = a_pCallsite->m_Id;
+		if ( id >= m_Defined.size() )
+			m_Defined.resize( id + 1, false );
+		if (! m_Defined[id] )
+		{
+			StringWriter writer( m_Buffer );
+			writer.Put<char>( RECORD_CALLSITE );
+			writer.Put<boost::uint32_t>( id );
+			writer.Put<boost::uint8_t>( (boost::uint8_t)a_pCallsite->m_Level );
+			writer.PutString( a_pCallsite->m_pSubSystem );
+			writer.PutString( a_pCallsite->m_pFile );
+			writer.Put<boost::uint32_t>( (boost::uint32_t)a_pCallsite->m_Line );
+			writer.PutString( a_pCallsite->m_pFormat );
+			m_Defined[id] = true;
+		}
+	}
+
+	m_Buffer.append( a_pRecord, a_Size );
+	m_Records += 1;
+}
+
+void BinaryReactor::WriteThread()
+{
+	FILE * pFile = fopen( m_LogFile.c_str(), "wb" );
+	if ( pFile == NULL )
+		Log::Error( "BinaryReactor", "Failed to open %s for writing.", m_LogFile.c_str() );
+
+	std::string output;
+	while( true )
+	{
+		{
+			boost::unique_lock<boost::mutex> lock( m_WakeLock );
+			if (! m_bStopThread )
+				m_WakeThread.timed_wait( lock, boost::posix_time::milliseconds( WRITE_INTERVAL ) );
+		}
+		bool bStop = m_bStopThread;
+
+		// swap the buffers, so logging threads only wait for the swap..
+		m_BufferLock.lock();
+		output.swap( m_Buffer );
+		m_BufferLock.unlock();
+
+		if ( pFile != NULL && output.size() > 0 )
+		{
+			fwrite( output.c_str(), 1, output.size(), pFile );
+			fflush( pFile );
+		}
+		output.clear();
+
+		if ( bStop )
+			break;
+	}
+
+	if ( pFile != NULL )
+		fclose( pFile );
+}
+
+//! Call-site definitions read back from a binary log
+struct DecodedCallsite
+{
+	DecodedCallsite() : m_Level( 0 ), m_Line( 0 )
+	{}
+
+	boost::uint8_t	m_Level;
+	std::string		m_SubSystem;
+	std::string		m_File;
+	boost::uint32_t	m_Line;
+	std::string		m_Format;
+};
+
+//! Appends text to a fixed size buffer, the text is cut short once the buffer is full
+struct TextWriter
+{
+	TextWriter( char * a_pBuffer, size_t a_Size ) : m_pStart( a_pBuffer ), m_pPos( a_pBuffer ), m_pEnd( a_pBuffer + a_Size - 1 )
+	{
+		*m_pPos = 0;
+	}
+
+	void Append( const char * a_pText, size_t a_Size )
+	{
+		if ( a_Size > (size_t)(m_pEnd - m_pPos) )
+			a_Size = m_pEnd - m_pPos;
+		memcpy( m_pPos, a_pText, a_Size );
+		m_pPos += a_Size;
+		*m_pPos = 0;
+	}
+	void Append( char a_Char )
+	{
+		Append( &a_Char, 1 );
+	}
+	size_t GetSize() const
+	{
+		return m_pPos - m_pStart;
+	}
+
+	char *	m_pStart;
+	char *	m_pPos;
+	char *	m_pEnd;
+};
+
+template<typename T>
+static void FormatValue( TextWriter & a_Output, const char * a_pSpec, const int * a_pStars, int a_Stars, T a_Value )
+{
+	char buffer[ 1024 ];
+	int len = 0;
+	if ( a_Stars == 0 )
+		len = snprintf( buffer, sizeof(buffer), a_pSpec, a_Value );
+	else if ( a_Stars == 1 )
+		len = snprintf( buffer, sizeof(buffer), a_pSpec, a_pStars[0], a_Value );
+	else
+		len = snprintf( buffer, sizeof(buffer), a_pSpec, a_pStars[0], a_pStars[1], a_Value );
+	if ( len > 0 )
+		a_Output.Append( buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1 );
+}
+
+//! Formats the recorded arguments with the call-site's format, the length modifiers are replaced to match
+//! how the arguments were stored. This doesn't allocate, so it can be used from a crash handler.
+static bool FormatEvent( const char * a_pFormat, RecordReader & a_Args, TextWriter & a_Output )
+{
+	FormatSpec spec;
+	char format[ 64 ];
+	const char * p = a_pFormat;
+	while( *p != 0 )
+	{
+		if ( *p != '%' )
+		{
+			a_Output.Append( *p++ );
+			continue;
+		}
+		if ( p[1] == '%' )
+		{
+			a_Output.Append( '%' );
+			p += 2;
+			continue;
+		}
+		if ( (p = ParseSpec( p + 1, spec )) == NULL )
+			return false;
+		unsigned char type = 0;
+		if (! GetArgType( spec, type ) || spec.m_Stars > 2 || spec.m_Flags.size() > sizeof(format) - 4 )
+			return false;
+
+		int stars[2] = { 0, 0 };
+		for(int i=0;i<spec.m_Stars;++i)
+		{
+			boost::int32_t star = 0;
+			if (! a_Args.Get( star ) )
+				return false;
+			stars[i] = star;
+		}
+
+		switch( type )
+		{
+		case BinaryReactor::ARG_INT:
+			{
+				boost::int32_t value = 0;
+				if (! a_Args.Get( value ) )
+					return false;
+				snprintf( format, sizeof(format), "%%%s%c", spec.m_Flags.c_str(), spec.m_Conversion );
+				FormatValue( a_Output, format, stars, spec.m_Stars, (int)value );
+			}
+			break;
+		case BinaryReactor::ARG_LONG:
+		case BinaryReactor::ARG_LONGLONG:
+		case BinaryReactor::ARG_SIZE:
+			{
+				boost::int64_t value = 0;
+				if (! a_Args.Get( value ) )
+					return false;
+				snprintf( format, sizeof(format), "%%%sll%c", spec.m_Flags.c_str(), spec.m_Conversion );
+				FormatValue( a_Output, format, stars, spec.m_Stars, (long long)value );
+			}
+			break;
+		case BinaryReactor::ARG_DOUBLE:
+		case BinaryReactor::ARG_LONGDOUBLE:
+			{
+				double value = 0.0;
+				if (! a_Args.Get( value ) )
+					return false;
+				snprintf( format, sizeof(format), "%%%s%c", spec.m_Flags.c_str(), spec.m_Conversion );
+				FormatValue( a_Output, format, stars, spec.m_Stars, value );
+			}
+			break;
+		case BinaryReactor::ARG_STRING:
+			{
+				const char * pValue = NULL;
+				boost::uint16_t len = 0;
+				if (! a_Args.GetStringData( pValue, len ) )
+					return false;
+				if ( spec.m_Flags.empty() )
+					a_Output.Append( pValue, len );
+				else
+				{
+					char value[ 1024 ];
+					if ( len >= sizeof(value) )
+						len = sizeof(value) - 1;
+					memcpy( value, pValue, len );
+					value[len] = 0;
+					snprintf( format, sizeof(format), "%%%ss", spec.m_Flags.c_str() );
+					FormatValue( a_Output, format, stars, spec.m_Stars, (const char *)value );
+				}
+			}
+			break;
+		case BinaryReactor::ARG_POINTER:
+			{
+				boost::uint64_t value = 0;
+				if (! a_Args.Get( value ) )
+					return false;
+				snprintf( format, sizeof(format), "%%%sp", spec.m_Flags.c_str() );
+				FormatValue( a_Output, format, stars, spec.m_Stars, (void *)(size_t)value );
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool BinaryReactor::FormatArgs( const char * a_pFormat, const char * a_pArgs, size_t a_ArgSize, char * a_pOutput, size_t a_OutputSize )
+{
+	RecordReader args( a_pArgs, a_ArgSize );
+	TextWriter output( a_pOutput, a_OutputSize );
+	return FormatEvent( a_pFormat, args, output );
+}
+
+static std::string FormatTimestamp( boost::uint64_t a_Timestamp )
+{
+	Time time( (time_t)(a_Timestamp / 1000000) );
+	return time.GetFormattedTime( "%x %X" ) + StringUtil::Format( ".%0.3d", (int)((a_Timestamp / 1000) % 1000) );
+}
+
+bool BinaryReactor::Decode( const std::string & a_LogFile, std::ostream & a_Output )
+{
+	std::ifstream input( a_LogFile.c_str(), std::ios::in | std::ios::binary );
+	if (! input.is_open() )
+		return false;
+	std::string data( (std::istreambuf_iterator<char>( input )), std::istreambuf_iterator<char>() );
+
+	RecordReader reader( data.c_str(), data.size() );
+	char magic[ sizeof(BINARY_LOG_MAGIC) ];
+	boost::uint32_t order = 0;
+	if (! reader.Get( magic ) || memcmp( magic, BINARY_LOG_MAGIC, sizeof(magic) ) != 0 )
+		return false;
+	if (! reader.Get( order ) || order != BINARY_LOG_ORDER )
+		return false;
+
+	std::vector<DecodedCallsite> callsites;
+	std::vector<char> buffer( 64 * 1024 );
+	while( reader.m_pPos < reader.m_pEnd )
+	{
+		char type = 0;
+		reader.Get( type );
+
+		if ( type == RECORD_CALLSITE )
+		{
+			boost::uint32_t id = 0;
+			DecodedCallsite callsite;
+			if (! reader.Get( id ) || !reader.Get( callsite.m_Level ) || !reader.GetString<boost::uint32_t>( callsite.m_SubSystem )
+				|| !reader.GetString<boost::uint32_t>( callsite.m_File ) || !reader.Get( callsite.m_Line )
+				|| !reader.GetString<boost::uint32_t>( callsite.m_Format ) )
+				return false;
+			if ( id >= callsites.size() )
+				callsites.resize( id + 1 );
+			callsites[id] = callsite;
+		}
+		else if ( type == RECORD_EVENT )
+		{
+			boost::uint32_t id = 0;
+			boost::uint64_t timestamp = 0;
+			boost::uint16_t argSize = 0;
+			if (! reader.Get( id ) || !reader.Get( timestamp ) || !reader.Get( argSize )
+				|| (size_t)(reader.m_pEnd - reader.m_pPos) < argSize )
+				return false;
+
+			RecordReader args( reader.m_pPos, argSize );
+			reader.m_pPos += argSize;
+
+			// the size of the event is known, so one that can't be formatted is skipped instead of losing the rest..
+			TextWriter message( &buffer[0], buffer.size() );
+			if ( id >= callsites.size() || !FormatEvent( callsites[id].m_Format.c_str(), args, message ) )
+			{
+				a_Output << "[" << FormatTimestamp( timestamp ) << "] (bad record " << id << ")\n";
+				continue;
+			}
+			const DecodedCallsite & callsite = callsites[id];
+			a_Output << "[" << FormatTimestamp( timestamp ) << "][" << Log::LevelText( (LogLevel)callsite.m_Level ) << "]["
+				<< callsite.m_SubSystem << "] " << message.m_pStart << "\n";
+		}
+		else if ( type == RECORD_TEXT )
+		{
+			boost::uint8_t level = 0;
+			boost::uint64_t timestamp = 0;
+			std::string subSystem, message;
+			if (! reader.Get( level ) || !reader.Get( timestamp ) || !reader.GetString<boost::uint32_t>( subSystem )
+				|| !reader.GetString<boost::uint32_t>( message ) )
+				return false;
+			a_Output << "[" << FormatTimestamp( timestamp ) << "][" << Log::LevelText( (LogLevel)level ) << "]["
+				<< subSystem << "] " << message << "\n";
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,189 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#ifndef WDC_BINARY_LOG_H
+#define WDC_BINARY_LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "boost/atomic.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/thread.hpp"
+
+#include "Log.h"
+#include "UtilsLib.h"		// include last
+
+//! Log reactor that writes a compact binary log instead of text. Records from the BLOG_ macros store a call-site
+//! id, a timestamp and the raw arguments, the format string is written once per call-site, so nothing is formatted
+//! while logging. Records from the text Log functions are stored with their formatted message. Use Decode() or the
+//! log_decode tool to turn the binary log back into the same text FileReactor writes. The other reactors still get
+//! BLOG_ records as text when their level admits them, so only levels no text reactor wants skip formatting.
+class UTILS_API BinaryReactor : public ILogReactor
+{
+public:
+	RTTI_DECL();
+
+	//! Types
+	enum ArgType
+	{
+		ARG_INT,
+		ARG_LONG,
+		ARG_LONGLONG,
+		ARG_SIZE,
+		ARG_DOUBLE,
+		ARG_LONGDOUBLE,
+		ARG_STRING,
+		ARG_POINTER
+	};
+	typedef std::vector<unsigned char>		ArgList;
+
+	//! A static instance of this is created by each BLOG_ macro, a_pSubSystem must be a literal.
+	struct UTILS_API Callsite
+	{
+		Callsite( LogLevel a_Level, const char * a_pSubSystem, const char * a_pFile, int a_Line ) :
+			m_Level( a_Level ),
+			m_pSubSystem( a_pSubSystem ),
+			m_pFile( a_pFile ),
+			m_Line( a_Line ),
+			m_pFormat( NULL ),
+			m_bBinary( false ),
+			m_Id( 0 )
+		{}
+
+		LogLevel		m_Level;
+		const char *	m_pSubSystem;
+		const char *	m_pFile;
+		int				m_Line;
+		const char *	m_pFormat;		// set on first use
+		ArgList			m_Args;			// parsed from the format on first use
+		bool			m_bBinary;		// false if the format can't be recorded, these are logged as text
+		boost::atomic<unsigned int>
+						m_Id;			// 0 until first use
+	};
+
+	//! Construction
+	BinaryReactor( const char * a_pLogFile, LogLevel a_MinLevel = LL_DEBUG_LOW, size_t a_MaxBuffer = 4 * 1024 * 1024 );
+	~BinaryReactor();
+
+	//! Returns the current binary reactor, NULL if none has been created.
+	static BinaryReactor * Instance();
+
+	//! ILogReactor interface
+	virtual void Process(const LogRecord & a_Record);
+	virtual void SetLogLevel( LogLevel a_Level );
+	virtual LogLevel GetLogLevel() const
+	{
+		return m_MinLevel;
+	}
+
+	//! Accessors
+	//! Returns the number of records written, both binary and text.
+	unsigned int GetRecords() const
+	{
+		return m_Records;
+	}
+	//! Returns the number of records dropped because the write thread fell behind by more than the max buffer.
+	unsigned int GetDropped() const
+	{
+		return m_Dropped;
+	}
+
+	//! Records a call from one of the BLOG_ macros. This falls back to Log::DoLog() when there is no binary
+	//! reactor or the level is below it. Otherwise the record is written binary and passed as text to the
+	//! other reactors whose level admits it.
+	static void Write( Callsite & a_Callsite, const char * a_pFormat, ... );
+	//! Parses the printf conversions of a_pFormat into the types of the arguments they read, returns false
+	//! if the format has a conversion that can't be recorded.
+	static bool ParseFormat( const char * a_pFormat, ArgList & a_Args );
+	//! Copies the arguments of the given types from a_Args into a_pBuffer, string arguments are cut short
+	//! to leave room for the arguments after them. Returns the number of bytes written, or -1 if the
+	//! arguments don't fit even with the strings cut to nothing.
+	static int EncodeArgs( const ArgList & a_Types, va_list a_Args, char * a_pBuffer, size_t a_Size );
+	//! Copies the arguments read by a_pFormat into a_pBuffer without parsing the format into a list first, 
+	//! strings are cut short the same way. Returns the number of bytes written, or -1 if the format can't 
+	//! be recorded or the arguments didn't fit.
+	static int EncodeArgs( const char * a_pFormat, va_list a_Args, char * a_pBuffer, size_t a_Size );
+	//! Formats arguments written by EncodeArgs() into a_pOutput, the text is cut short to fit. This doesn't
+	//! allocate memory. Returns false if the arguments don't match the format.
+	static bool FormatArgs( const char * a_pFormat, const char * a_pArgs, size_t a_ArgSize, 
+		char * a_pOutput, size_t a_OutputSize );
+	//! Decodes a binary log into text lines formatted like FileReactor, returns false if the file
+	//! is not a binary log or is truncated. Lines decoded before an error are still written, an event 
+	//! that doesn't match it's call-site is written as a bad record and skipped.
+	static bool Decode( const std::string & a_LogFile, std::ostream & a_Output );
+
+private:
+	//! Data
+	std::string			m_LogFile;
+	LogLevel			m_MinLevel;
+	size_t				m_MaxBuffer;
+	boost::uint64_t		m_EpochBase;		// epoch time in microseconds at m_MonotonicBase
+	boost::uint64_t		m_MonotonicBase;
+	volatile unsigned int
+						m_Records;
+	volatile unsigned int
+						m_Dropped;
+
+	boost::mutex		m_BufferLock;
+	std::string			m_Buffer;			// encoded records waiting for the write thread
+	std::vector<bool>	m_Defined;			// call-sites already written to this file, by id
+
+	volatile bool		m_bStopThread;
+	boost::thread *		m_pThread;
+	boost::mutex		m_WakeLock;
+	boost::condition_variable
+						m_WakeThread;
+
+	static BinaryReactor *
+						sm_pInstance;
+
+	boost::uint64_t GetTimestamp() const;
+	void Append( const char * a_pRecord, size_t a_Size, const Callsite * a_pCallsite );
+	void WriteThread();
+	static void Register( Callsite & a_Callsite, const char * a_pFormat );
+};
+
+//! Binary log macros, these take the same arguments as the Log functions. Without a BinaryReactor they
+//! log text like the LOG_ macros, and LOG_COMPILE_LEVEL removes the same levels.
+#define BLOG_IF_ENABLED( LEVEL, SUB, ... )		do { if ( Log::IsEnabled( LEVEL ) ) { \
+	static BinaryReactor::Callsite s_Callsite( LEVEL, SUB, __FILE__, __LINE__ ); \
+	BinaryReactor::Write( s_Callsite, __VA_ARGS__ ); } } while(0)
+
+#if LOG_COMPILE_LEVEL <= 0
+#define BLOG_DEBUG_LOW( SUB, ... )		BLOG_IF_ENABLED( LL_DEBUG_LOW, SUB, __VA_ARGS__ )
+#else
+#define BLOG_DEBUG_LOW( SUB, ... )		do {} while(0)
+#endif
+#if LOG_COMPILE_LEVEL <= 1
+#define BLOG_DEBUG_MED( SUB, ... )		BLOG_IF_ENABLED( LL_DEBUG_MED, SUB, __VA_ARGS__ )
+#else
+#define BLOG_DEBUG_MED( SUB, ... )		do {} while(0)
+#endif
+#if LOG_COMPILE_LEVEL <= 2
+#define BLOG_DEBUG_HIGH( SUB, ... )		BLOG_IF_ENABLED( LL_DEBUG_HIGH, SUB, __VA_ARGS__ )
+#define BLOG_DEBUG( SUB, ... )			BLOG_IF_ENABLED( LL_DEBUG, SUB, __VA_ARGS__ )
+#else
+#define BLOG_DEBUG_HIGH( SUB, ... )		do {} while(0)
+#define BLOG_DEBUG( SUB, ... )			do {} while(0)
+#endif
+
+#endif
@@ -163,7 +163,7 @@ bool DataCache::Save(const std::string & a_ID, const std::string & a_Data, bool
 	CacheItem & item = m_Cache[ id ];
 	item.m_Path = m_CachePath + id + m_Extension;
 	item.m_Id = id;
-	item.m_Time = Time().GetEpochTime();
+	item.m_Time = Time::GetCoarseTime().GetEpochTime();
 	item.m_Size = a_Data.size();
 
 	if ( a_bKeepInMemory )
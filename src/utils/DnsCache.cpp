@@ -0,0 +1,211 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include "DnsCache.h"
+#include "BinaryLog.h"
+#include "Log.h"
+#include "StringUtil.h"
+#include "Time.h"
+
+#include "boost/bind.hpp"
+
+DnsCache::DnsCache( boost::asio::io_service & a_Service ) :
+	m_Resolver( a_Service ),
+	m_TTL( 60.0 ),
+	m_NegativeTTL( 5.0 ),
+	m_RefreshTime( 10.0 ),
+	m_Hits( 0 ),
+	m_Misses( 0 ),
+	m_Lookups( 0 )
+{}
+
+DnsCache::~DnsCache()
+{
+	// any lookups still running are aborted, their handlers are never invoked since the io_service
+	// must have been stopped before we are destroyed..
+	m_Resolver.cancel();
+}
+
+size_t DnsCache::GetSize()
+{
+	boost::lock_guard<boost::mutex> lock( m_Lock );
+	return m_Entries.size();
+}
+
+void DnsCache::Resolve( const std::string & a_Host, unsigned int a_Port, const Handler & a_Handler )
+{
+	std::string key( StringUtil::Format( "%s:%u", a_Host.c_str(), a_Port ) );
+	boost::system::error_code error;
+	EndpointsSP spEndpoints;
+
+	{
+		boost::lock_guard<boost::mutex> lock( m_Lock );
+
+		double now = Time::GetCoarseMonotonicTime();
+		Entry & entry = m_Entries[ key ];
+		if ( entry.m_Expire <= now )
+		{
+			// not cached or expired, wait for the lookup and start one unless another request already did..
+			m_Misses++;
+			entry.m_Waiting.push_back( a_Handler );
+			if (! entry.m_bResolving )
+				StartLookup( key, a_Host, a_Port );
+			return;
+		}
+
+		m_Hits++;
+		error = entry.m_Error;
+		spEndpoints = entry.m_spEndpoints;
+
+		// refresh a host that is still being used before it expires, failures just expire..
+		if ( spEndpoints && !entry.m_bResolving && (entry.m_Expire - now) < m_RefreshTime )
+		{
+			BLOG_DEBUG_LOW( "DnsCache", "Refreshing %s", key.c_str() );
+			StartLookup( key, a_Host, a_Port );
+		}
+	}
+
+	a_Handler( error, spEndpoints );
+}
+
+void DnsCache::SetEndpoints( const std::string & a_Host, unsigned int a_Port, const Endpoints & a_Endpoints )
+{
+	boost::lock_guard<boost::mutex> lock( m_Lock );
+
+	Entry & entry = m_Entries[ StringUtil::Format( "%s:%u", a_Host.c_str(), a_Port ) ];
+	entry.m_spEndpoints.reset( new Endpoints( a_Endpoints ) );
+	entry.m_Error = boost::system::error_code();
+	entry.m_Expire = (std::numeric_limits<double>::max)();
+}
+
+size_t DnsCache::Purge()
+{
+	boost::lock_guard<boost::mutex> lock( m_Lock );
+
+	size_t purged = 0;
+	double now = Time::GetCoarseMonotonicTime();
+	for( EntryMap::iterator iEntry = m_Entries.begin(); iEntry != m_Entries.end(); )
+	{
+		if (! iEntry->second.m_bResolving && iEntry->second.m_Expire <= now )
+		{
+			m_Entries.erase( iEntry++ );
+			purged++;
+		}
+		else
+			++iEntry;
+	}
+
+	return purged;
+}
+
+void DnsCache::Clear()
+{
+	boost::lock_guard<boost::mutex> lock( m_Lock );
+	for( EntryMap::iterator iEntry = m_Entries.begin(); iEntry != m_Entries.end(); )
+	{
+		if (! iEntry->second.m_bResolving )
+			m_Entries.erase( iEntry++ );
+		else
+			++iEntry;
+	}
+}
+
+//! Called with m_Lock held, the resolver isn't safe to use from more than one thread at once.
+void DnsCache::StartLookup( const std::string & a_Key, const std::string & a_Host, unsigned int a_Port )
+{
+	m_Entries[ a_Key ].m_bResolving = true;
+	m_Lookups++;
+
+	boost::asio::ip::tcp::resolver::query q( a_Host, StringUtil::Format( "%u", a_Port ) );
+	m_Resolver.async_resolve( q, boost::bind( &DnsCache::OnResolved, this, a_Key,
+		boost::asio::placeholders::error, boost::asio::placeholders::iterator ) );
+}
+
+void DnsCache::OnResolved( const std::string & a_Key, const boost::system::error_code & a_Error,
+	boost::asio::ip::tcp::resolver::iterator a_Iterator )
+{
+	boost::system::error_code error( a_Error );
+	EndpointsSP spEndpoints;
+	if (! error )
+	{
+		Endpoints * pEndpoints = new Endpoints();
+		for(; a_Iterator != boost::asio::ip::tcp::resolver::iterator(); ++a_Iterator )
+			pEndpoints->push_back( a_Iterator->endpoint() );
+		Interleave( *pEndpoints );
+		spEndpoints.reset( pEndpoints );
+
+		if ( pEndpoints->size() == 0 )
+			error = boost::asio::error::host_not_found;
+	}
+
+	HandlerList waiting;
+	{
+		boost::lock_guard<boost::mutex> lock( m_Lock );
+
+		double now = Time::GetCoarseMonotonicTime();
+		Entry & entry = m_Entries[ a_Key ];
+		entry.m_bResolving = false;
+		if (! error )
+		{
+			entry.m_spEndpoints = spEndpoints;
+			entry.m_Error = error;
+			entry.m_Expire = now + m_TTL;
+		}
+		else if (! entry.m_spEndpoints || entry.m_Expire <= now )
+		{
+			entry.m_spEndpoints.reset();
+			entry.m_Error = error;
+			entry.m_Expire = now + m_NegativeTTL;
+		}
+		// else a failed refresh, keep the endpoints we have until they expire..
+		waiting.swap( entry.m_Waiting );
+	}
+
+	if ( error )
+	{
+		BLOG_DEBUG_LOW( "DnsCache", "Failed to resolve %s: %s", a_Key.c_str(), error.message().c_str() );
+		spEndpoints.reset();
+	}
+	for( HandlerList::iterator iHandler = waiting.begin(); iHandler != waiting.end(); ++iHandler )
+		(*iHandler)( error, spEndpoints );
+}
+
+void DnsCache::Interleave( Endpoints & a_Endpoints )
+{
+	if ( a_Endpoints.size() < 2 )
+		return;
+
+	Endpoints first, second;
+	bool bFirstV6 = a_Endpoints[0].address().is_v6();
+	for( Endpoints::const_iterator iEndpoint = a_Endpoints.begin(); iEndpoint != a_Endpoints.end(); ++iEndpoint )
+	{
+		if ( iEndpoint->address().is_v6() == bFirstV6 )
+			first.push_back( *iEndpoint );
+		else
+			second.push_back( *iEndpoint );
+	}
+
+	a_Endpoints.clear();
+	for(size_t i=0;i<first.size() || i<second.size();++i)
+	{
+		if ( i < first.size() )
+			a_Endpoints.push_back( first[i] );
+		if ( i < second.size() )
+			a_Endpoints.push_back( second[i] );
+	}
+}
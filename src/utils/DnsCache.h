@@ -0,0 +1,143 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#ifndef WDC_DNS_CACHE_H
+#define WDC_DNS_CACHE_H
+
+#include <limits>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/asio.hpp"
+#include "boost/atomic.hpp"
+#include "boost/function.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "UtilsLib.h"		// include last
+
+//! Caches host name lookups for the web clients. Lookups are made with an async resolver on the given
+//! io_service, so no io_service thread waits on DNS. Concurrent requests for a host that isn't cached
+//! share one lookup, failed lookups are cached for a shorter time, and a host that is used shortly before
+//! its entry expires is looked up again in the background so busy hosts don't wait on DNS at all.
+class UTILS_API DnsCache
+{
+public:
+	//! Types
+	typedef boost::asio::ip::tcp::endpoint		Endpoint;
+	typedef std::vector<Endpoint>				Endpoints;
+	typedef boost::shared_ptr<const Endpoints>	EndpointsSP;
+	//! Invoked with the endpoints of a host, or an error and an empty pointer if the lookup failed.
+	typedef boost::function<void( const boost::system::error_code &, EndpointsSP )>
+												Handler;
+
+	//! Construction
+	DnsCache( boost::asio::io_service & a_Service );
+	~DnsCache();
+
+	//! Accessors
+	//! Returns the number of requests answered from the cache, including cached failures.
+	unsigned int GetHits() const
+	{
+		return m_Hits;
+	}
+	//! Returns the number of requests that had to wait for a lookup, including those that joined one.
+	unsigned int GetMisses() const
+	{
+		return m_Misses;
+	}
+	//! Returns the number of lookups made, including background refreshes.
+	unsigned int GetLookups() const
+	{
+		return m_Lookups;
+	}
+	size_t GetSize();
+
+	//! Mutators
+	//! Sets how long a lookup is cached in seconds, the resolver doesn't return the record TTL.
+	void SetTTL( double a_TTL )
+	{
+		m_TTL = a_TTL;
+	}
+	//! Sets how long a failed lookup is cached in seconds.
+	void SetNegativeTTL( double a_TTL )
+	{
+		m_NegativeTTL = a_TTL;
+	}
+	//! A host used within this many seconds of its entry expiring is looked up again in the background.
+	void SetRefreshTime( double a_Refresh )
+	{
+		m_RefreshTime = a_Refresh;
+	}
+
+	//! Adds an entry for a_Host that never expires, the endpoints are used in the given order. This replaces
+	//! any cached entry, Clear() removes it.
+	void SetEndpoints( const std::string & a_Host, unsigned int a_Port, const Endpoints & a_Endpoints );
+	//! Resolves a_Host, a_Handler is invoked before this returns when the host is cached, otherwise
+	//! it's invoked from an io_service thread when the lookup completes.
+	void Resolve( const std::string & a_Host, unsigned int a_Port, const Handler & a_Handler );
+	//! Removes expired entries, returns the number removed.
+	size_t Purge();
+	//! Removes all entries that aren't being looked up.
+	void Clear();
+
+	//! Orders endpoints so IPv6 and IPv4 addresses alternate, starting with the family of the first one,
+	//! otherwise keeping the resolver's order. This is done to each lookup, so a client connecting to them
+	//! in turn tries the other family second.
+	static void Interleave( Endpoints & a_Endpoints );
+
+private:
+	//! Types
+	typedef std::list<Handler>		HandlerList;
+	struct Entry
+	{
+		Entry() : m_Expire( 0.0 ), m_bResolving( false )
+		{}
+
+		EndpointsSP		m_spEndpoints;		// NULL if the last lookup failed
+		boost::system::error_code
+						m_Error;			// error of the last lookup
+		double			m_Expire;			// monotonic time this entry expires, 0 until looked up
+		bool			m_bResolving;		// true while a lookup is running
+		HandlerList		m_Waiting;			// requests waiting on the lookup
+	};
+	typedef std::map<std::string, Entry>	EntryMap;
+
+	//! Data
+	boost::asio::ip::tcp::resolver
+						m_Resolver;
+	boost::mutex		m_Lock;
+	EntryMap			m_Entries;
+	volatile double		m_TTL;
+	volatile double		m_NegativeTTL;
+	volatile double		m_RefreshTime;
+	boost::atomic<unsigned int>
+						m_Hits;
+	boost::atomic<unsigned int>
+						m_Misses;
+	boost::atomic<unsigned int>
+						m_Lookups;
+
+	void StartLookup( const std::string & a_Key, const std::string & a_Host, unsigned int a_Port );
+	void OnResolved( const std::string & a_Key, const boost::system::error_code & a_Error,
+		boost::asio::ip::tcp::resolver::iterator a_Iterator );
+};
+
+#endif
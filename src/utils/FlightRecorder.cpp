@@ -0,0 +1,354 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <exception>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "FlightRecorder.h"
+#include "Time.h"
+
+const size_t SUBSYSTEM_SIZE = 32;		// sub-systems are cut short to fit
+const size_t DATA_SIZE = 448;			// format and arguments, or the formatted message
+const size_t MAX_FORMAT = 256;			// longer formats are formatted when recorded
+const size_t MAX_CRASH_FILE = 1024;
+
+//! One recorded message. m_Sequence is odd while the slot is being written, readers check it before and
+//! after copying the slot to skip slots that were written while they copied.
+struct FlightRecorder::Slot
+{
+	boost::atomic<boost::uint64_t>
+					m_Sequence;
+	boost::uint64_t	m_Timestamp;		// epoch time in microseconds
+	boost::uint8_t	m_Level;
+	boost::uint8_t	m_bText;			// m_Data holds the formatted message
+	boost::uint16_t	m_FormatSize;		// including the terminator
+	boost::uint16_t	m_ArgSize;			// arguments follow the format
+	char			m_SubSystem[ SUBSYSTEM_SIZE ];
+	char			m_Data[ DATA_SIZE ];
+};
+
+struct FlightRecorder::Ring
+{
+	Ring( size_t a_Size ) : m_Size( a_Size ), m_pSlots( new Slot[ a_Size ] ), m_Next( 0 )
+	{
+		for(size_t i=0;i<m_Size;++i)
+			m_pSlots[i].m_Sequence = 0;
+		Time now;
+		m_MonotonicBase = Time::GetCoarseMonotonicMicroseconds();
+		m_EpochBase = ((boost::uint64_t)now.GetTime() * 1000000) + ((boost::uint64_t)now.GetMilliseconds() * 1000);
+	}
+
+	size_t			m_Size;
+	Slot *			m_pSlots;
+	boost::atomic<boost::uint64_t>
+					m_Next;				// next record number, record N is in slot N % m_Size
+	boost::uint64_t	m_EpochBase;		// epoch time in microseconds at m_MonotonicBase
+	boost::uint64_t	m_MonotonicBase;
+};
+
+volatile int FlightRecorder::sm_MinLevel = LL_CRITICAL + 1;
+boost::atomic<FlightRecorder::Ring *> FlightRecorder::sm_pRing( NULL );
+
+static char						s_CrashFile[ MAX_CRASH_FILE ];
+static volatile sig_atomic_t	s_bCrashed = 0;
+static std::terminate_handler	s_PreviousTerminate = NULL;
+
+void FlightRecorder::Start( size_t a_Records /*= 4096*/, LogLevel a_MinLevel /*= LL_DEBUG_LOW*/ )
+{
+	if ( a_Records < 1 )
+		a_Records = 1;
+
+	Ring * pRing = sm_pRing.load();
+	if ( pRing == NULL || pRing->m_Size != a_Records )
+		sm_pRing.store( new Ring( a_Records ) );
+
+	sm_MinLevel = a_MinLevel;
+	Log::UpdateMinLevel();
+}
+
+void FlightRecorder::Stop()
+{
+	sm_MinLevel = LL_CRITICAL + 1;
+	Log::UpdateMinLevel();
+}
+
+bool FlightRecorder::IsActive()
+{
+	return sm_MinLevel <= LL_CRITICAL;
+}
+
+boost::uint64_t FlightRecorder::GetRecords()
+{
+	Ring * pRing = sm_pRing.load();
+	return pRing != NULL ? pRing->m_Next.load() : 0;
+}
+
+void FlightRecorder::Record( LogLevel a_Level, const char * a_pSub, const char * a_pFormat, va_list a_Args )
+{
+	Write( a_Level, a_pSub, a_pFormat, NULL, a_Args );
+}
+
+void FlightRecorder::Record( LogLevel a_Level, const char * a_pSub, const char * a_pFormat,
+	const BinaryReactor::ArgList & a_Types, va_list a_Args )
+{
+	Write( a_Level, a_pSub, a_pFormat, &a_Types, a_Args );
+}
+
+void FlightRecorder::Write( LogLevel a_Level, const char * a_pSub, const char * a_pFormat,
+	const BinaryReactor::ArgList * a_pTypes, va_list a_Args )
+{
+	Ring * pRing = sm_pRing.load( boost::memory_order_acquire );
+	if ( pRing == NULL || a_pFormat == NULL )
+		return;
+
+	boost::uint64_t record = pRing->m_Next.fetch_add( 1, boost::memory_order_relaxed );
+	Slot & slot = pRing->m_pSlots[ record % pRing->m_Size ];
+	slot.m_Sequence.store( record * 2 + 1, boost::memory_order_relaxed );
+	boost::atomic_thread_fence( boost::memory_order_release );
+
+	slot.m_Timestamp = pRing->m_EpochBase + (Time::GetCoarseMonotonicMicroseconds() - pRing->m_MonotonicBase);
+	slot.m_Level = (boost::uint8_t)a_Level;
+
+	if ( a_pSub == NULL )
+		a_pSub = "";
+	size_t subSize = strlen( a_pSub );
+	if ( subSize >= SUBSYSTEM_SIZE )
+		subSize = SUBSYSTEM_SIZE - 1;
+	memcpy( slot.m_SubSystem, a_pSub, subSize );
+	slot.m_SubSystem[ subSize ] = 0;
+
+	// copy the format and the raw arguments, the format is copied since it may not be a literal..
+	int argSize = -1;
+	size_t formatSize = strlen( a_pFormat ) + 1;
+	if ( formatSize <= MAX_FORMAT )
+	{
+		memcpy( slot.m_Data, a_pFormat, formatSize );
+		if ( a_pTypes != NULL )
+			argSize = BinaryReactor::EncodeArgs( *a_pTypes, a_Args, slot.m_Data + formatSize, DATA_SIZE - formatSize );
+		else
+			argSize = BinaryReactor::EncodeArgs( a_pFormat, a_Args, slot.m_Data + formatSize, DATA_SIZE - formatSize );
+	}
+
+	if ( argSize >= 0 )
+	{
+		slot.m_bText = 0;
+		slot.m_FormatSize = (boost::uint16_t)formatSize;
+		slot.m_ArgSize = (boost::uint16_t)argSize;
+	}
+	else
+	{
+		// can't be recorded as arguments, so pay for formatting it now..
+		va_list args;
+		va_copy( args, a_Args );
+		vsnprintf( slot.m_Data, DATA_SIZE, a_pFormat, args );
+		va_end( args );
+		slot.m_Data[ DATA_SIZE - 1 ] = 0;
+
+		slot.m_bText = 1;
+		slot.m_FormatSize = 0;
+		slot.m_ArgSize = 0;
+	}
+
+	slot.m_Sequence.store( record * 2 + 2, boost::memory_order_release );
+}
+
+bool FlightRecorder::Dump( const char * a_pFile )
+{
+#ifdef _WIN32
+	int file = _open( a_pFile, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE );
+#else
+	int file = open( a_pFile, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+#endif
+	if ( file < 0 )
+		return false;
+
+	bool bResult = Dump( file );
+#ifdef _WIN32
+	_close( file );
+#else
+	close( file );
+#endif
+	return bResult;
+}
+
+static bool WriteFile( int a_File, const char * a_pData, size_t a_Size )
+{
+	while( a_Size > 0 )
+	{
+#ifdef _WIN32
+		int written = _write( a_File, a_pData, (unsigned int)a_Size );
+#else
+		ssize_t written = write( a_File, a_pData, a_Size );
+#endif
+		if ( written <= 0 )
+			return false;
+		a_pData += written;
+		a_Size -= written;
+	}
+	return true;
+}
+
+bool FlightRecorder::Dump( int a_File )
+{
+	Ring * pRing = sm_pRing.load( boost::memory_order_acquire );
+	if ( pRing == NULL )
+		return true;
+
+	boost::uint64_t end = pRing->m_Next.load( boost::memory_order_acquire );
+	boost::uint64_t begin = end > pRing->m_Size ? end - pRing->m_Size : 0;
+
+	// everything below is on the stack, a crash may have left the heap in any state..
+	char line[ 4096 ];
+	int len = snprintf( line, sizeof(line), "---- Flight recorder, records %llu to %llu ----\n",
+		(unsigned long long)begin, (unsigned long long)end );
+	if (! WriteFile( a_File, line, len ) )
+		return false;
+
+	char subSystem[ SUBSYSTEM_SIZE ];
+	char data[ DATA_SIZE ];
+	char message[ 2048 ];
+	for( boost::uint64_t record = begin; record < end; ++record )
+	{
+		Slot & slot = pRing->m_pSlots[ record % pRing->m_Size ];
+		boost::uint64_t sequence = record * 2 + 2;
+		if ( slot.m_Sequence.load( boost::memory_order_acquire ) != sequence )
+			continue;		// still being written, or already overwritten
+
+		boost::uint64_t timestamp = slot.m_Timestamp;
+		LogLevel level = (LogLevel)slot.m_Level;
+		bool bText = slot.m_bText != 0;
+		size_t formatSize = slot.m_FormatSize;
+		size_t argSize = slot.m_ArgSize;
+		memcpy( subSystem, slot.m_SubSystem, sizeof(subSystem) );
+		memcpy( data, slot.m_Data, sizeof(data) );
+
+		boost::atomic_thread_fence( boost::memory_order_acquire );
+		if ( slot.m_Sequence.load( boost::memory_order_relaxed ) != sequence )
+			continue;
+
+		subSystem[ sizeof(subSystem) - 1 ] = 0;
+		data[ sizeof(data) - 1 ] = 0;
+		if ( bText )
+			snprintf( message, sizeof(message), "%s", data );
+		else if ( formatSize == 0 || formatSize + argSize > sizeof(data)
+			|| !BinaryReactor::FormatArgs( data, data + formatSize, argSize, message, sizeof(message) ) )
+			snprintf( message, sizeof(message), "(bad record) %s", formatSize > 0 ? data : "" );
+
+		// gmtime doesn't take the time zone lock that localtime does, so the dump is in UTC..
+		time_t seconds = (time_t)(timestamp / 1000000);
+		struct tm parts;
+#ifdef _WIN32
+		gmtime_s( &parts, &seconds );
+#else
+		gmtime_r( &seconds, &parts );
+#endif
+		len = snprintf( line, sizeof(line), "[%04d-%02d-%02d %02d:%02d:%02d.%03dZ][%s][%s] %s\n",
+			parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday, parts.tm_hour, parts.tm_min, parts.tm_sec,
+			(int)((timestamp / 1000) % 1000), Log::LevelText( level ), subSystem, message );
+		if ( len < 0 )
+			continue;
+		if ( len >= (int)sizeof(line) )
+		{
+			len = sizeof(line) - 1;
+			line[ len - 1 ] = '\n';
+		}
+		if (! WriteFile( a_File, line, len ) )
+			return false;
+	}
+
+	return true;
+}
+
+static void OnTerminate()
+{
+	FlightRecorder::Dump( s_CrashFile );
+	s_bCrashed = 1;
+
+	if ( s_PreviousTerminate != NULL )
+		s_PreviousTerminate();
+	abort();
+}
+
+static void OnSignal( int a_Signal )
+{
+	if (! s_bCrashed )
+	{
+		s_bCrashed = 1;
+		FlightRecorder::Dump( s_CrashFile );
+	}
+
+	// the handler was reset before it was called, so this gets the default action (e.g. a core dump)..
+	signal( a_Signal, SIG_DFL );
+	raise( a_Signal );
+}
+
+#ifdef _WIN32
+static LPTOP_LEVEL_EXCEPTION_FILTER s_PreviousFilter = NULL;
+
+static LONG WINAPI OnUnhandledException( EXCEPTION_POINTERS * a_pInfo )
+{
+	if (! s_bCrashed )
+	{
+		s_bCrashed = 1;
+		FlightRecorder::Dump( s_CrashFile );
+	}
+	return s_PreviousFilter != NULL ? s_PreviousFilter( a_pInfo ) : EXCEPTION_CONTINUE_SEARCH;
+}
+#endif
+
+void FlightRecorder::InstallCrashHandler( const char * a_pFile )
+{
+	strncpy( s_CrashFile, a_pFile, sizeof(s_CrashFile) - 1 );
+	s_CrashFile[ sizeof(s_CrashFile) - 1 ] = 0;
+
+	std::terminate_handler previous = std::set_terminate( OnTerminate );
+	if ( previous != OnTerminate )
+		s_PreviousTerminate = previous;
+
+#ifdef _WIN32
+	LPTOP_LEVEL_EXCEPTION_FILTER previousFilter = SetUnhandledExceptionFilter( OnUnhandledException );
+	if ( previousFilter != OnUnhandledException )
+		s_PreviousFilter = previousFilter;
+	signal( SIGABRT, OnSignal );
+#else
+	const int SIGNALS[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+	for(size_t i=0;i<sizeof(SIGNALS)/sizeof(SIGNALS[0]);++i)
+	{
+		struct sigaction action;
+		memset( &action, 0, sizeof(action) );
+		action.sa_handler = OnSignal;
+		action.sa_flags = SA_RESETHAND;
+		sigemptyset( &action.sa_mask );
+		sigaction( SIGNALS[i], &action, NULL );
+	}
+#endif
+}
@@ -0,0 +1,87 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#ifndef WDC_FLIGHT_RECORDER_H
+#define WDC_FLIGHT_RECORDER_H
+
+#include <stdarg.h>
+
+#include "boost/atomic.hpp"
+#include "boost/cstdint.hpp"
+
+#include "Log.h"
+#include "BinaryLog.h"
+#include "UtilsLib.h"		// include last
+
+//! Keeps the most recent log records in a fixed size in-memory ring, whatever the level of the reactors, so
+//! the lead up to a crash can be written out even when the log file is at LL_STATUS or hasn't been flushed.
+//! Records are not formatted when recorded, the format and the raw arguments are copied into a slot and
+//! only formatted by Dump(). Writers claim slots with an atomic counter and never take a lock.
+class UTILS_API FlightRecorder
+{
+public:
+	//! Start recording the last a_Records records at a_MinLevel and above. The ring is allocated once and kept
+	//! after Stop(), since a thread may still be writing into it. Calling Start() again with a different
+	//! size allocates a new ring and leaves the old one.
+	static void Start( size_t a_Records = 4096, LogLevel a_MinLevel = LL_DEBUG_LOW );
+	static void Stop();
+	static bool IsActive();
+	//! Returns true if a record at this level would be recorded, this is one compare.
+	static bool IsRecording( LogLevel a_Level )
+	{
+		return a_Level >= sm_MinLevel;
+	}
+	//! Returns the lowest level recorded, LL_CRITICAL + 1 when stopped.
+	static int GetLevel()
+	{
+		return sm_MinLevel;
+	}
+	//! Returns the number of records written since the first Start(), including those since overwritten.
+	static boost::uint64_t GetRecords();
+
+	//! Records a message, called by Log::DoLog() and BinaryReactor::Write().
+	static void Record( LogLevel a_Level, const char * a_pSub, const char * a_pFormat, va_list a_Args );
+	//! Records a message from a BLOG_ call-site, using the argument types it already parsed.
+	static void Record( LogLevel a_Level, const char * a_pSub, const char * a_pFormat,
+		const BinaryReactor::ArgList & a_Types, va_list a_Args );
+
+	//! Writes the recorded messages to a_pFile as text lines, oldest first, replacing the file. This doesn't
+	//! lock or allocate, so it's safe to call from a crash handler. Records being written at the time are skipped.
+	static bool Dump( const char * a_pFile );
+	//! Writes the recorded messages to an open file.
+	static bool Dump( int a_File );
+	//! Dumps to a_pFile when the process crashes: on a fatal signal, when std::terminate() is called and on
+	//! Windows for an unhandled exception. After the dump the previous terminate handler or exception filter
+	//! runs, and fatal signals get their default action (e.g. a core dump).
+	static void InstallCrashHandler( const char * a_pFile );
+
+private:
+	//! Types
+	struct Slot;
+	struct Ring;
+
+	//! Data
+	static volatile int		sm_MinLevel;
+	static boost::atomic<Ring *>
+							sm_pRing;
+
+	static void Write( LogLevel a_Level, const char * a_pSub, const char * a_pFormat,
+		const BinaryReactor::ArgList * a_pTypes, va_list a_Args );
+};
+
+#endif
@@ -0,0 +1,399 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#ifndef WDC_FUTURE_H
+#define WDC_FUTURE_H
+
+#include <vector>
+
+#include "boost/atomic.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+
+#include "Delegate.h"
+#include "ThreadPool.h"
+#include "Time.h"
+#include "WatsonException.h"
+#include "tinythread++/tinythread.h"
+
+//! How a continuation is invoked once a future completes.
+enum FutureDispatch
+{
+	DISPATCH_INLINE,		// invoked by the thread that completes the future, or right away if already complete
+	DISPATCH_MAIN,			// queued to the main thread
+	DISPATCH_THREAD			// queued to a thread of the default ThreadPool
+};
+
+//! Shared state between a Promise and it's futures, this is only allocated for a future that isn't complete yet.
+template<typename T>
+class FutureState
+{
+public:
+	//! Types
+	typedef boost::shared_ptr<FutureState>		SP;
+
+	//! Used by WhenAll() and WhenAny() to find out when an input completes. The value is passed in, so a listener
+	//! doesn't need to hold the inputs, which hold the listener until they complete.
+	class IListener
+	{
+	public:
+		virtual ~IListener()
+		{}
+		virtual void OnReady( size_t a_nIndex, const T & a_Value ) = 0;
+	};
+	typedef boost::shared_ptr<IListener>		ListenerSP;
+
+	//! Construction
+	FutureState() : m_bReady( false )
+	{}
+
+	bool IsReady() const
+	{
+		return m_bReady;
+	}
+	//! Only valid once IsReady() returns true.
+	const T & GetValue() const
+	{
+		return m_Value;
+	}
+
+	//! Complete this state and run the continuations, returns false if already complete.
+	bool SetValue( const T & a_Value )
+	{
+		ContinuationList continuations;
+		ListenerList listeners;
+
+		m_Lock.lock();
+		if ( m_bReady )
+		{
+			m_Lock.unlock();
+			return false;
+		}
+		m_Value = a_Value;
+		m_bReady = true;
+		continuations.swap( m_Continuations );
+		listeners.swap( m_Listeners );
+		m_Ready.notify_all();
+		m_Lock.unlock();
+
+		// invoke with no lock, a continuation may well add another continuation..
+		for( typename ContinuationList::iterator iCont = continuations.begin(); iCont != continuations.end(); ++iCont )
+			Dispatch( iCont->m_Callback, iCont->m_Dispatch, m_Value );
+		for( typename ListenerList::iterator iListener = listeners.begin(); iListener != listeners.end(); ++iListener )
+			iListener->m_spListener->OnReady( iListener->m_nIndex, m_Value );
+		return true;
+	}
+
+	void AddContinuation( Delegate<T> a_Callback, FutureDispatch a_Dispatch )
+	{
+		m_Lock.lock();
+		if (! m_bReady )
+		{
+			m_Continuations.push_back( Continuation( a_Callback, a_Dispatch ) );
+			m_Lock.unlock();
+			return;
+		}
+		m_Lock.unlock();
+
+		Dispatch( a_Callback, a_Dispatch, m_Value );
+	}
+
+	void AddListener( const ListenerSP & a_spListener, size_t a_nIndex )
+	{
+		m_Lock.lock();
+		if (! m_bReady )
+		{
+			m_Listeners.push_back( Listener( a_spListener, a_nIndex ) );
+			m_Lock.unlock();
+			return;
+		}
+		m_Lock.unlock();
+
+		a_spListener->OnReady( a_nIndex, m_Value );
+	}
+
+	//! Block until complete, a negative timeout waits forever. Returns false on timeout.
+	bool Wait( double a_fTimeout )
+	{
+		tthread::lock_guard<tthread::mutex> lock( m_Lock );
+		double fEnd = Time::GetMonotonicTime() + a_fTimeout;
+		while(! m_bReady )
+		{
+			if ( a_fTimeout < 0.0 )
+				m_Ready.wait( m_Lock );
+			else
+			{
+				double fRemaining = fEnd - Time::GetMonotonicTime();
+				if ( fRemaining <= 0.0 )
+					return false;
+				m_Ready.wait( m_Lock, (unsigned int)(fRemaining * 1000.0) + 1 );
+			}
+		}
+		return true;
+	}
+
+	static void Dispatch( Delegate<T> a_Callback, FutureDispatch a_Dispatch, const T & a_Value )
+	{
+		ThreadPool * pPool = ThreadPool::Instance();
+		if ( a_Dispatch == DISPATCH_MAIN && pPool != NULL )
+			pPool->InvokeOnMain<T>( a_Callback, a_Value );
+		else if ( a_Dispatch == DISPATCH_THREAD && pPool != NULL )
+			pPool->InvokeOnThread<T>( a_Callback, a_Value );
+		else
+			a_Callback( a_Value );
+	}
+
+private:
+	//! Types
+	struct Continuation
+	{
+		Continuation( Delegate<T> a_Callback, FutureDispatch a_Dispatch ) : m_Callback( a_Callback ), m_Dispatch( a_Dispatch )
+		{}
+
+		Delegate<T>		m_Callback;
+		FutureDispatch	m_Dispatch;
+	};
+	typedef std::vector<Continuation>		ContinuationList;
+
+	struct Listener
+	{
+		Listener( const ListenerSP & a_spListener, size_t a_nIndex ) : m_spListener( a_spListener ), m_nIndex( a_nIndex )
+		{}
+
+		ListenerSP		m_spListener;
+		size_t			m_nIndex;
+	};
+	typedef std::vector<Listener>			ListenerList;
+
+	//! Data
+	tthread::mutex		m_Lock;
+	tthread::condition_variable
+						m_Ready;
+	volatile bool		m_bReady;
+	T					m_Value;
+	ContinuationList	m_Continuations;
+	ListenerList		m_Listeners;
+};
+
+//! A value of type T that becomes available later, the value is provided by a Promise. A future that is created
+//! with a value is complete right away and doesn't allocate, continuations added to it are dispatched immediately.
+//! T must be default constructible and copyable, use a pointer or shared_ptr for large objects.
+template<typename T>
+class Future
+{
+public:
+	//! Types
+	typedef typename FutureState<T>::SP		StateSP;
+	typedef std::vector<Future>				FutureList;
+
+	//! Construction
+	Future() : m_bReady( false )
+	{}
+	//! Make a completed future
+	Future( const T & a_Value ) : m_bReady( true ), m_Value( a_Value )
+	{}
+	Future( const StateSP & a_spState ) : m_bReady( false ), m_spState( a_spState )
+	{}
+
+	//! Returns true if this future came from a Promise or was created with a value.
+	bool IsValid() const
+	{
+		return m_bReady || m_spState;
+	}
+	bool IsReady() const
+	{
+		return m_bReady || (m_spState && m_spState->IsReady());
+	}
+	//! Returns the value, this blocks until the future is complete.
+	const T & Get() const
+	{
+		if ( m_bReady )
+			return m_Value;
+		if (! m_spState )
+			throw WatsonException( "Future is not valid." );
+		m_spState->Wait( -1.0 );
+		return m_spState->GetValue();
+	}
+	//! Block until this future is complete, returns false on timeout.
+	bool Wait( double a_fTimeout = -1.0 ) const
+	{
+		if ( m_bReady )
+			return true;
+		if (! m_spState )
+			return false;
+		return m_spState->Wait( a_fTimeout );
+	}
+
+	//! Invoke the callback with the value once this future is complete.
+	void Then( Delegate<T> a_Callback, FutureDispatch a_Dispatch = DISPATCH_INLINE ) const
+	{
+		if ( m_bReady )
+			FutureState<T>::Dispatch( a_Callback, a_Dispatch, m_Value );
+		else if ( m_spState )
+			m_spState->AddContinuation( a_Callback, a_Dispatch );
+	}
+
+	//! Returns a future that completes with all the values once all the futures are complete, the returned
+	//! future is invalid if any of the futures is.
+	static Future< std::vector<T> > WhenAll( const FutureList & a_Futures );
+	//! Returns a future that completes with the index of the first future to complete, invalid futures are
+	//! skipped. The returned future is invalid if there is no valid future to wait on.
+	static Future<size_t> WhenAny( const FutureList & a_Futures );
+
+private:
+	//! Types
+	class WhenAllListener;
+	class WhenAnyListener;
+
+	//! Data
+	bool		m_bReady;
+	T			m_Value;
+	StateSP		m_spState;
+};
+
+//! The producer side of a Future, a promise may be copied and completed from any thread.
+template<typename T>
+class Promise
+{
+public:
+	//! Construction
+	Promise() : m_spState( boost::make_shared< FutureState<T> >() )
+	{}
+
+	Future<T> GetFuture() const
+	{
+		return Future<T>( m_spState );
+	}
+	bool IsReady() const
+	{
+		return m_spState->IsReady();
+	}
+
+	//! Complete the future, returns false if it was already complete.
+	bool SetValue( const T & a_Value ) const
+	{
+		return m_spState->SetValue( a_Value );
+	}
+
+private:
+	//! Data
+	typename FutureState<T>::SP		m_spState;
+};
+
+template<typename T>
+class Future<T>::WhenAllListener : public FutureState<T>::IListener
+{
+public:
+	WhenAllListener( size_t a_nPending ) :
+		m_Values( a_nPending ),
+		m_nPending( (int)a_nPending )
+	{}
+
+	virtual void OnReady( size_t a_nIndex, const T & a_Value )
+	{
+		m_Values[ a_nIndex ] = a_Value;
+		if ( --m_nPending == 0 )
+			m_Promise.SetValue( m_Values );
+	}
+
+	std::vector<T>		m_Values;
+	boost::atomic<int>	m_nPending;
+	Promise< std::vector<T> >
+						m_Promise;
+};
+
+template<typename T>
+class Future<T>::WhenAnyListener : public FutureState<T>::IListener
+{
+public:
+	virtual void OnReady( size_t a_nIndex, const T & )
+	{
+		m_Promise.SetValue( a_nIndex );
+	}
+
+	Promise<size_t>		m_Promise;
+};
+
+template<typename T>
+Future< std::vector<T> > Future<T>::WhenAll( const FutureList & a_Futures )
+{
+	size_t nPending = 0;
+	for(size_t i=0;i<a_Futures.size();++i)
+	{
+		if (! a_Futures[i].IsValid() )
+			return Future< std::vector<T> >();
+		if (! a_Futures[i].IsReady() )
+			nPending += 1;
+	}
+
+	// everything is already done, no need for any shared state..
+	if ( nPending == 0 )
+	{
+		std::vector<T> values;
+		for(size_t i=0;i<a_Futures.size();++i)
+			values.push_back( a_Futures[i].Get() );
+		return Future< std::vector<T> >( values );
+	}
+
+	// count every input as pending, the ones that are already complete report in right away..
+	boost::shared_ptr<WhenAllListener> spListener( new WhenAllListener( a_Futures.size() ) );
+	Future< std::vector<T> > result( spListener->m_Promise.GetFuture() );
+	for(size_t i=0;i<a_Futures.size();++i)
+	{
+		if ( a_Futures[i].m_bReady )
+			spListener->OnReady( i, a_Futures[i].m_Value );
+		else
+			a_Futures[i].m_spState->AddListener( spListener, i );
+	}
+	return result;
+}
+
+template<typename T>
+Future<size_t> Future<T>::WhenAny( const FutureList & a_Futures )
+{
+	bool bValid = false;
+	for(size_t i=0;i<a_Futures.size();++i)
+	{
+		if ( a_Futures[i].IsReady() )
+			return Future<size_t>( i );
+		if ( a_Futures[i].IsValid() )
+			bValid = true;
+	}
+	// nothing would ever complete the future..
+	if (! bValid )
+		return Future<size_t>();
+
+	boost::shared_ptr<WhenAnyListener> spListener( new WhenAnyListener() );
+	Future<size_t> result( spListener->m_Promise.GetFuture() );
+	for(size_t i=0;i<a_Futures.size();++i)
+	{
+		if ( a_Futures[i].m_spState )
+			a_Futures[i].m_spState->AddListener( spListener, i );
+	}
+	return result;
+}
+
+template<typename R>
+Future<R> ThreadPool::InvokeOnThread( Delegate< Promise<R> > a_Work, Priority a_Priority /*= PRIORITY_NORMAL*/ )
+{
+	Promise<R> promise;
+	InvokeOnThread< Promise<R> >( a_Work, promise, a_Priority );
+	return promise.GetFuture();
+}
+
+#endif
@@ -42,10 +42,11 @@ IService::Request::Request(const std::string & a_URL,
 	m_Complete(false),
 	m_Error(false),
 	m_Callback(a_Callback),
-	m_CreateTime(Time().GetEpochTime()),
+	m_CreateTime(Time::GetCoarseMonotonicTime()),
 	m_StartTime(0.0),
 	m_bDelete(false),
-	m_pCachedReq(NULL)
+	m_pCachedReq(NULL),
+	m_pExecutor(NULL)
 {
 	m_spClient->SetURL( a_URL );
 	m_spClient->SetRequestType( a_RequestType );
@@ -64,7 +65,7 @@ IService::Request::Request(const std::string & a_URL,
 	else if ( TimerPool::Instance() != NULL )
 	{
 		m_spTimeoutTimer = TimerPool::Instance()->StartTimer( 
-			VOID_DELEGATE( Request, OnTimeout, this ), a_fTimeout, true, false );
+			VOID_DELEGATE( Request, OnTimeout, this ), a_fTimeout, true, false, NULL, TimerPool::TIMEOUT_SLACK );
 	}
 	else
 	{
@@ -85,10 +86,11 @@ IService::Request::Request( IService * a_pService,
 	m_Complete( false ),
 	m_Error( false ),
 	m_Callback( a_Callback ),
-	m_CreateTime( Time().GetEpochTime() ),
+	m_CreateTime( Time::GetCoarseMonotonicTime() ),
 	m_StartTime( 0.0 ),
 	m_bDelete(false),
-	m_pCachedReq(a_CacheReq)
+	m_pCachedReq(a_CacheReq),
+	m_pExecutor(a_pService->GetExecutor())
 {
 	m_pService->m_RequestsPending += 1;
 
@@ -113,7 +115,7 @@ IService::Request::Request( IService * a_pService,
 
 	// if our connection is already connected, then go ahead and set the start time to now..
 	if ( m_spClient->GetState() == IWebClient::CONNECTED )
-		m_StartTime = Time().GetEpochTime();
+		m_StartTime = Time::GetCoarseMonotonicTime();
 
 	//Log::Debug( "Request", "Sending request '%s'", a_pService->GetConfig()->m_URL + a_EndPoint.c_str() );
 	if (! m_spClient->Send() )
@@ -126,7 +128,7 @@ IService::Request::Request( IService * a_pService,
 	{
 		float fTimeout = MAX(a_fTimeout, m_pService->m_RequestTimeout);
 		m_spTimeoutTimer = TimerPool::Instance()->StartTimer( 
-			VOID_DELEGATE( Request, OnTimeout, this ), fTimeout, true, false );
+			VOID_DELEGATE( Request, OnTimeout, this ), fTimeout, true, false, NULL, TimerPool::TIMEOUT_SLACK );
 	}
 	else
 	{
@@ -138,25 +140,18 @@ void IService::Request::OnState( IWebClient * a_pClient )
 {
 	if ( a_pClient->GetState() == IWebClient::CONNECTING )
 	{
-		m_StartTime = Time().GetEpochTime();
+		m_StartTime = Time::GetCoarseMonotonicTime();
 	}
 	else if ( a_pClient->GetState() == IWebClient::DISCONNECTED )
 	{
-		Log::Error( "Request", "Request failed to connect." );
+		LOG_LIMITED( LL_ERROR, "Request", "Request failed to connect." );
 		m_Error = true;
 		m_bDelete = true;
-		if ( m_Callback.IsValid() )
-		{
-			m_Callback( this );
-			m_Callback.Reset();
-			if ( m_pService != NULL )
-				m_pService->m_RequestsPending -= 1;
-		}
 	}
 
 	// delete needs to be the last thing we do..
 	if ( m_bDelete )
-		delete this;
+		Finish();
 }
 
 void IService::Request::OnResponseData( IWebClient::RequestData * a_pResponse )
@@ -169,8 +164,8 @@ void IService::Request::OnResponseData( IWebClient::RequestData * a_pResponse )
 		m_SetCookies = a_pResponse->m_SetCookies;
 		m_RespHeaders = a_pResponse->m_Headers;
 
-		double end = Time().GetEpochTime();
-		Log::DebugMed( "Request", "REST request %s completed in %g seconds. Queued for %g seconds. Status: %d.", 
+		double end = Time::GetCoarseMonotonicTime();
+		LOG_DEBUG_MED( "Request", "REST request %s completed in %g seconds. Queued for %g seconds. Status: %d.", 
 			m_spClient->GetURL().GetURL().c_str(), end - m_StartTime, m_StartTime - m_CreateTime, a_pResponse->m_StatusCode );
 
 		if (m_pCachedReq != NULL && m_pService != NULL && !m_Error)
@@ -186,40 +181,49 @@ void IService::Request::OnResponseData( IWebClient::RequestData * a_pResponse )
 
 		if ( m_Error )
 		{
-			Log::Error( "Request", "Request Error %u: %s, URL: %s", 
+			// a failing service fails every request, so don't let the errors flood the log..
+			LOG_LIMITED( LL_ERROR, "Request", "Request Error %u: %s, URL: %s", 
 				a_pResponse->m_StatusCode, m_Response.c_str(), m_spClient->GetURL().GetURL().c_str() );
 		}
 
-		if ( m_Callback.IsValid() )
+		Finish();
+	}
+}
+
+void IService::Request::OnLocalResponse()
+{
+	m_Complete = true;
+	Finish();
+}
+
+void IService::Request::OnExecutorResponse()
+{
+	InvokeCallback();
+	delete this;
+}
+
+void IService::Request::Finish()
+{
+	if ( m_pExecutor != NULL && m_Callback.IsValid() )
+	{
+		// the connection and timer belong to the main thread, release them here and only move the callback..
+		if ( m_spClient )
 		{
-#if defined(WARNING_DELEGATE_TIME) && defined(ERROR_DELEGATE_TIME)
-			double startTime = Time().GetEpochTime();
-#endif
-			m_Callback(this);
-#if defined(WARNING_DELEGATE_TIME) && defined(ERROR_DELEGATE_TIME)
-			double elapsed = Time().GetEpochTime() - startTime;
-			if(elapsed > WARNING_DELEGATE_TIME)
-			{
-				if ( elapsed > ERROR_DELEGATE_TIME )
-					Log::Error("ThreadPool", "Delegate %s:%d took %f seconds to invoke on main thread.", 
-						m_Callback.GetFile(), m_Callback.GetLine(), elapsed );
-				else
-					Log::Warning("ThreadPool", "Delegate %s:%d took %f seconds to invoke on main thread.", 
-						m_Callback.GetFile(), m_Callback.GetLine(), elapsed );
-			}
-#endif
-			m_Callback.Reset();
-			if ( m_pService != NULL )
-				m_pService->m_RequestsPending -= 1;
+			IWebClient::Free( m_spClient );
+			m_spClient.reset();
 		}
+		m_spTimeoutTimer.reset();
 
-		delete this;
+		m_pExecutor->InvokeOnThread( VOID_DELEGATE( Request, OnExecutorResponse, this ) );
+		return;
 	}
+
+	InvokeCallback();
+	delete this;
 }
 
-void IService::Request::OnLocalResponse()
+void IService::Request::InvokeCallback()
 {
-	m_Complete = true;
 	if (m_Callback.IsValid())
 	{
 #if defined(WARNING_DELEGATE_TIME) && defined(ERROR_DELEGATE_TIME)
@@ -231,10 +235,10 @@ void IService::Request::OnLocalResponse()
 		if(elapsed > WARNING_DELEGATE_TIME)
 		{
 			if ( elapsed > ERROR_DELEGATE_TIME )
-				Log::Error("ThreadPool", "Delegate %s:%d took %f seconds to invoke on main thread.", 
+				Log::Error("ThreadPool", "Delegate %s:%d took %f seconds to invoke.", 
 					m_Callback.GetFile(), m_Callback.GetLine(), elapsed );
 			else
-				Log::Warning("ThreadPool", "Delegate %s:%d took %f seconds to invoke on main thread.", 
+				Log::Warning("ThreadPool", "Delegate %s:%d took %f seconds to invoke.", 
 					m_Callback.GetFile(), m_Callback.GetLine(), elapsed );
 		}
 #endif
@@ -243,7 +247,6 @@ void IService::Request::OnLocalResponse()
 		if ( m_pService != NULL )
 			m_pService->m_RequestsPending -= 1;
 	}
-	delete this;
 }
 
 void IService::Request::OnTimeout()
@@ -255,10 +258,13 @@ void IService::Request::OnTimeout()
 	m_Error = true;
 	m_spTimeoutTimer.reset();
 
-	// closing will call OnState() which will actually take care of deleteing this object.
+	// closing will call OnState() which will actually take care of deleteing this object. A closed client
+	// never reports DISCONNECTED, so with an executor we finish here and the executor deletes this request.
 	if ( m_spClient->Close() )
 	{
-		if (m_Callback.IsValid())
+		if ( m_pExecutor != NULL )
+			Finish();
+		else if (m_Callback.IsValid())
 		{
 			m_Callback(this);
 			m_Callback.Reset();
@@ -278,7 +284,8 @@ IService::IService(const std::string & a_ServiceId, AuthType a_AuthType /*= AUTH
 	m_MaxCacheSize( 5 * 1024 * 1024 ),
 	m_MaxCacheAge( 7 * 24 ),
 	m_RequestTimeout( 30.0f ),
-	m_RequestsPending( 0 )
+	m_RequestsPending( 0 ),
+	m_pExecutor( NULL )
 {
 	NewGUID();
 }
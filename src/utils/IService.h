@@ -135,6 +135,17 @@ public:
 		{
 			return m_Response;
 		}
+		ThreadPool * GetExecutor() const
+		{
+			return m_pExecutor;
+		}
+
+		//! Invoke the response callback with a thread from the given pool instead of the main thread,
+		//! this defaults to the executor of the service. The pool must outlive this request.
+		void SetExecutor( ThreadPool * a_pExecutor )
+		{
+			m_pExecutor = a_pExecutor;
+		}
 
 	protected:
 		//! HTTP callbacks
@@ -142,6 +153,11 @@ public:
 		void OnResponseData( IWebClient::RequestData * a_pResponse );
 		void OnLocalResponse();
 		void OnTimeout();
+		void OnExecutorResponse();
+
+		//! Invoke the callback then delete this request, on the executor if we have one.
+		void Finish();
+		void InvokeCallback();
 
 		//! Data
 		IService *			m_pService;
@@ -154,12 +170,13 @@ public:
 		bool				m_Error;
 		ResponseCallback	m_Callback;
 		CacheRequest *		m_pCachedReq;
+		ThreadPool *		m_pExecutor;
 
 		TimerPool::ITimer::SP
 							m_spTimeoutTimer;
 		bool				m_bDelete;
 
-		double				m_CreateTime;
+		double				m_CreateTime;		// on the coarse monotonic clock, see Time::GetCoarseMonotonicTime()
 		double				m_StartTime;
 	};
 
@@ -469,6 +486,10 @@ public:
 	{
 		return m_bCacheEnabled;
 	}
+	ThreadPool * GetExecutor() const
+	{
+		return m_pExecutor;
+	}
 
 	//! Start this service, returns true on success.
 	virtual bool Start();
@@ -480,6 +501,13 @@ public:
 		m_bCacheEnabled = a_bEnabled;
 	}
 
+	//! Set the pool that invokes the response callbacks of requests made by this service, NULL 
+	//! invokes them on the main thread. The pool must outlive this service.
+	void SetExecutor( ThreadPool * a_pExecutor )
+	{
+		m_pExecutor = a_pExecutor;
+	}
+
 	//! Update the default headers of this service, this will change
 	//! the headers of any REST request made using this service.
 	void SetHeaders( const Headers & a_Headers )
@@ -515,6 +543,7 @@ protected:
 
 	boost::atomic<int>
 					m_RequestsPending;
+	ThreadPool *	m_pExecutor;
 
 	DataCache *		GetDataCache(const std::string & a_Type);
 	bool			GetCachedResponse(const std::string & a_CacheName, const std::string & a_Id,std::string & a_Response);
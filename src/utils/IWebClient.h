@@ -19,9 +19,11 @@
 #ifndef WDC_IWEBCLIENT_H
 #define WDC_IWEBCLIENT_H
 
+#include <list>
 #include <map>
 
 #include "boost/atomic.hpp"
+#include "boost/thread/mutex.hpp"
 
 #include "RTTI.h"
 #include "Delegate.h"
@@ -41,6 +43,8 @@ public:
 	static boost::atomic<unsigned int>		sm_RequestsSent;
 	static boost::atomic<unsigned int>		sm_BytesSent;
 	static boost::atomic<unsigned int>		sm_BytesRecv;
+	static boost::atomic<unsigned int>		sm_ConnectionsReused;
+	static boost::atomic<unsigned int>		sm_ConnectionsEvicted;
 
 	//! Types
 	typedef std::map< std::string, std::string, StringUtil::ci_less >	Headers;
@@ -83,15 +87,45 @@ public:
 		DISCONNECTED	// connection has been lost
 	};
 
-	typedef std::list< SP >								ConnectionList;
+	//! A connection waiting in the pool to be reused
+	struct IdleConnection
+	{
+		IdleConnection( const SP & a_spClient, double a_IdleTime ) : m_spClient( a_spClient ), m_IdleTime( a_IdleTime )
+		{}
+
+		SP				m_spClient;
+		double			m_IdleTime;			// when it was returned to the pool, on the coarse monotonic clock
+	};
+	typedef std::list< IdleConnection >					ConnectionList;
 	typedef std::map< std::string, ConnectionList >		ConnectionMap;
 
-	//! Static function for creating a concrete WebClient class.
+	//! Static function for creating a concrete WebClient class. Create() returns a connected client from 
+	//! the pool if one is idle for the same protocol, host and port, Free() returns a client to the pool.
+	//! Both may be called from any thread.
 	static ConnectionMap & GetConnectionMap();
+	static boost::mutex & GetConnectionLock();
 	static Factory<IWebClient> & GetFactory();
 	static SP Create( const URL & a_URL );
 	static void Free( const SP & a_spClient );
 
+	//! Connection pool settings. At most a_Max idle connections are kept for each host, the oldest is closed 
+	//! when another is returned. 0 disables connection reuse.
+	static void SetMaxIdleConnections( size_t a_Max );
+	static size_t GetMaxIdleConnections();
+	//! Idle connections are closed after this many seconds, servers often close them sooner or later on their own.
+	static void SetIdleTimeout( double a_Timeout );
+	static double GetIdleTimeout();
+	//! Closes connections that have been idle longer than the idle timeout, WebClientService calls this
+	//! periodically. Returns the number of connections closed.
+	static size_t EvictIdleConnections();
+	//! Closes every idle connection.
+	static void ClearIdleConnections();
+	static size_t GetIdleConnections();
+	//! When a host has more than one address, another is tried if a connect hasn't finished after this many 
+	//! seconds, the first to connect is used and the others are closed.
+	static void SetConnectDelay( double a_Delay );
+	static double GetConnectDelay();
+
 	//! Destruction
 	virtual ~IWebClient()
 	{}
@@ -100,6 +134,9 @@ public:
 	virtual SocketState GetState() const = 0;
 	virtual const URL & GetURL() const = 0;
 	virtual const Headers & GetHeaders() const = 0;
+	//! Returns true if this connection can be used for another request. This is checked when a connection
+	//! is returned to the pool and again before it's reused, so it should be cheap.
+	virtual bool IsReusable() = 0;
 
 	//! Set the connection target
 	virtual void SetURL(const URL & a_URL) = 0;
@@ -59,6 +59,10 @@ public:
 
 		virtual void SendAsync(const std::string & a_Send) = 0;
 		virtual void ReadAsync(size_t a_Bytes, Delegate< std::string * > a_ReadCallback ) = 0;
+		//! Send a response to the request. If a_bClose is false the connection is kept open and the next
+		//! request on it is read (HTTP keep-alive), a Content-Length header is added if it's not provided.
+		//! Any of the request body that wasn't read is skipped first, a request with a Transfer-Encoding
+		//! closes the connection instead.
 		virtual void SendResponse(int a_nStatusCode, const std::string & a_Reply, const Headers & a_Headers,
 			const std::string & a_Content, bool a_bClose = true ) = 0;
 		virtual void SendResponse(int a_nStatusCode, const std::string & a_Reply, 
@@ -106,10 +110,12 @@ public:
 	//! Add an end-point to this server, the provided delegate will be invoked with the 
 	//! Request object when an incoming client connections makes a request that matches 
 	//! the provided end-point mask.
-	//! If a_bInvokeOnMain is false the delegate will be invoked in a thread from this servers thread-pool.
+	//! If a_bInvokeOnMain is false the delegate will be invoked in a thread from this servers thread-pool, or
+	//! by a thread from a_pExecutor if provided.
 	virtual void AddEndpoint(const std::string & a_EndPointMask,
 		Delegate<RequestSP> a_RequestHandler,
-		bool a_bInvokeOnMain = true ) = 0;
+		bool a_bInvokeOnMain = true,
+		ThreadPool * a_pExecutor = NULL ) = 0;
 	//! Remove a register end-point.
 	virtual bool RemoveEndpoint(const std::string & a_EndPointMask) = 0;
 
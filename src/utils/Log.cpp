@@ -20,24 +20,175 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#else
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #endif
 
 #include <boost/filesystem.hpp>
+#include <boost/atomic.hpp>
 #include <string>
 #include <list>
+#include <vector>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "zlib.h"
 
 #include "Log.h"
+#include "BinaryLog.h"
+#include "FlightRecorder.h"
 #include "Time.h"
 #include "StringUtil.h"
 #include "ThreadPool.h"
 #include "WatsonException.h"
 
+#if !defined(_WIN32) && !defined(IOV_MAX)
+#define IOV_MAX		1024
+#endif
+
 RTTI_IMPL_BASE( ILogReactor );
 RTTI_IMPL( FileReactor, ILogReactor );
 RTTI_IMPL( ConsoleReactor, ILogReactor );
 
+// nothing is formatted until a reactor is registered
+volatile int Log::sm_MinLevel = LL_CRITICAL + 1;
+volatile int Log::sm_ReactorLevel = LL_CRITICAL + 1;
+volatile int Log::sm_TextLevel = LL_CRITICAL + 1;
+volatile int Log::sm_LimitGeneration = 0;
+Log::Limiter * Log::sm_pLimiters = NULL;
+
+typedef std::map<std::string, Log::RateLimit>		RateLimitMap;
+
+static RateLimitMap & GetRateLimits()
+{
+	static RateLimitMap limits;
+	return limits;
+}
+
+static boost::mutex & GetRateLimitLock()
+{
+	static boost::mutex lock;
+	return lock;
+}
+
+const int DRAIN_INTERVAL = 10;			// how often the drain thread wakes up on its own, in milliseconds
+
+static void SwapRecord( LogRecord & a_Left, LogRecord & a_Right )
+{
+	std::swap( a_Left.m_Level, a_Right.m_Level );
+	std::swap( a_Left.m_TimeEpoch, a_Right.m_TimeEpoch );
+	a_Left.m_Time.swap( a_Right.m_Time );
+	a_Left.m_SubSystem.swap( a_Right.m_SubSystem );
+	a_Left.m_Message.swap( a_Right.m_Message );
+	std::swap( a_Left.m_bBinaryLogged, a_Right.m_bBinaryLogged );
+}
+
+//! Single producer, single consumer ring of records, written by one logging thread and read by the drain.
+class Log::RecordBuffer
+{
+public:
+	RecordBuffer( size_t a_Size ) : m_Records( a_Size ), m_Head( 0 ), m_Tail( 0 ), m_SampleCount( 0 ), m_bClosed( false )
+	{}
+
+	size_t GetCapacity() const
+	{
+		return m_Records.size();
+	}
+	size_t GetSize() const
+	{
+		return m_Tail.load( boost::memory_order_acquire ) - m_Head.load( boost::memory_order_acquire );
+	}
+
+	//! Swaps the record into the buffer, returns false if full. Only called by the owning thread.
+	bool Push( LogRecord & a_Record )
+	{
+		size_t tail = m_Tail.load( boost::memory_order_relaxed );
+		if ( tail - m_Head.load( boost::memory_order_acquire ) >= m_Records.size() )
+			return false;
+		SwapRecord( m_Records[ tail % m_Records.size() ], a_Record );
+		m_Tail.store( tail + 1, boost::memory_order_release );
+		return true;
+	}
+	//! Swaps the oldest record out of the buffer, returns false if empty. Only called by the drain.
+	bool Pop( LogRecord & a_Record )
+	{
+		size_t head = m_Head.load( boost::memory_order_relaxed );
+		if ( head == m_Tail.load( boost::memory_order_acquire ) )
+			return false;
+		SwapRecord( m_Records[ head % m_Records.size() ], a_Record );
+		m_Head.store( head + 1, boost::memory_order_release );
+		return true;
+	}
+
+	std::vector<LogRecord>	m_Records;
+	boost::atomic<size_t>	m_Head;				// next record to drain
+	boost::atomic<size_t>	m_Tail;				// next free slot
+	unsigned int			m_SampleCount;		// only used by the owning thread
+	boost::atomic<bool>		m_bClosed;			// set when the owning thread exits, the drain deletes it once empty
+};
+
+//! Async logging state, shared by all threads.
+struct Log::AsyncState
+{
+	typedef std::vector<RecordBuffer *>	BufferList;
+
+	AsyncState() : 
+		m_bAsync( false ), 
+		m_bStopDrain( false ),
+		m_BufferSize( 1024 ), 
+		m_Policy( Log::OVERFLOW_DROP ), 
+		m_SampleRate( 10 ),
+		m_Dropped( 0 ),
+		m_Sampled( 0 ),
+		m_ReportedDrops( 0 ),
+		m_pDrainThread( NULL ),
+		m_ThreadBuffer( &AsyncState::CloseBuffer ),
+		m_IsDrainThread( &AsyncState::KeepState )
+	{}
+
+	static void CloseBuffer( RecordBuffer * a_pBuffer )
+	{
+		a_pBuffer->m_bClosed = true;
+	}
+	static void KeepState( AsyncState * )
+	{}
+
+	boost::atomic<bool>		m_bAsync;
+	volatile bool			m_bStopDrain;
+	size_t					m_BufferSize;
+	Log::OverflowPolicy		m_Policy;
+	unsigned int			m_SampleRate;
+	boost::atomic<unsigned int>
+							m_Dropped;
+	boost::atomic<unsigned int>
+							m_Sampled;
+	unsigned int			m_ReportedDrops;	// only used by the drain
+	boost::thread *			m_pDrainThread;
+
+	boost::mutex			m_BufferLock;		// protects m_Buffers
+	BufferList				m_Buffers;
+	boost::mutex			m_DrainLock;		// only one thread drains at a time
+	boost::mutex			m_WakeLock;
+	boost::condition_variable
+							m_WakeDrain;
+	boost::thread_specific_ptr<RecordBuffer>
+							m_ThreadBuffer;
+	boost::thread_specific_ptr<AsyncState>
+							m_IsDrainThread;	// set on the drain thread, cheaper than comparing thread ids
+};
+
+Log::AsyncState & Log::GetAsyncState()
+{
+	static AsyncState state;
+	return state;
+}
+
 void ConsoleReactor::Process(const LogRecord & a_Record)
 {
 	if (a_Record.m_Level >= m_MinLevel)
@@ -71,33 +222,29 @@ void ConsoleReactor::Process(const LogRecord & a_Record)
 void ConsoleReactor::SetLogLevel( LogLevel a_Level )
 {
 	m_MinLevel = a_Level;
+	Log::UpdateMinLevel();
 }
 
 FileReactor::FileReactor(const char * a_pLogFile, LogLevel a_MinLevel /*= DEBUG*/, int a_LogHistory /*= 5*/) :
 	m_LogFile(a_pLogFile),
 	m_MinLevel(a_MinLevel),
-	m_pThread( NULL ),
+	m_LogHistory( a_LogHistory ),
+	m_MaxSize( 0 ),
+	m_MaxAge( 0.0 ),
+	m_bCompress( false ),
+	m_FlushInterval( 250 ),
+	m_SyncPolicy( SYNC_NONE ),
+	m_SyncInterval( 1.0 ),
+	m_File( -1 ),
+	m_FileSize( 0 ),
+	m_OpenTime( 0.0 ),
+	m_SyncTime( 0.0 ),
+	m_Rotations( 0 ),
 	m_bStopThread(false),
-	m_bThreadStopped(false)
+	m_pThread( NULL ),
+	m_pCompressThread( NULL )
 {
-	// rotate log files...
-	try {
-		boost::filesystem::remove( StringUtil::Format( "%s.%d", a_pLogFile, a_LogHistory - 1 ).c_str() );
-		for(int i=a_LogHistory - 1;i>0;--i)
-		{
-			std::string src = StringUtil::Format( "%s.%d", a_pLogFile, i - 1);
-			if ( boost::filesystem::exists( src ) )
-			{
-				std::string dst = StringUtil::Format( "%s.%d", a_pLogFile, i );
-				boost::filesystem::rename( src.c_str(), dst.c_str() );
-			}
-		}
-
-		if ( boost::filesystem::exists( a_pLogFile ) )
-			boost::filesystem::rename( a_pLogFile, StringUtil::Format( "%s.%d", a_pLogFile, 0 ) );
-	}
-	catch( const std::exception & )
-	{}
+	RotateFiles();
 
 	// start our thread for writing to files..
 	m_pThread = new boost::thread( boost::bind( &FileReactor::WriteThread, this ) );
@@ -107,9 +254,12 @@ FileReactor::~FileReactor()
 {
 	if ( m_pThread != NULL )
 	{
-		m_bStopThread = true;
-		while(! m_bThreadStopped )
-			boost::this_thread::yield();
+		{
+			boost::lock_guard<boost::mutex> lock( m_WakeLock );
+			m_bStopThread = true;
+		}
+		m_WakeThread.notify_one();
+		m_pThread->join();
 
 		delete m_pThread;
 		m_pThread = NULL;
@@ -132,43 +282,229 @@ void FileReactor::Process(const LogRecord & a_Record)
 void FileReactor::SetLogLevel( LogLevel a_Level )
 {
 	m_MinLevel = a_Level;
+	Log::UpdateMinLevel();
 }
 
 void FileReactor::WriteThread()
 {
-	while(! m_bStopThread )
+	LogList output;
+	while( true )
 	{
-		boost::this_thread::sleep( boost::posix_time::milliseconds( 250 ) );
+		{
+			boost::unique_lock<boost::mutex> lock( m_WakeLock );
+			if (! m_bStopThread )
+				m_WakeThread.timed_wait( lock, boost::posix_time::milliseconds( m_FlushInterval ) );
+		}
+		// read before taking the output, so the last lines are written when stopping..
+		bool bStop = m_bStopThread;
 
+		// transfer data into a local list so we don't block the logging threads for long..
 		m_OutputLock.lock();
-		if ( m_Output.begin() != m_Output.end() )
+		output.splice( output.begin(), m_Output );
+		m_OutputLock.unlock();
+
+		if ( output.begin() != output.end() )
+		{
+			if ( m_File >= 0 || OpenFile() )
+				WriteLines( output );
+			output.clear();
+		}
+
+		double now = Time::GetMonotonicTime();
+		if ( m_File >= 0 )
 		{
-			// transfer data into a local list so we don't block the main thread for long..
-			LogList output;
-			output.splice( output.begin(), m_Output );
-			m_OutputLock.unlock();
+			if ( m_SyncPolicy == SYNC_ALWAYS || (m_SyncPolicy == SYNC_INTERVAL && (now - m_SyncTime) >= m_SyncInterval) )
+			{
+#ifdef _WIN32
+				_commit( m_File );
+#else
+				fsync( m_File );
+#endif
+				m_SyncTime = now;
+			}
 
-			FILE * f = fopen(m_LogFile.c_str(), "a+");
-			if ( f != NULL )
+			if ( m_FileSize > 0 && ((m_MaxSize > 0 && m_FileSize >= m_MaxSize) 
+				|| (m_MaxAge > 0.0 && (now - m_OpenTime) >= m_MaxAge)) )
 			{
-				for( LogList::const_iterator iLog = output.begin(); 
-					iLog != output.end(); ++iLog )
-				{
-					const std::string & log = *iLog;
-					fwrite( log.c_str(), sizeof(char), log.size(), f );
-				}
-
-				fclose( f );
+				CloseFile();
+				// the files can't be renamed under the last compression, that only waits if rotations come 
+				// faster than gzip..
+				WaitForCompress();
+				RotateFiles();
+				m_Rotations += 1;
+
+				if ( m_bCompress )
+					StartCompress();
 			}
 		}
-		else
+
+		if ( bStop )
+			break;
+	}
+
+	CloseFile();
+	WaitForCompress();
+}
+
+void FileReactor::StartCompress()
+{
+	std::string rotated( StringUtil::Format( "%s.%d", m_LogFile.c_str(), 0 ) );
+	try {
+		m_pCompressThread = new boost::thread( boost::bind( &FileReactor::CompressRotated, rotated ) );
+	}
+	catch( const std::exception & )
+	{
+		// no thread to spare, so leave it uncompressed rather than stall the log..
+		m_pCompressThread = NULL;
+	}
+}
+
+void FileReactor::WaitForCompress()
+{
+	if ( m_pCompressThread != NULL )
+	{
+		m_pCompressThread->join();
+		delete m_pCompressThread;
+		m_pCompressThread = NULL;
+	}
+}
+
+bool FileReactor::OpenFile()
+{
+#ifdef _WIN32
+	m_File = _open( m_LogFile.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE );
+#else
+	m_File = open( m_LogFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644 );
+#endif
+	if ( m_File < 0 )
+		return false;
+
+#ifdef _WIN32
+	long size = _lseek( m_File, 0, SEEK_END );
+#else
+	off_t size = lseek( m_File, 0, SEEK_END );
+#endif
+	m_FileSize = size > 0 ? (size_t)size : 0;
+	m_OpenTime = m_SyncTime = Time::GetMonotonicTime();
+	return true;
+}
+
+void FileReactor::CloseFile()
+{
+	if ( m_File >= 0 )
+	{
+#ifdef _WIN32
+		_close( m_File );
+#else
+		close( m_File );
+#endif
+		m_File = -1;
+	}
+}
+
+void FileReactor::WriteLines( const LogList & a_Lines )
+{
+#ifdef _WIN32
+	// no writev(), so coalesce the lines into one buffer instead..
+	std::string buffer;
+	for( LogList::const_iterator iLog = a_Lines.begin(); iLog != a_Lines.end(); ++iLog )
+		buffer += *iLog;
+	if ( buffer.size() > 0 && _write( m_File, buffer.c_str(), (unsigned int)buffer.size() ) > 0 )
+		m_FileSize += buffer.size();
+#else
+	// write the lines in as few system calls as we can..
+	std::vector<struct iovec> iov;
+	iov.reserve( IOV_MAX );
+
+	LogList::const_iterator iLog = a_Lines.begin();
+	while( iLog != a_Lines.end() )
+	{
+		iov.clear();
+		size_t total = 0;
+		for(; iLog != a_Lines.end() && iov.size() < IOV_MAX; ++iLog )
+		{
+			struct iovec v;
+			v.iov_base = (void *)iLog->c_str();
+			v.iov_len = iLog->size();
+			iov.push_back( v );
+			total += v.iov_len;
+		}
+
+		size_t first = 0;
+		while( total > 0 && first < iov.size() )
 		{
-			// nothing to do..
-			m_OutputLock.unlock();
+			ssize_t written = writev( m_File, &iov[first], (int)(iov.size() - first) );
+			if ( written <= 0 )
+				return;
+			m_FileSize += written;
+			total -= written;
+
+			// skip whatever was written, a partial write may end in the middle of a line..
+			while( first < iov.size() && (size_t)written >= iov[first].iov_len )
+				written -= iov[first++].iov_len;
+			if ( first < iov.size() )
+			{
+				iov[first].iov_base = (char *)iov[first].iov_base + written;
+				iov[first].iov_len -= written;
+			}
+		}
+	}
+#endif
+}
+
+void FileReactor::RotateFiles()
+{
+	try {
+		std::string oldest( StringUtil::Format( "%s.%d", m_LogFile.c_str(), m_LogHistory - 1 ) );
+		boost::filesystem::remove( oldest );
+		boost::filesystem::remove( oldest + ".gz" );
+		for(int i=m_LogHistory - 1;i>0;--i)
+		{
+			std::string src = StringUtil::Format( "%s.%d", m_LogFile.c_str(), i - 1);
+			std::string dst = StringUtil::Format( "%s.%d", m_LogFile.c_str(), i );
+			if ( boost::filesystem::exists( src ) )
+				boost::filesystem::rename( src, dst );
+			if ( boost::filesystem::exists( src + ".gz" ) )
+				boost::filesystem::rename( src + ".gz", dst + ".gz" );
 		}
+
+		if ( boost::filesystem::exists( m_LogFile ) )
+			boost::filesystem::rename( m_LogFile, StringUtil::Format( "%s.%d", m_LogFile.c_str(), 0 ) );
+	}
+	catch( const std::exception & )
+	{}
+}
+
+bool FileReactor::CompressFile( const std::string & a_Source, const std::string & a_Target )
+{
+	FILE * pSource = fopen( a_Source.c_str(), "rb" );
+	if ( pSource == NULL )
+		return false;
+	gzFile target = gzopen( a_Target.c_str(), "wb" );
+	if ( target == NULL )
+	{
+		fclose( pSource );
+		return false;
 	}
 
-	m_bThreadStopped = true;
+	bool bSuccess = true;
+	char buffer[ 64 * 1024 ];
+	size_t read = 0;
+	while( bSuccess && (read = fread( buffer, 1, sizeof(buffer), pSource )) > 0 )
+		bSuccess = gzwrite( target, buffer, (unsigned int)read ) == (int)read;
+
+	bSuccess &= gzclose( target ) == Z_OK;
+	fclose( pSource );
+	return bSuccess;
+}
+
+void FileReactor::CompressRotated( const std::string & a_Source )
+{
+	if ( CompressFile( a_Source, a_Source + ".gz" ) )
+	{
+		boost::system::error_code error;
+		boost::filesystem::remove( a_Source, error );
+	}
 }
 
 Log::ReactorList & Log::GetReactorList()
@@ -187,18 +523,23 @@ void Log::RegisterReactor(ILogReactor * a_pReactor)
 {
 	boost::lock_guard<boost::recursive_mutex> lock( GetReactorLock() );
 	GetReactorList().push_back(a_pReactor);
+	UpdateMinLevel();
 }
 
 void Log::RemoveReactor(ILogReactor * a_pReactor, bool a_bDelete /*= true */)
 {
 	boost::lock_guard<boost::recursive_mutex> lock( GetReactorLock() );
 	GetReactorList().remove(a_pReactor);
+	UpdateMinLevel();
 	if ( a_bDelete )
 		delete a_pReactor;
 }
 
 void Log::RemoveAllReactors( bool a_bDelete /*= true*/ )
 {
+	// summaries of call-sites that went quiet go out while the reactors are still here..
+	FlushLimited();
+
 	boost::lock_guard<boost::recursive_mutex> lock( GetReactorLock() );
 	ReactorList & reactors = GetReactorList();
 
@@ -212,24 +553,438 @@ void Log::RemoveAllReactors( bool a_bDelete /*= true*/ )
 	}
 
 	reactors.clear();
+	UpdateMinLevel();
+}
+
+void Log::UpdateMinLevel()
+{
+	boost::lock_guard<boost::recursive_mutex> lock( GetReactorLock() );
+
+	int minLevel = LL_CRITICAL + 1;
+	int textLevel = LL_CRITICAL + 1;
+	ReactorList & reactors = GetReactorList();
+	for (ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor)
+	{
+		LogLevel level = (*iReactor)->GetLogLevel();
+		if ( level < minLevel )
+			minLevel = level;
+		if ( level < textLevel && *iReactor != BinaryReactor::Instance() )
+			textLevel = level;
+	}
+
+	sm_ReactorLevel = minLevel;
+	sm_TextLevel = textLevel;
+	sm_MinLevel = FlightRecorder::GetLevel() < minLevel ? FlightRecorder::GetLevel() : minLevel;
 }
 
 void Log::DoLog(LogLevel a_Level, const char * a_pSub, const char * a_pFormat, va_list args )
+{
+	// no reactor wants this level, so skip the formatting..
+	if (! IsEnabled( a_Level ) )
+		return;
+	// the flight recorder only copies the arguments, so this is cheap even when no reactor wants the record..
+	if ( FlightRecorder::IsRecording( a_Level ) )
+		FlightRecorder::Record( a_Level, a_pSub, a_pFormat, args );
+	if ( a_Level < sm_ReactorLevel )
+		return;
+
+	DoLogText( a_Level, a_pSub, a_pFormat, args, false );
+}
+
+void Log::DoLogText(LogLevel a_Level, const char * a_pSub, const char * a_pFormat, va_list args, bool a_bBinaryLogged )
 {
 	char buffer[1024 * 32];
 
 	LogRecord rec;
 	rec.m_Level = a_Level;
 	rec.m_SubSystem = a_pSub;
+	rec.m_bBinaryLogged = a_bBinaryLogged;
 
-	Time now;
+	// the coarse clock is precise enough for a log line and avoids a system call per line..
+	Time now( Time::GetCoarseTime() );
 	rec.m_Time = now.GetFormattedTime( "%x %X" ) + StringUtil::Format(".%0.3d", (int)now.GetMilliseconds()); 
 	rec.m_TimeEpoch = now.GetTime();
 
 	vsnprintf(buffer, sizeof(buffer) - 1, a_pFormat, args);
 	rec.m_Message = buffer;
 
-	ProcessRecord(rec);
+	if (! PushRecord( rec ) )
+		ProcessRecord(rec);
+}
+
+void Log::Write( LogLevel a_Level, const char * a_pSub, const char * a_pFormat, ... )
+{
+	va_list args;
+	va_start(args, a_pFormat);
+	DoLog( a_Level, a_pSub, a_pFormat, args );
+	va_end(args);
+}
+
+void Log::SetRateLimit( const std::string & a_SubSystem, const RateLimit & a_Limit )
+{
+	boost::lock_guard<boost::mutex> lock( GetRateLimitLock() );
+	GetRateLimits()[ a_SubSystem ] = a_Limit;
+	sm_LimitGeneration += 1;
+}
+
+Log::RateLimit Log::GetRateLimit( const std::string & a_SubSystem )
+{
+	boost::lock_guard<boost::mutex> lock( GetRateLimitLock() );
+	RateLimitMap & limits = GetRateLimits();
+
+	RateLimitMap::iterator iLimit = limits.find( a_SubSystem );
+	if ( iLimit == limits.end() )
+		iLimit = limits.find( std::string() );
+	return iLimit != limits.end() ? iLimit->second : RateLimit();
+}
+
+void Log::ClearRateLimits()
+{
+	boost::lock_guard<boost::mutex> lock( GetRateLimitLock() );
+	GetRateLimits().clear();
+	sm_LimitGeneration += 1;
+}
+
+Log::Limiter::Limiter( const char * a_pFile, int a_Line ) :
+	m_pFile( a_pFile ),
+	m_Line( a_Line ),
+	m_pNext( NULL ),
+	m_Generation( -1 ),
+	m_Level( LL_STATUS ),
+	m_pSubSystem( NULL ),
+	m_Interval( 0 ),
+	m_BurstTime( 0 ),
+	m_NextAllowed( 0 ),
+	m_Sample( 1 ),
+	m_SummaryInterval( 0 ),
+	m_Calls( 0 ),
+	m_Suppressed( 0 ),
+	m_LastSummary( 0 )
+{
+	// just the file name, not the full path of the build
+	const char * pSlash = strrchr( m_pFile, '/' );
+	const char * pBackslash = strrchr( m_pFile, '\\' );
+	if ( pBackslash > pSlash )
+		pSlash = pBackslash;
+	if ( pSlash != NULL )
+		m_pFile = pSlash + 1;
+
+	// the lock is constructed before us, so it's still there when we are destroyed..
+	boost::lock_guard<boost::mutex> lock( GetRateLimitLock() );
+	m_pNext = sm_pLimiters;
+	sm_pLimiters = this;
+}
+
+Log::Limiter::~Limiter()
+{
+	boost::lock_guard<boost::mutex> lock( GetRateLimitLock() );
+	for( Limiter ** ppLimiter = &sm_pLimiters; *ppLimiter != NULL; ppLimiter = &(*ppLimiter)->m_pNext )
+	{
+		if ( *ppLimiter == this )
+		{
+			*ppLimiter = m_pNext;
+			break;
+		}
+	}
+}
+
+bool Log::Limiter::Allow( LogLevel a_Level, const char * a_pSubSystem )
+{
+	boost::int64_t now = (boost::int64_t)Time::GetCoarseMonotonicMicroseconds();
+	if ( m_Generation.load( boost::memory_order_acquire ) != sm_LimitGeneration )
+		UpdateLimits( a_Level, a_pSubSystem, now );
+
+	unsigned int sample = m_Sample.load( boost::memory_order_relaxed );
+	bool bAllow = sample <= 1 || (m_Calls.fetch_add( 1, boost::memory_order_relaxed ) % sample) == 0;
+
+	boost::int64_t interval = m_Interval.load( boost::memory_order_relaxed );
+	if ( bAllow && interval > 0 )
+	{
+		// the next message is allowed once now catches up, each message pushes it on by the interval and 
+		// the burst lets it run that far ahead of now..
+		boost::int64_t burstTime = m_BurstTime.load( boost::memory_order_relaxed );
+		boost::int64_t next = m_NextAllowed.load( boost::memory_order_relaxed );
+		do {
+			boost::int64_t start = next > now ? next : now;
+			bAllow = (start - now) <= burstTime;
+			if (! bAllow )
+				break;
+		} while(! m_NextAllowed.compare_exchange_weak( next, (next > now ? next : now) + interval, boost::memory_order_relaxed ) );
+	}
+
+	if (! bAllow )
+	{
+		m_Suppressed.fetch_add( 1, boost::memory_order_relaxed );
+		return false;
+	}
+
+	unsigned int suppressed = 0;
+	double elapsed = 0.0;
+	if ( TakeSummary( now, m_SummaryInterval.load( boost::memory_order_relaxed ), suppressed, elapsed ) )
+	{
+		Write( a_Level, a_pSubSystem, "Suppressed %u messages from %s:%d in the last %.0f seconds.", 
+			suppressed, m_pFile, m_Line, elapsed );
+	}
+	return true;
+}
+
+void Log::Limiter::UpdateLimits( LogLevel a_Level, const char * a_pSubSystem, boost::int64_t a_Now )
+{
+	boost::lock_guard<boost::mutex> lock( m_Lock );
+
+	int generation = sm_LimitGeneration;
+	if ( m_Generation.load( boost::memory_order_relaxed ) == generation )
+		return;
+
+	RateLimit limit( GetRateLimit( a_pSubSystem ) );
+	boost::int64_t interval = limit.m_Rate > 0.0 ? (boost::int64_t)(1000000.0 / limit.m_Rate) : 0;
+	if ( limit.m_Rate > 0.0 && interval < 1 )
+		interval = 1;
+
+	m_Level = a_Level;
+	m_pSubSystem = a_pSubSystem;
+	m_Interval.store( interval, boost::memory_order_relaxed );
+	// a full burst is available again..
+	m_BurstTime.store( (boost::int64_t)((limit.m_Burst - 1.0) * interval), boost::memory_order_relaxed );
+	m_NextAllowed.store( a_Now, boost::memory_order_relaxed );
+	m_Sample.store( limit.m_Sample, boost::memory_order_relaxed );
+	m_SummaryInterval.store( (boost::int64_t)(limit.m_SummaryInterval * 1000000.0), boost::memory_order_relaxed );
+	m_LastSummary.store( a_Now, boost::memory_order_relaxed );
+	m_Generation.store( generation, boost::memory_order_release );
+}
+
+bool Log::Limiter::TakeSummary( boost::int64_t a_Now, boost::int64_t a_Interval, unsigned int & a_Suppressed, double & a_Elapsed )
+{
+	if ( m_Suppressed.load( boost::memory_order_relaxed ) == 0 )
+		return false;
+
+	// only the thread that moves the summary time on writes the summary..
+	boost::int64_t last = m_LastSummary.load( boost::memory_order_relaxed );
+	if ( (a_Now - last) < a_Interval || !m_LastSummary.compare_exchange_strong( last, a_Now, boost::memory_order_relaxed ) )
+		return false;
+
+	a_Suppressed = m_Suppressed.exchange( 0, boost::memory_order_relaxed );
+	a_Elapsed = (double)(a_Now - last) / 1000000.0;
+	return a_Suppressed > 0;
+}
+
+void Log::FlushLimited( bool a_bDue /*= false*/ )
+{
+	struct Summary
+	{
+		LogLevel		m_Level;
+		const char *	m_pSubSystem;
+		const char *	m_pFile;
+		int				m_Line;
+		unsigned int	m_Suppressed;
+		double			m_Elapsed;
+	};
+	std::vector<Summary> summaries;
+
+	{
+		boost::lock_guard<boost::mutex> lock( GetRateLimitLock() );
+
+		boost::int64_t now = (boost::int64_t)Time::GetCoarseMonotonicMicroseconds();
+		for( Limiter * pLimiter = sm_pLimiters; pLimiter != NULL; pLimiter = pLimiter->m_pNext )
+		{
+			// the level and sub-system are set with the first limits..
+			if ( pLimiter->m_Generation.load( boost::memory_order_acquire ) < 0 )
+				continue;
+
+			Summary summary;
+			boost::int64_t interval = a_bDue ? pLimiter->m_SummaryInterval.load( boost::memory_order_relaxed ) : 0;
+			if ( pLimiter->TakeSummary( now, interval, summary.m_Suppressed, summary.m_Elapsed ) )
+			{
+				summary.m_Level = pLimiter->m_Level;
+				summary.m_pSubSystem = pLimiter->m_pSubSystem;
+				summary.m_pFile = pLimiter->m_pFile;
+				summary.m_Line = pLimiter->m_Line;
+				summaries.push_back( summary );
+			}
+		}
+	}
+
+	for( size_t i=0;i<summaries.size();++i)
+	{
+		const Summary & summary = summaries[i];
+		Write( summary.m_Level, summary.m_pSubSystem, "Suppressed %u messages from %s:%d in the last %.0f seconds.", 
+			summary.m_Suppressed, summary.m_pFile, summary.m_Line, summary.m_Elapsed );
+	}
+}
+
+void Log::StartAsync( size_t a_BufferSize /*= 1024*/, OverflowPolicy a_Policy /*= OVERFLOW_DROP*/, 
+	unsigned int a_SampleRate /*= 10*/ )
+{
+	AsyncState & state = GetAsyncState();
+	StopAsync();
+
+	state.m_BufferSize = a_BufferSize > 1 ? a_BufferSize : 2;
+	state.m_Policy = a_Policy;
+	state.m_SampleRate = a_SampleRate > 0 ? a_SampleRate : 1;
+	state.m_bStopDrain = false;
+	state.m_pDrainThread = new boost::thread( &Log::DrainThread );
+	state.m_bAsync = true;
+}
+
+void Log::StopAsync()
+{
+	AsyncState & state = GetAsyncState();
+	if ( state.m_pDrainThread != NULL )
+	{
+		state.m_bAsync = false;
+		state.m_bStopDrain = true;
+		state.m_WakeDrain.notify_one();
+		state.m_pDrainThread->join();
+
+		delete state.m_pDrainThread;
+		state.m_pDrainThread = NULL;
+	}
+}
+
+bool Log::IsAsync()
+{
+	return GetAsyncState().m_bAsync;
+}
+
+void Log::Flush()
+{
+	FlushLimited();
+	DrainBuffers();
+}
+
+unsigned int Log::GetDroppedRecords()
+{
+	return GetAsyncState().m_Dropped;
+}
+
+unsigned int Log::GetSampledRecords()
+{
+	return GetAsyncState().m_Sampled;
+}
+
+bool Log::PushRecord( LogRecord & a_Record )
+{
+	AsyncState & state = GetAsyncState();
+	// the drain thread logs directly, it can't wait on its own buffer..
+	if (! state.m_bAsync || state.m_IsDrainThread.get() != NULL )
+		return false;
+
+	RecordBuffer * pBuffer = state.m_ThreadBuffer.get();
+	if ( pBuffer == NULL || pBuffer->GetCapacity() != state.m_BufferSize )
+	{
+		// first record from this thread, or the size was changed by StartAsync()
+		if ( pBuffer != NULL )
+			pBuffer->m_bClosed = true;
+		pBuffer = new RecordBuffer( state.m_BufferSize );
+		state.m_ThreadBuffer.release();
+		state.m_ThreadBuffer.reset( pBuffer );
+
+		boost::lock_guard<boost::mutex> lock( state.m_BufferLock );
+		state.m_Buffers.push_back( pBuffer );
+	}
+
+	size_t size = pBuffer->GetSize();
+	if ( state.m_Policy == OVERFLOW_SAMPLE && size >= pBuffer->GetCapacity() / 2 && a_Record.m_Level < LL_WARNING )
+	{
+		if ( (++pBuffer->m_SampleCount % state.m_SampleRate) != 0 )
+		{
+			state.m_Sampled += 1;
+			return true;
+		}
+	}
+
+	while(! pBuffer->Push( a_Record ) )
+	{
+		if ( state.m_Policy != OVERFLOW_BLOCK )
+		{
+			state.m_Dropped += 1;
+			return true;
+		}
+		state.m_WakeDrain.notify_one();
+		boost::this_thread::yield();
+
+		// async was stopped while we waited, so the caller logs directly..
+		if (! state.m_bAsync )
+			return false;
+	}
+
+	// wake the drain early once a buffer is half full, otherwise it drains on its own interval..
+	if ( size + 1 == pBuffer->GetCapacity() / 2 )
+		state.m_WakeDrain.notify_one();
+
+	// StopAsync() may have finished draining before our push, so make sure this record isn't left behind..
+	if (! state.m_bAsync )
+		DrainBuffers();
+	return true;
+}
+
+void Log::DrainBuffers()
+{
+	AsyncState & state = GetAsyncState();
+	boost::lock_guard<boost::mutex> drainLock( state.m_DrainLock );
+
+	// only the drain deletes buffers, so the list can be copied and processed without holding the lock..
+	AsyncState::BufferList buffers;
+	{
+		boost::lock_guard<boost::mutex> lock( state.m_BufferLock );
+		buffers = state.m_Buffers;
+	}
+
+	LogRecord rec;
+	for( AsyncState::BufferList::iterator iBuffer = buffers.begin(); iBuffer != buffers.end(); ++iBuffer )
+	{
+		RecordBuffer * pBuffer = *iBuffer;
+		while( pBuffer->Pop( rec ) )
+			ProcessRecord( rec );
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock( state.m_BufferLock );
+		for( AsyncState::BufferList::iterator iBuffer = state.m_Buffers.begin(); iBuffer != state.m_Buffers.end(); )
+		{
+			RecordBuffer * pBuffer = *iBuffer;
+			if ( pBuffer->m_bClosed && pBuffer->GetSize() == 0 )
+			{
+				delete pBuffer;
+				iBuffer = state.m_Buffers.erase( iBuffer );
+			}
+			else
+				++iBuffer;
+		}
+	}
+
+	unsigned int dropped = state.m_Dropped;
+	if ( dropped != state.m_ReportedDrops )
+	{
+		LogRecord warning;
+		warning.m_Level = LL_WARNING;
+		warning.m_SubSystem = "Log";
+		Time now( Time::GetCoarseTime() );
+		warning.m_Time = now.GetFormattedTime( "%x %X" ) + StringUtil::Format(".%0.3d", (int)now.GetMilliseconds()); 
+		warning.m_TimeEpoch = now.GetTime();
+		warning.m_Message = StringUtil::Format( "Dropped %u log records, the async log buffers are full.", 
+			dropped - state.m_ReportedDrops );
+		state.m_ReportedDrops = dropped;
+
+		ProcessRecord( warning );
+	}
+}
+
+void Log::DrainThread()
+{
+	AsyncState & state = GetAsyncState();
+	state.m_IsDrainThread.reset( &state );
+	while(! state.m_bStopDrain )
+	{
+		{
+			boost::unique_lock<boost::mutex> lock( state.m_WakeLock );
+			state.m_WakeDrain.timed_wait( lock, boost::posix_time::milliseconds( DRAIN_INTERVAL ) );
+		}
+		FlushLimited( true );
+		DrainBuffers();
+	}
+
+	DrainBuffers();
 }
 
 void Log::ProcessRecord(const LogRecord & rec)
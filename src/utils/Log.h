@@ -23,10 +23,12 @@
 
 #include <string>
 #include <list>
+#include <map>
 #include <stdarg.h>
 
 #include "RTTI.h"
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 #include "UtilsLib.h"		// include last
 
 enum LogLevel
@@ -43,11 +45,15 @@ enum LogLevel
 
 struct LogRecord
 {
+	LogRecord() : m_Level( LL_STATUS ), m_TimeEpoch( 0 ), m_bBinaryLogged( false )
+	{}
+
 	LogLevel		m_Level;
 	std::string		m_Time;
 	std::string		m_SubSystem;
 	std::string		m_Message;
 	time_t          m_TimeEpoch;
+	bool			m_bBinaryLogged;	// true if the BinaryReactor already has this record from a BLOG_ macro
 };
 
 //! Abstract interface for any object that wants to hook into the LogSystem.
@@ -61,6 +67,12 @@ public:
 
 	virtual void Process(const LogRecord & a_Record) = 0;
 	virtual void SetLogLevel( LogLevel a_Level ) = 0;
+	//! Returns the lowest level this reactor processes, records below the level of every reactor are
+	//! never formatted. Reactors that filter on their own return LL_DEBUG_LOW.
+	virtual LogLevel GetLogLevel() const
+	{
+		return LL_DEBUG_LOW;
+	}
 };
 
 class UTILS_API ConsoleReactor : public ILogReactor
@@ -73,6 +85,10 @@ public:
 
 	virtual void Process(const LogRecord & a_Record);
 	virtual void SetLogLevel( LogLevel a_Level );
+	virtual LogLevel GetLogLevel() const
+	{
+		return m_MinLevel;
+	}
 
 private:
 	LogLevel			m_MinLevel;
@@ -83,11 +99,56 @@ class UTILS_API FileReactor : public ILogReactor
 public:
 	RTTI_DECL();
 
+	//! When the write thread forces the log file to disk
+	enum SyncPolicy
+	{
+		SYNC_NONE,			// leave it to the OS
+		SYNC_INTERVAL,		// fsync at most once per sync interval
+		SYNC_ALWAYS			// fsync after every write
+	};
+
+	//! The log file is rotated when the reactor is created, and while running once it grows past the max size or 
+	//! has been open longer than the max age. a_LogHistory rotated files are kept, a_pLogFile.0 is the newest.
 	FileReactor(const char * a_pLogFile, LogLevel a_MinLevel = LL_STATUS, int a_LogHistory = 5 );
 	~FileReactor();
 
 	virtual void Process(const LogRecord & a_Record);
 	virtual void SetLogLevel( LogLevel a_Level );
+	virtual LogLevel GetLogLevel() const
+	{
+		return m_MinLevel;
+	}
+
+	//! Rotate once the file is larger than this many bytes, 0 to disable.
+	void SetMaxSize( size_t a_MaxSize )
+	{
+		m_MaxSize = a_MaxSize;
+	}
+	//! Rotate once the file has been open for this many seconds, 0 to disable.
+	void SetMaxAge( double a_MaxAge )
+	{
+		m_MaxAge = a_MaxAge;
+	}
+	//! Gzip files rotated while running on a thread of their own, they are named a_pLogFile.N.gz
+	void SetCompress( bool a_bCompress )
+	{
+		m_bCompress = a_bCompress;
+	}
+	//! How often queued lines are written to the file, in milliseconds.
+	void SetFlushInterval( int a_Interval )
+	{
+		m_FlushInterval = a_Interval > 0 ? a_Interval : 1;
+	}
+	void SetSyncPolicy( SyncPolicy a_Policy, double a_SyncInterval = 1.0 )
+	{
+		m_SyncPolicy = a_Policy;
+		m_SyncInterval = a_SyncInterval;
+	}
+	//! Returns the number of times the file was rotated while running.
+	unsigned int GetRotations() const
+	{
+		return m_Rotations;
+	}
 
 private:
 	//! Types
@@ -96,15 +157,40 @@ private:
 	//! Data
 	std::string			m_LogFile;
 	LogLevel			m_MinLevel;
+	int					m_LogHistory;
+	volatile size_t		m_MaxSize;
+	volatile double		m_MaxAge;
+	volatile bool		m_bCompress;
+	volatile int		m_FlushInterval;
+	volatile SyncPolicy	m_SyncPolicy;
+	volatile double		m_SyncInterval;
 
-	bool				m_bStopThread;
-	bool				m_bThreadStopped;
+	int					m_File;				// only used by the write thread, kept open between writes
+	size_t				m_FileSize;
+	double				m_OpenTime;			// on the monotonic clock
+	double				m_SyncTime;
+	volatile unsigned int
+						m_Rotations;
+
+	volatile bool		m_bStopThread;
 	boost::thread *		m_pThread;
+	boost::thread *		m_pCompressThread;	// compressing the last rotated file, only used by the write thread
+	boost::mutex		m_WakeLock;
+	boost::condition_variable
+						m_WakeThread;
 	boost::recursive_mutex
 						m_OutputLock;
 	LogList				m_Output;
 
 	void WriteThread();
+	bool OpenFile();
+	void CloseFile();
+	void WriteLines( const LogList & a_Lines );
+	void RotateFiles();
+	void StartCompress();
+	void WaitForCompress();
+	static bool CompressFile( const std::string & a_Source, const std::string & a_Target );
+	static void CompressRotated( const std::string & a_Source );
 };
 
 class UTILS_API Log
@@ -113,14 +199,123 @@ public:
 	//! Types
 	typedef std::list<ILogReactor *>		ReactorList;
 
+	//! What a thread does when its async log buffer is full
+	enum OverflowPolicy
+	{
+		OVERFLOW_DROP,			// drop the new record
+		OVERFLOW_BLOCK,			// wait for the drain thread to make room
+		OVERFLOW_SAMPLE			// once the buffer is half full keep only every Nth record below LL_WARNING, drop when full
+	};
+
+	//! Limits for each LOG_LIMITED call-site of a sub-system
+	struct RateLimit
+	{
+		RateLimit( double a_Rate = 1.0, double a_Burst = 10.0, unsigned int a_Sample = 1, double a_SummaryInterval = 10.0 ) :
+			m_Rate( a_Rate ), m_Burst( a_Burst ), m_Sample( a_Sample ), m_SummaryInterval( a_SummaryInterval )
+		{}
+
+		double			m_Rate;				// messages per second once the burst is used up, 0 for no limit
+		double			m_Burst;			// messages that may be logged back to back
+		unsigned int	m_Sample;			// only 1 in this many calls is considered, 1 for every call
+		double			m_SummaryInterval;	// seconds between "suppressed N messages" summaries
+	};
+
+	//! Token bucket and sampling state of one LOG_LIMITED call-site. The bucket is kept as the time the next
+	//! message is allowed, so Allow() only takes m_Lock when the limits change.
+	class UTILS_API Limiter
+	{
+	public:
+		Limiter( const char * a_pFile, int a_Line );
+		~Limiter();
+
+		//! Returns true if the message should be logged. A summary of the suppressed messages is logged first 
+		//! once the summary interval has passed.
+		bool Allow( LogLevel a_Level, const char * a_pSubSystem );
+
+	private:
+		//! Types
+		typedef boost::atomic<boost::int64_t>	AtomicTime;		// monotonic microseconds
+
+		const char *	m_pFile;
+		int				m_Line;
+		Limiter *		m_pNext;			// in the list FlushLimited() walks
+		boost::mutex	m_Lock;				// held while the limits are looked up
+		boost::atomic<int>
+						m_Generation;		// of the limits when they were looked up, -1 until the first call
+		LogLevel		m_Level;			// of the call-site, set with the limits
+		const char *	m_pSubSystem;
+		AtomicTime		m_Interval;			// between messages once the burst is used up, 0 for no limit
+		AtomicTime		m_BurstTime;		// how far m_NextAllowed may run ahead of now
+		AtomicTime		m_NextAllowed;
+		boost::atomic<unsigned int>
+						m_Sample;
+		AtomicTime		m_SummaryInterval;
+		boost::atomic<unsigned int>
+						m_Calls;
+		boost::atomic<unsigned int>
+						m_Suppressed;
+		AtomicTime		m_LastSummary;
+
+		void UpdateLimits( LogLevel a_Level, const char * a_pSubSystem, boost::int64_t a_Now );
+		bool TakeSummary( boost::int64_t a_Now, boost::int64_t a_Interval, unsigned int & a_Suppressed, double & a_Elapsed );
+
+		friend class Log;
+	};
+
 	//! Interface
 	static void RegisterReactor(ILogReactor * a_pReactor);
 	static void RemoveReactor(ILogReactor * a_pReactor, bool a_bDelete = true );
 	static void RemoveAllReactors( bool a_bDelete = true );
+	//! Recalculates the lowest level of all registered reactors, call after changing the level of a 
+	//! registered reactor. ConsoleReactor and FileReactor call this from SetLogLevel().
+	static void UpdateMinLevel();
+	//! Returns true if any reactor would process a record of the given level, or the FlightRecorder would 
+	//! record it. This is checked before any formatting is done, so a disabled level costs one compare.
+	static bool IsEnabled( LogLevel a_Level )
+	{
+		return a_Level >= sm_MinLevel;
+	}
+	//! Returns the lowest level of the reactors other than the BinaryReactor, BLOG_ records at or above 
+	//! this are formatted for them as well.
+	static LogLevel GetTextLevel()
+	{
+		return (LogLevel)sm_TextLevel;
+	}
+
+	//! Set the limits used by LOG_LIMITED call-sites of the given sub-system, an empty sub-system sets the 
+	//! default for sub-systems with no limits of their own. Each call-site has its own bucket.
+	static void SetRateLimit( const std::string & a_SubSystem, const RateLimit & a_Limit );
+	static RateLimit GetRateLimit( const std::string & a_SubSystem );
+	//! Go back to the default limits for every sub-system.
+	static void ClearRateLimits();
+	//! Logs the summary of every LOG_LIMITED call-site with suppressed messages, a_bDue only logs those whose 
+	//! summary interval has passed. A call-site that goes quiet is otherwise never summarized, so Flush() 
+	//! and RemoveAllReactors() call this, and the async drain thread calls it for the due summaries.
+	static void FlushLimited( bool a_bDue = false );
+
+	//! Switch to asynchronous logging. Each thread writes its records into its own lock-free ring buffer of
+	//! a_BufferSize records, and a single background thread drains the buffers into the reactors. Records from 
+	//! one thread stay in order, records from different threads are only ordered within each drain pass.
+	static void StartAsync( size_t a_BufferSize = 1024, OverflowPolicy a_Policy = OVERFLOW_DROP, 
+		unsigned int a_SampleRate = 10 );
+	//! Stops the drain thread and passes any pending records to the reactors, after this reactors are
+	//! called by the logging thread again. This must be called before exit if StartAsync() was called.
+	static void StopAsync();
+	static bool IsAsync();
+	//! Passes every record logged before this call to the reactors, does nothing unless async.
+	static void Flush();
+	//! Returns the number of records dropped because a buffer was full.
+	static unsigned int GetDroppedRecords();
+	//! Returns the number of records dropped by OVERFLOW_SAMPLE before the buffer was full.
+	static unsigned int GetSampledRecords();
 
 	static void DoLog(LogLevel a_Level, const char * a_pSub, const char * a_pFormat, va_list args );
+	//! Formats a record and passes it to the reactors without recording it to the FlightRecorder, used by
+	//! BinaryReactor::Write() for records it already has, which the BinaryReactor then skips.
+	static void DoLogText(LogLevel a_Level, const char * a_pSub, const char * a_pFormat, va_list args, bool a_bBinaryLogged );
 	static void ProcessRecord(const LogRecord & rec);
 
+	static void Write( LogLevel a_Level, const char * a_pSub, const char * a_pFormat, ... );
 	static void DebugLow(const char * a_pSub, const char * a_pFormat, ...);
 	static void DebugMed(const char * a_pSub, const char * a_pFormat, ...);
 	static void DebugHigh(const char * a_pSub, const char * a_pFormat, ...);
@@ -135,7 +330,70 @@ public:
 	//! Data
 	static ReactorList & GetReactorList();
 	static boost::recursive_mutex & GetReactorLock();
+
+private:
+	//! Types
+	class RecordBuffer;
+	struct AsyncState;
+
+	static AsyncState & GetAsyncState();
+	static bool PushRecord( LogRecord & a_Record );
+	static void DrainBuffers();
+	static void DrainThread();
+
+	static volatile int		sm_MinLevel;
+	static volatile int		sm_ReactorLevel;		// lowest level of the reactors, sm_MinLevel includes the flight recorder
+	static volatile int		sm_TextLevel;			// lowest level of the reactors other than the BinaryReactor
+	static volatile int		sm_LimitGeneration;		// changed each time the limits change
+	static Limiter *		sm_pLimiters;			// every LOG_LIMITED call-site that has been reached
 };
 
+//! Log levels below LOG_COMPILE_LEVEL are removed at compile time by the LOG_ macros below, 0 keeps every
+//! level. For example, build with -DLOG_COMPILE_LEVEL=3 to remove all the LL_DEBUG levels.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL		0
+#endif
+
+//! Log macros, the arguments are only evaluated when the level is enabled, so these should be used
+//! instead of calling Log directly where the arguments are expensive (e.g. building a string per request).
+#define LOG_IF_ENABLED( LEVEL, FUNC, ... )		do { if ( Log::IsEnabled( LEVEL ) ) Log::FUNC( __VA_ARGS__ ); } while(0)
+
+#if LOG_COMPILE_LEVEL <= 0
+#define LOG_DEBUG_LOW( ... )		LOG_IF_ENABLED( LL_DEBUG_LOW, DebugLow, __VA_ARGS__ )
+#else
+#define LOG_DEBUG_LOW( ... )		do {} while(0)
+#endif
+#if LOG_COMPILE_LEVEL <= 1
+#define LOG_DEBUG_MED( ... )		LOG_IF_ENABLED( LL_DEBUG_MED, DebugMed, __VA_ARGS__ )
+#else
+#define LOG_DEBUG_MED( ... )		do {} while(0)
+#endif
+#if LOG_COMPILE_LEVEL <= 2
+#define LOG_DEBUG_HIGH( ... )		LOG_IF_ENABLED( LL_DEBUG_HIGH, DebugHigh, __VA_ARGS__ )
+#define LOG_DEBUG( ... )			LOG_IF_ENABLED( LL_DEBUG, Debug, __VA_ARGS__ )
+#else
+#define LOG_DEBUG_HIGH( ... )		do {} while(0)
+#define LOG_DEBUG( ... )			do {} while(0)
+#endif
+#if LOG_COMPILE_LEVEL <= 3
+#define LOG_STATUS( ... )			LOG_IF_ENABLED( LL_STATUS, Status, __VA_ARGS__ )
+#else
+#define LOG_STATUS( ... )			do {} while(0)
+#endif
+#if LOG_COMPILE_LEVEL <= 4
+#define LOG_WARNING( ... )			LOG_IF_ENABLED( LL_WARNING, Warning, __VA_ARGS__ )
+#else
+#define LOG_WARNING( ... )			do {} while(0)
+#endif
+// errors are never compiled out
+#define LOG_ERROR( ... )			LOG_IF_ENABLED( LL_ERROR, Error, __VA_ARGS__ )
+#define LOG_CRITICAL( ... )			LOG_IF_ENABLED( LL_CRITICAL, Critical, __VA_ARGS__ )
+
+//! Rate limited logging for messages that can repeat in a storm (a failing service, a flapping connection).
+//! Each use of the macro is limited on its own, using the limits set for the sub-system with Log::SetRateLimit().
+#define LOG_LIMITED( LEVEL, SUB, ... )	do { if ( Log::IsEnabled( LEVEL ) ) { \
+	static Log::Limiter s_Limiter( __FILE__, __LINE__ ); \
+	if ( s_Limiter.Allow( LEVEL, SUB ) ) Log::Write( LEVEL, SUB, __VA_ARGS__ ); } } while(0)
+
 #endif
 
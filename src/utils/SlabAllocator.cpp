@@ -0,0 +1,157 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include "SlabAllocator.h"
+
+//! blocks are aligned to this many bytes
+#define SLAB_ALIGNMENT			16
+
+SlabAllocator::SlabAllocator( size_t a_BlockSize, size_t a_BlocksPerSlab /*= 256*/, size_t a_BatchSize /*= 64*/ ) :
+	m_BlockSize( a_BlockSize ),
+	m_BlocksPerSlab( a_BlocksPerSlab ),
+	m_BatchSize( a_BatchSize ),
+	m_SlabCount( 0 ),
+	m_HeapAllocations( 0 ),
+	m_BlocksInUse( 0 )
+{
+	if ( m_BlockSize < sizeof(Block) )
+		m_BlockSize = sizeof(Block);
+	m_BlockSize = (m_BlockSize + SLAB_ALIGNMENT - 1) & ~((size_t)SLAB_ALIGNMENT - 1);
+	if ( m_BatchSize < 1 )
+		m_BatchSize = 1;
+	if ( m_BlocksPerSlab < m_BatchSize )
+		m_BlocksPerSlab = m_BatchSize;
+}
+
+SlabAllocator::~SlabAllocator()
+{
+	// release the cache of the calling thread, caches of other threads must be gone by now..
+	m_Cache.reset();
+	for( SlabList::iterator iSlab = m_Slabs.begin(); iSlab != m_Slabs.end(); ++iSlab )
+		delete [] *iSlab;
+	m_Slabs.clear();
+}
+
+void * SlabAllocator::Alloc()
+{
+	Cache * pCache = GetCache();
+	if ( pCache->m_pFree == NULL )
+		Refill( pCache );
+
+	Block * pBlock = pCache->m_pFree;
+	pCache->m_pFree = pBlock->m_pNext;
+	pCache->m_nCount -= 1;
+	m_BlocksInUse += 1;
+
+	return pBlock;
+}
+
+void SlabAllocator::Free( void * a_pBlock )
+{
+	if ( a_pBlock == NULL )
+		return;
+
+	Cache * pCache = GetCache();
+	Block * pBlock = (Block *)a_pBlock;
+	pBlock->m_pNext = pCache->m_pFree;
+	pCache->m_pFree = pBlock;
+	pCache->m_nCount += 1;
+	m_BlocksInUse -= 1;
+
+	// a thread that only frees (e.g. the main thread) hands a batch back once it holds two of them..
+	if ( pCache->m_nCount >= (m_BatchSize * 2) )
+	{
+		Block * pHead = pCache->m_pFree;
+		Block * pLast = pHead;
+		for(size_t i=1;i<m_BatchSize;++i)
+			pLast = pLast->m_pNext;
+
+		pCache->m_pFree = pLast->m_pNext;
+		pCache->m_nCount -= m_BatchSize;
+		pLast->m_pNext = NULL;
+
+		PushBatch( Batch( pHead, m_BatchSize ) );
+	}
+}
+
+SlabAllocator::Cache * SlabAllocator::GetCache()
+{
+	Cache * pCache = m_Cache.get();
+	if ( pCache == NULL )
+	{
+		pCache = new Cache( this );
+		m_HeapAllocations += 1;
+		m_Cache.reset( pCache );
+	}
+	return pCache;
+}
+
+void SlabAllocator::Refill( Cache * a_pCache )
+{
+	m_Lock.lock();
+	if ( m_FreeBatches.size() > 0 )
+	{
+		Batch batch = m_FreeBatches.back();
+		m_FreeBatches.pop_back();
+		m_Lock.unlock();
+
+		a_pCache->m_pFree = batch.m_pHead;
+		a_pCache->m_nCount = batch.m_nCount;
+		return;
+	}
+
+	char * pSlab = new char[ m_BlockSize * m_BlocksPerSlab ];
+	m_Slabs.push_back( pSlab );
+	m_Lock.unlock();
+
+	m_SlabCount += 1;
+	m_HeapAllocations += 1;
+
+	// keep one batch for this thread, put the rest of the new slab on the shared list..
+	Block * pHead = NULL;
+	size_t nCount = 0;
+	for(size_t i=m_BlocksPerSlab;i>0;--i)
+	{
+		Block * pBlock = (Block *)(pSlab + ((i - 1) * m_BlockSize));
+		pBlock->m_pNext = pHead;
+		pHead = pBlock;
+
+		if ( ++nCount == m_BatchSize && i > 1 )
+		{
+			PushBatch( Batch( pHead, nCount ) );
+			pHead = NULL;
+			nCount = 0;
+		}
+	}
+
+	a_pCache->m_pFree = pHead;
+	a_pCache->m_nCount = nCount;
+}
+
+void SlabAllocator::PushBatch( const Batch & a_Batch )
+{
+	m_Lock.lock();
+	m_FreeBatches.push_back( a_Batch );
+	m_Lock.unlock();
+}
+
+SlabAllocator::Cache::~Cache()
+{
+	if ( m_pFree != NULL )
+		m_pOwner->PushBatch( Batch( m_pFree, m_nCount ) );
+}
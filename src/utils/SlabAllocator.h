@@ -0,0 +1,125 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#ifndef WDC_SLAB_ALLOCATOR_H
+#define WDC_SLAB_ALLOCATOR_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "boost/atomic.hpp"
+#include "boost/thread/tss.hpp"
+
+#include "tinythread++/tinythread.h"
+#include "UtilsLib.h"
+
+//! Allocator for fixed-size blocks of memory. Blocks are carved out of large slabs and recycled through a
+//! free list, each thread keeps a small cache of free blocks so Alloc() and Free() normally don't take a lock. 
+//! Full caches are moved to and from a shared list in batches. Memory is returned to the heap only when the 
+//! allocator is destroyed.
+class UTILS_API SlabAllocator
+{
+public:
+	//! Construction
+	SlabAllocator( size_t a_BlockSize, size_t a_BlocksPerSlab = 256, size_t a_BatchSize = 64 );
+	~SlabAllocator();
+
+	//! Accessors
+	size_t GetBlockSize() const
+	{
+		return m_BlockSize;
+	}
+	//! Returns the number of slabs allocated from the heap so far.
+	unsigned int GetSlabCount() const
+	{
+		return m_SlabCount;
+	}
+	//! Returns the number of blocks currently handed out by Alloc().
+	int GetBlocksInUse() const
+	{
+		return m_BlocksInUse;
+	}
+	//! Returns the number of heap allocations made by this allocator, this includes the slabs and the per-thread caches.
+	unsigned int GetHeapAllocations() const
+	{
+		return m_HeapAllocations;
+	}
+
+	//! Returns a block of GetBlockSize() bytes, never returns NULL.
+	void * Alloc();
+	//! Returns a block obtained from Alloc() back to this allocator, the block may be freed from any thread.
+	void Free( void * a_pBlock );
+
+private:
+	//! Types
+	struct Block
+	{
+		Block *			m_pNext;
+	};
+
+	//! A chain of free blocks moved between the shared list and a thread cache in one go.
+	struct Batch
+	{
+		Batch() : m_pHead( NULL ), m_nCount( 0 )
+		{}
+		Batch( Block * a_pHead, size_t a_nCount ) : m_pHead( a_pHead ), m_nCount( a_nCount )
+		{}
+
+		Block *			m_pHead;
+		size_t			m_nCount;
+	};
+	typedef std::vector<Batch>		BatchList;
+	typedef std::vector<char *>		SlabList;
+
+	//! Per-thread list of free blocks, returned to the shared list when the thread exits.
+	struct Cache
+	{
+		Cache( SlabAllocator * a_pOwner ) : m_pOwner( a_pOwner ), m_pFree( NULL ), m_nCount( 0 )
+		{}
+		~Cache();
+
+		SlabAllocator *	m_pOwner;
+		Block *			m_pFree;
+		size_t			m_nCount;
+	};
+
+	//! Functions
+	Cache * GetCache();
+	void Refill( Cache * a_pCache );
+	void PushBatch( const Batch & a_Batch );
+
+	//! Data
+	size_t				m_BlockSize;
+	size_t				m_BlocksPerSlab;
+	size_t				m_BatchSize;
+
+	tthread::mutex		m_Lock;				// protects m_FreeBatches and m_Slabs
+	BatchList			m_FreeBatches;
+	SlabList			m_Slabs;
+
+	boost::atomic<unsigned int>
+						m_SlabCount;
+	boost::atomic<unsigned int>
+						m_HeapAllocations;
+	boost::atomic<int>	m_BlocksInUse;
+
+	boost::thread_specific_ptr<Cache>
+						m_Cache;
+};
+
+#endif
@@ -25,127 +25,370 @@
 #define ERROR_DELEGATE_TIME			(0.5)
 #endif
 
+//! default number of seconds a thread may be idle before it exits
+#define DEFAULT_IDLE_TIMEOUT		(30.0)
+//! longest single wait for work in milliseconds, so changes to the idle timeout are noticed
+#define MAX_IDLE_WAIT				(5000)
+
+#include "boost/shared_ptr.hpp"
+
 #include "ThreadPool.h"
 #include "WatsonException.h"
 #include "Log.h"
+#include "StringUtil.h"
 #include "Time.h"
 
 ThreadPool * ThreadPool::sm_pInstance = NULL;
 
+static void NoWorkerCleanup( void * )
+{}
+boost::thread_specific_ptr<ThreadPool::Worker> ThreadPool::sm_pCurrentWorker( (void (*)(ThreadPool::Worker *))NoWorkerCleanup );
+SlabAllocator * ThreadPool::sm_pTaskSlab = new SlabAllocator( ThreadPool::TASK_SLOT_SIZE );
+boost::atomic<unsigned int> ThreadPool::sm_HeapCallbacks( 0 );
+
+SlabAllocator * ThreadPool::GetTaskSlab()
+{
+	return sm_pTaskSlab;
+}
+
+unsigned int ThreadPool::GetHeapCallbacks()
+{
+	return sm_HeapCallbacks;
+}
+
+ThreadPool * ThreadPool::Find( const std::string & a_Name )
+{
+	tthread::lock_guard<tthread::mutex> lock( GetExecutorLock() );
+	ExecutorMap & executors = GetExecutorMap();
+	ExecutorMap::iterator iExecutor = executors.find( a_Name );
+	if ( iExecutor != executors.end() )
+		return iExecutor->second;
+	return NULL;
+}
+
+ThreadPool * ThreadPool::Executor( const std::string & a_Name )
+{
+	ThreadPool * pPool = Find( a_Name );
+	if ( pPool == NULL )
+		pPool = sm_pInstance;
+	return pPool;
+}
+
+ThreadPool::ExecutorMap & ThreadPool::GetExecutorMap()
+{
+	static ExecutorMap * pMAP = new ExecutorMap();
+	return *pMAP;
+}
+
+tthread::mutex & ThreadPool::GetExecutorLock()
+{
+	static tthread::mutex * pLOCK = new tthread::mutex();
+	return *pLOCK;
+}
+
 //! Construction
-ThreadPool::ThreadPool( int a_Threads /*= 10*/ ) : 
+ThreadPool::ThreadPool( int a_Threads /*= 20*/, const std::string & a_Name /*= std::string()*/ ) : 
+	m_Name( a_Name ),
 	m_ExitCode(0), 
 	m_StopMain( false ),
-	m_ThreadCount( a_Threads ), 
+	m_MinThreads( a_Threads ),
+	m_MaxThreads( a_Threads ),
+	m_IdleTimeout( DEFAULT_IDLE_TIMEOUT ),
+	m_WorkerCount( 0 ),
+	m_ThreadCount( 0 ), 
+	m_StartingThreads( 0 ),
+	m_BlockedThreads( 0 ),
+	m_NextWorker( 0 ),
+	m_PendingTasks( 0 ),
+	m_MainPending( 0 ),
+	m_MainBacklogAge( 0.0 ),
+	m_MainProcessing( false ),
+	m_IdleThreads( 0 ),
 	m_ActiveThreads( 0 ), 
 	m_BusyThreads( 0 ), 
 	m_Shutdown( false )
 {
-	if ( sm_pInstance != NULL )
-		throw WatsonException( "ThreadPool already exists." );
-	sm_pInstance = this;
+	if ( m_Name.size() == 0 )
+	{
+		if ( sm_pInstance != NULL )
+			throw WatsonException( "ThreadPool already exists." );
+		sm_pInstance = this;
+	}
+	else
+	{
+		tthread::lock_guard<tthread::mutex> lock( GetExecutorLock() );
+		ExecutorMap & executors = GetExecutorMap();
+		if ( executors.find( m_Name ) != executors.end() )
+			throw WatsonException( StringUtil::Format( "ThreadPool %s already exists.", m_Name.c_str() ).c_str() );
+		executors[ m_Name ] = this;
+	}
 
-	for(int i=0;i<m_ThreadCount;++i)
-		m_Threads.push_back( new tthread::thread( ThreadMain, this ) );
+	if ( m_MinThreads < 1 )
+		m_MinThreads = 1;
+	if ( m_MinThreads > THREAD_LIMIT )
+		m_MinThreads = THREAD_LIMIT;
+	m_MaxThreads = m_MinThreads;
+	for(int i=0;i<PRIORITY_COUNT;++i)
+	{
+		m_LanePending[i] = 0;
+		m_MainLanePending[i] = 0;
+		m_MainSkipped[i] = 0;
+	}
+
+	// create the minimum workers before starting any threads, so they can steal from each other right away..
+	m_Workers.resize( THREAD_LIMIT, NULL );
+	for(int i=0;i<STRAND_COUNT;++i)
+		m_Strands.push_back( new Strand( this ) );
+	for(int i=0;i<m_MinThreads;++i)
+		m_Workers[i] = new Worker( this, i );
+	m_WorkerCount = m_MinThreads;
+
+	for(int i=0;i<m_MinThreads;++i)
+	{
+		Worker * pWorker = m_Workers[i];
+		pWorker->m_bRunning = true;
+		m_ThreadCount += 1;
+		m_StartingThreads += 1;
+		pWorker->m_pThread = new tthread::thread( ThreadMain, pWorker );
+	}
 }
 
 ThreadPool::~ThreadPool()
 {
+	if ( m_Name.size() > 0 )
+	{
+		tthread::lock_guard<tthread::mutex> lock( GetExecutorLock() );
+		GetExecutorMap().erase( m_Name );
+	}
+
+	m_IdleLock.lock();
 	m_Shutdown = true;
 	m_WakeThread.notify_all();
+	m_IdleLock.unlock();
+
+	// no threads are started once m_Shutdown is set, wait for any thread being started right now..
+	m_GrowLock.lock();
+	m_GrowLock.unlock();
 
-	for( ThreadList::iterator iThread = m_Threads.begin(); iThread != m_Threads.end(); ++iThread )
+	int nWorkers = m_WorkerCount;
+	for(int i=0;i<nWorkers;++i)
 	{
-		(*iThread)->join();
-		delete *iThread;
+		Worker * pWorker = m_Workers[i];
+		if ( pWorker->m_pThread != NULL )
+		{
+			pWorker->m_pThread->join();
+			delete pWorker->m_pThread;
+			pWorker->m_pThread = NULL;
+		}
 	}
 
+	for(int w=0;w<nWorkers;++w)
+	{
+		Worker * pWorker = m_Workers[w];
+		for(int i=0;i<PRIORITY_COUNT;++i)
+			for( TaskDeque::iterator iTask = pWorker->m_Tasks[i].begin(); iTask != pWorker->m_Tasks[i].end(); ++iTask )
+				(*iTask)->Destroy();
+		delete pWorker;
+	}
+	m_Workers.clear();
+
+	for(int i=0;i<PRIORITY_COUNT;++i)
+	{
+		ICallback * pCallback = NULL;
+		while( (pCallback = m_MainQueue[i].Pop()) != NULL )
+			pCallback->Destroy();
+	}
+
+	for(size_t i=0;i<m_Strands.size();++i)
+		delete m_Strands[i];
+	m_Strands.clear();
+
 	if ( sm_pInstance == this )
 		sm_pInstance = NULL;
 }
 
+void ThreadPool::SetMaxThreads( int a_MaxThreads )
+{
+	if ( a_MaxThreads < m_MinThreads )
+		a_MaxThreads = m_MinThreads;
+	if ( a_MaxThreads > THREAD_LIMIT )
+		a_MaxThreads = THREAD_LIMIT;
+	m_MaxThreads = a_MaxThreads;
+
+	// tasks may already be backed up waiting for a thread..
+	WakeThread();
+}
+
 void ThreadPool::ProcessMainThread()
 {
-	// transfer our list to a local copy so we don't block for that long..
-	m_MainQueueLock.lock();
-	DelegateList invoke;
-	invoke.splice( invoke.begin(), m_MainQueue );
-	m_MainQueueLock.unlock();
+	ProcessMainThread( 0.0, 0 );
+}
 
-	for( DelegateList::iterator iDelegate = invoke.begin(); iDelegate != invoke.end(); ++iDelegate )
+int ThreadPool::ProcessMainThread( double a_fMaxTime, int a_nMaxItems /*= 0*/ )
+{
+	// only one thread may consume the main queue, but allow the same thread to re-enter..
+	bool bNested = false;
+	if ( m_MainProcessing.exchange( true, boost::memory_order_acquire ) )
 	{
-#if defined(WARNING_DELEGATE_TIME) && defined(ERROR_DELEGATE_TIME)
-        double startTime = Time().GetEpochTime();
+		if ( m_MainThread != tthread::this_thread::get_id() )
+			return m_MainPending;
+		bNested = true;
+	}
+	else
+		m_MainThread = tthread::this_thread::get_id();
+
+	// only process what is queued right now, so a delegate that re-queues itself can't keep us here forever..
+	int nQueued[ PRIORITY_COUNT ];
+	for(int i=0;i<PRIORITY_COUNT;++i)
+		nQueued[i] = m_MainLanePending[i];
+
+	double fDeadline = 0.0;
+	if ( a_fMaxTime > 0.0 )
+		fDeadline = Time::GetMonotonicTime() + a_fMaxTime;
+
+	int nProcessed = 0;
+	while( a_nMaxItems <= 0 || nProcessed < a_nMaxItems )
+	{
+		int nLane = GetStarvedLane( m_MainSkipped, nQueued );
+		for(int i=0;i<PRIORITY_COUNT && nLane < 0;++i)
+			if ( nQueued[i] > 0 )
+				nLane = i;
+		if ( nLane < 0 )
+			break;
+
+		ICallback * pCallback = m_MainQueue[nLane].Pop();
+		if ( pCallback == NULL )
+		{
+			// a producer is still in the middle of a push, pick it up next time..
+			nQueued[nLane] = 0;
+			continue;
+		}
+		nQueued[nLane] -= 1;
+		UpdateSkipped( nLane, m_MainSkipped, nQueued );
+		m_MainLanePending[nLane] -= 1;
+		nProcessed += 1;
+
+#if ENABLE_DELEGATE_DEBUG
+		double startTime = Time::GetMonotonicTime();
 #endif
-		(*iDelegate)->Invoke();
+		pCallback->Invoke();
 
+#if ENABLE_DELEGATE_DEBUG
+		double elapsed = Time::GetMonotonicTime() - startTime;
+		{
+			tthread::lock_guard<tthread::mutex> lock( m_CallsiteLock );
+			Callsite & callsite = m_Callsites[ std::make_pair( pCallback->GetFile(), pCallback->GetLine() ) ];
+			callsite.m_pFile = pCallback->GetFile();
+			callsite.m_nLine = pCallback->GetLine();
+			callsite.m_nCount += 1;
+			callsite.m_fTotalTime += elapsed;
+			if ( elapsed > callsite.m_fMaxTime )
+				callsite.m_fMaxTime = elapsed;
+		}
+#endif
 #if defined(WARNING_DELEGATE_TIME) && defined(ERROR_DELEGATE_TIME)
-        double elapsed = Time().GetEpochTime() - startTime;
 		if(elapsed > WARNING_DELEGATE_TIME)
 		{
 			if ( elapsed > ERROR_DELEGATE_TIME )
 				Log::Error("ThreadPool", "Delegate %s:%d took %f seconds to invoke on main thread.", 
-					(*iDelegate)->GetFile(), (*iDelegate)->GetLine(), elapsed );
+					pCallback->GetFile(), pCallback->GetLine(), elapsed );
 			else
 				Log::Warning("ThreadPool", "Delegate %s:%d took %f seconds to invoke on main thread.", 
-					(*iDelegate)->GetFile(), (*iDelegate)->GetLine(), elapsed );
+					pCallback->GetFile(), pCallback->GetLine(), elapsed );
 		}
 #endif
-		(*iDelegate)->Destroy();
+		pCallback->Destroy();
+
+		if ( fDeadline > 0.0 && Time::GetMonotonicTime() >= fDeadline )
+			break;
 	}
+	int nRemaining = (m_MainPending -= nProcessed);
+
+	// the oldest invoke is at the front of one of the lanes
+	double fOldest = 0.0;
+	for(int i=0;i<PRIORITY_COUNT && nRemaining > 0;++i)
+	{
+		ICallback * pCallback = m_MainQueue[i].Peek();
+		if ( pCallback != NULL && (fOldest == 0.0 || pCallback->m_fQueuedTime < fOldest) )
+			fOldest = pCallback->m_fQueuedTime;
+	}
+	m_MainBacklogAge = fOldest > 0.0 ? Time::GetCoarseMonotonicTime() - fOldest : 0.0;
+
+	if (! bNested )
+	{
+		m_MainThread = tthread::thread::id();
+		m_MainProcessing.store( false, boost::memory_order_release );
+	}
+
+	return nRemaining;
+}
+
+static bool SortByTotalTime( const ThreadPool::Callsite & a_Left, const ThreadPool::Callsite & a_Right )
+{
+	return a_Left.m_fTotalTime > a_Right.m_fTotalTime;
+}
+
+void ThreadPool::GetMainCallsites( CallsiteList & a_Callsites )
+{
+	a_Callsites.clear();
+
+	tthread::lock_guard<tthread::mutex> lock( m_CallsiteLock );
+	for( CallsiteMap::const_iterator iCallsite = m_Callsites.begin(); iCallsite != m_Callsites.end(); ++iCallsite )
+		a_Callsites.push_back( iCallsite->second );
+	std::sort( a_Callsites.begin(), a_Callsites.end(), SortByTotalTime );
+}
+
+void ThreadPool::ResetMainCallsites()
+{
+	tthread::lock_guard<tthread::mutex> lock( m_CallsiteLock );
+	m_Callsites.clear();
 }
 
 //! This function should be called by the main loop of the application to process any
 //! main thread invokes.
 int ThreadPool::RunMainThread()
 {
-	m_MainQueueLock.lock();
 	m_StopMain = false;
 
 	while( !m_StopMain )
 	{
 		// block until something is pushed into our main queue..
-		m_WakeMain.wait( m_MainQueueLock );
-		m_MainQueueLock.unlock();
+		m_MainWakeLock.lock();
+		while( m_MainPending == 0 && !m_StopMain )
+			m_WakeMain.wait( m_MainWakeLock );
+		m_MainWakeLock.unlock();
 
 		// call with no lock on the main queue..
 		ProcessMainThread();
-
-		m_MainQueueLock.lock();
 	};
 
-	m_MainQueue.clear();
-	m_MainQueueLock.unlock();
-
 	return m_ExitCode;
 }
 
 void ThreadPool::StopMainThread(int a_ExitCode)
 {
+	m_ExitCode = a_ExitCode;
+
+	tthread::lock_guard<tthread::mutex> lock( m_MainWakeLock );
 	m_StopMain = true;
 	m_WakeMain.notify_one();
-
-	m_ExitCode = a_ExitCode;
 }
 
 
 void ThreadPool::ThreadMain( void * arg )
 {
-	ThreadPool * pPool = (ThreadPool *)arg;
+	Worker * pWorker = (Worker *)arg;
+	ThreadPool * pPool = pWorker->m_pPool;
+	sm_pCurrentWorker.reset( pWorker );
 
-	pPool->m_ThreadQueueLock.lock();
+	pPool->m_StartingThreads -= 1;
 	pPool->m_ActiveThreads += 1;
-	while(! pPool->m_Shutdown )
+	pPool->m_BusyThreads += 1;
+	while( true )
 	{
-		pPool->m_WakeThread.wait( pPool->m_ThreadQueueLock );
-		pPool->m_BusyThreads += 1;
-
-		while( pPool->m_ThreadQueue.size() > 0 )
+		ICallback * pCallback = NULL;
+		if ( pPool->PopTask( pWorker, pCallback ) )
 		{
-			ICallback * pCallback = pPool->m_ThreadQueue.front();
-			pPool->m_ThreadQueue.pop_front();
-			pPool->m_ThreadQueueLock.unlock();		// unlock while we are invoking so other threads can work.
-			
 #if ENABLE_THREAD_TRY_CATCH
 			try {
 #endif
@@ -158,26 +401,523 @@ void ThreadPool::ThreadMain( void * arg )
 			}
 #endif
 			pCallback->Destroy();
+			continue;
+		}
+
+		// no work found in any deque, go to sleep until something is queued or we have been idle too long..
+		bool bRetired = false;
+		{
+			tthread::lock_guard<tthread::mutex> lock( pPool->m_IdleLock );
+			if ( pPool->m_Shutdown )
+				break;
+
+			pPool->m_BusyThreads -= 1;
+			pPool->m_IdleThreads += 1;
+			double fIdleStart = Time::GetMonotonicTime();
+			while( pPool->m_PendingTasks == 0 && !pPool->m_Shutdown )
+			{
+				double fIdle = Time::GetMonotonicTime() - fIdleStart;
+				if ( fIdle >= pPool->m_IdleTimeout )
+				{
+					bRetired = pPool->RetireThread( pWorker );
+					if ( bRetired )
+						break;
+					fIdleStart += fIdle;		// we are needed to keep the minimum, start over
+					fIdle = 0.0;
+				}
 
-			pPool->m_ThreadQueueLock.lock();
+				double fWait = (pPool->m_IdleTimeout - fIdle) * 1000.0;
+				pPool->m_WakeThread.wait( pPool->m_IdleLock, fWait < MAX_IDLE_WAIT ? (unsigned int)fWait + 1 : MAX_IDLE_WAIT );
+			}
+			pPool->m_IdleThreads -= 1;
+			pPool->m_BusyThreads += 1;
 		}
 
-		pPool->m_BusyThreads -= 1;
+		if ( bRetired )
+		{
+			// a task may have been queued to us while we were leaving, make sure someone else picks it up..
+			if ( pPool->m_PendingTasks > 0 )
+				pPool->WakeThread();
+			break;
+		}
 	}
+	pPool->m_BusyThreads -= 1;
 	pPool->m_ActiveThreads -= 1;
-	pPool->m_ThreadQueueLock.unlock();
+
+	sm_pCurrentWorker.reset();
+	pWorker->m_bExited = true;
 }
 
-void ThreadPool::InvokeOnThread(ICallback * a_pCallback)
+bool ThreadPool::PopTask( Worker * a_pWorker, ICallback * & a_pCallback )
 {
-		tthread::lock_guard <tthread::recursive_mutex> lock(m_ThreadQueueLock);
-		m_ThreadQueue.push_back(a_pCallback);
+	int nPending[ PRIORITY_COUNT ];
+	for(int i=0;i<PRIORITY_COUNT;++i)
+		nPending[i] = m_LanePending[i];
+
+	// serve a starved lane first, otherwise take the highest lane that has any work..
+	int nLane = GetStarvedLane( a_pWorker->m_Skipped, nPending );
+	if ( nLane < 0 || !PopLane( a_pWorker, nLane, a_pCallback ) )
+	{
+		int nStarved = nLane;
+		nLane = -1;
+		for(int i=0;i<PRIORITY_COUNT;++i)
+		{
+			if ( i != nStarved && PopLane( a_pWorker, i, a_pCallback ) )
+			{
+				nLane = i;
+				break;
+			}
+		}
+		if ( nLane < 0 )
+			return false;
+	}
+
+	UpdateSkipped( nLane, a_pWorker->m_Skipped, nPending );
+	return true;
+}
+
+bool ThreadPool::PopLane( Worker * a_pWorker, int a_nLane, ICallback * & a_pCallback )
+{
+	if ( m_LanePending[a_nLane] <= 0 )
+		return false;
+
+	// pop from the back of our own deque first, this is most likely still in the cache..
+	TaskDeque & tasks = a_pWorker->m_Tasks[a_nLane];
+	a_pWorker->m_TaskLock.lock();
+	if ( tasks.begin() != tasks.end() )
+	{
+		a_pCallback = tasks.back();
+		tasks.pop_back();
+		m_LanePending[a_nLane] -= 1;
+		m_PendingTasks -= 1;
+		a_pWorker->m_TaskLock.unlock();
+		return true;
+	}
+	a_pWorker->m_TaskLock.unlock();
+
+	return StealTask( a_pWorker, a_nLane, a_pCallback );
+}
+
+bool ThreadPool::StealTask( Worker * a_pThief, int a_nLane, ICallback * & a_pCallback )
+{
+	size_t nWorkers = m_WorkerCount;
+	for(size_t i=1;i<nWorkers && m_LanePending[a_nLane] > 0;++i)
+	{
+		Worker * pVictim = m_Workers[ (a_pThief->m_nIndex + i) % nWorkers ];
+
+		// don't wait on a busy deque, just move on to the next victim..
+		if (! pVictim->m_TaskLock.try_lock() )
+			continue;
+		TaskDeque & tasks = pVictim->m_Tasks[a_nLane];
+		if ( tasks.begin() != tasks.end() )
+		{
+			a_pCallback = tasks.front();
+			tasks.pop_front();
+			m_LanePending[a_nLane] -= 1;
+			m_PendingTasks -= 1;
+			pVictim->m_TaskLock.unlock();
+			return true;
+		}
+		pVictim->m_TaskLock.unlock();
+	}
+
+	return false;
+}
+
+int ThreadPool::GetStarvedLane( const int * a_pSkipped, const int * a_pPending )
+{
+	for(int i=PRIORITY_HIGH + 1;i<PRIORITY_COUNT;++i)
+		if ( a_pSkipped[i] >= STARVATION_LIMIT && a_pPending[i] > 0 )
+			return i;
+	return -1;
+}
+
+void ThreadPool::UpdateSkipped( int a_nLane, int * a_pSkipped, const int * a_pPending )
+{
+	// any lower lane that has work waiting was just passed over..
+	a_pSkipped[a_nLane] = 0;
+	for(int i=a_nLane + 1;i<PRIORITY_COUNT;++i)
+	{
+		if ( a_pPending[i] > 0 )
+			a_pSkipped[i] += 1;
+	}
+}
+
+void ThreadPool::WakeThread()
+{
+	// only take the lock if someone is actually sleeping..
+	if ( m_IdleThreads > 0 )
+	{
+		tthread::lock_guard<tthread::mutex> lock( m_IdleLock );
 		m_WakeThread.notify_one();
+	}
+	else if ( m_StartingThreads == 0 && (m_ThreadCount - m_BlockedThreads) < m_MaxThreads 
+		&& m_PendingTasks > (m_ThreadCount - m_BlockedThreads) )
+	{
+		// every thread is busy and work is backing up..
+		GrowThreads( false );
+	}
+}
+
+bool ThreadPool::GrowThreads( bool a_bCompensate )
+{
+	tthread::lock_guard<tthread::mutex> lock( m_GrowLock );
+	if ( m_Shutdown || m_ThreadCount >= THREAD_LIMIT || (m_ThreadCount - m_BlockedThreads) >= m_MaxThreads )
+		return false;
+	// start one thread at a time for a backlog, but always make up for a blocked thread..
+	if (! a_bCompensate && m_StartingThreads > 0 )
+		return false;
+
+	// reuse a worker whose thread has exited, so it's tasks and index are kept..
+	Worker * pWorker = NULL;
+	int nWorkers = m_WorkerCount;
+	for(int i=0;i<nWorkers && pWorker == NULL;++i)
+	{
+		Worker * pSlot = m_Workers[i];
+		if (! pSlot->m_bRunning && (pSlot->m_pThread == NULL || pSlot->m_bExited) )
+			pWorker = pSlot;
+	}
+	if ( pWorker == NULL )
+	{
+		if ( nWorkers >= THREAD_LIMIT )
+			return false;
+		pWorker = new Worker( this, nWorkers );
+		m_Workers[nWorkers] = pWorker;
+		m_WorkerCount = nWorkers + 1;
+	}
+	else if ( pWorker->m_pThread != NULL )
+	{
+		pWorker->m_pThread->join();
+		delete pWorker->m_pThread;
+		pWorker->m_pThread = NULL;
+	}
+
+	pWorker->m_bRunning = true;
+	pWorker->m_bExited = false;
+	m_ThreadCount += 1;
+	m_StartingThreads += 1;
+	pWorker->m_pThread = new tthread::thread( ThreadMain, pWorker );
+
+	return true;
+}
+
+bool ThreadPool::RetireThread( Worker * a_pWorker )
+{
+	// called with m_IdleLock held, GrowThreads() never takes m_IdleLock so the lock order is safe..
+	tthread::lock_guard<tthread::mutex> lock( m_GrowLock );
+	if ( m_Shutdown || (m_ThreadCount - m_BlockedThreads) <= m_MinThreads )
+		return false;
+
+	a_pWorker->m_bRunning = false;
+	m_ThreadCount -= 1;
+	return true;
+}
+
+void ThreadPool::BeginBlocking()
+{
+	Worker * pWorker = sm_pCurrentWorker.get();
+	if ( pWorker == NULL || pWorker->m_nBlocking++ > 0 )
+		return;
+
+	// this thread no longer counts against the maximum, start another if nobody is left to take new work..
+	ThreadPool * pPool = pWorker->m_pPool;
+	pPool->m_BlockedThreads += 1;
+	if ( pPool->m_IdleThreads == 0 )
+		pPool->GrowThreads( true );
+}
+
+void ThreadPool::EndBlocking()
+{
+	Worker * pWorker = sm_pCurrentWorker.get();
+	if ( pWorker == NULL || pWorker->m_nBlocking <= 0 )
+		return;
+	if ( --pWorker->m_nBlocking == 0 )
+		pWorker->m_pPool->m_BlockedThreads -= 1;
+}
+
+void * ThreadPool::AllocCallback( size_t a_Size )
+{
+	if ( a_Size <= TASK_SLOT_SIZE )
+		return sm_pTaskSlab->Alloc();
+
+	sm_HeapCallbacks += 1;
+	return ::operator new( a_Size );
 }
 
-void ThreadPool::InvokeOnMain(ICallback * a_pCallback)
+void ThreadPool::FreeCallback( void * a_pCallback, size_t a_Size )
 {
-		tthread::lock_guard <tthread::recursive_mutex> lock(m_MainQueueLock);
-		m_MainQueue.push_back(a_pCallback);
+	if ( a_Size <= TASK_SLOT_SIZE )
+		sm_pTaskSlab->Free( a_pCallback );
+	else
+		::operator delete( a_pCallback );
+}
+
+void ThreadPool::InvokeOnThread(ICallback * a_pCallback, Priority a_Priority )
+{
+	// if invoked from one of our own threads, push onto the back of that threads deque, otherwise 
+	// pick a worker round-robin so external producers don't all contend on the same lock. External tasks
+	// go onto the front, the owner pops from the back so it runs them in the order they were queued after
+	// any work the owner spawned itself, instead of new tasks always running ahead of older ones.
+	Worker * pWorker = sm_pCurrentWorker.get();
+	bool bExternal = pWorker == NULL || pWorker->m_pPool != this;
+	if ( bExternal )
+	{
+		int nWorkers = m_WorkerCount;
+		pWorker = m_Workers[ m_NextWorker++ % nWorkers ];
+		for(int i=1;i<nWorkers && !pWorker->m_bRunning;++i)
+			pWorker = m_Workers[ m_NextWorker++ % nWorkers ];
+	}
+
+	pWorker->m_TaskLock.lock();
+	if ( bExternal )
+		pWorker->m_Tasks[a_Priority].push_front(a_pCallback);
+	else
+		pWorker->m_Tasks[a_Priority].push_back(a_pCallback);
+	m_LanePending[a_Priority] += 1;
+	m_PendingTasks += 1;
+	pWorker->m_TaskLock.unlock();
+
+	WakeThread();
+}
+
+void ThreadPool::YieldOnThread(ICallback * a_pCallback, Priority a_Priority )
+{
+	// the owner pops from the back, so the front of it's own deque is the last thing it runs..
+	Worker * pWorker = sm_pCurrentWorker.get();
+	if ( pWorker == NULL || pWorker->m_pPool != this )
+	{
+		InvokeOnThread( a_pCallback, a_Priority );
+		return;
+	}
+
+	pWorker->m_TaskLock.lock();
+	pWorker->m_Tasks[a_Priority].push_front(a_pCallback);
+	m_LanePending[a_Priority] += 1;
+	m_PendingTasks += 1;
+	pWorker->m_TaskLock.unlock();
+
+	WakeThread();
+}
+
+//! Shared state of a strand, the drain task holds a reference so the strand may be destroyed with tasks still queued.
+//! m_Pending counts the tasks pushed and not yet finished, whoever takes it from 0 to 1 queues the drain task, so
+//! only one thread ever pops from the queue.
+class ThreadPool::Strand::State
+{
+public:
+	typedef boost::shared_ptr<State>		SP;
+
+	State( ThreadPool * a_pPool, Priority a_Priority ) : m_pPool( a_pPool ), m_Priority( a_Priority ), m_Pending( 0 )
+	{}
+	~State()
+	{
+		ICallback * pCallback = NULL;
+		while( (pCallback = m_Queue.Pop()) != NULL )
+			pCallback->Destroy();
+	}
+
+	void Invoke( const SP & a_spSelf, ICallback * a_pCallback )
+	{
+		m_Queue.Push( a_pCallback );
+		if ( m_Pending++ == 0 )
+			m_pPool->InvokeOnThread<SP>( DELEGATE( State, Drain, SP, this ), a_spSelf, m_Priority );
+	}
+
+	void Drain( SP a_spSelf )
+	{
+		for(int i=0;i<STRAND_BATCH;++i)
+		{
+			// a producer may be between it's exchange and link in Push(), it will be done shortly..
+			ICallback * pCallback = NULL;
+			while( (pCallback = m_Queue.Pop()) == NULL )
+				tthread::this_thread::yield();
+
+#if ENABLE_THREAD_TRY_CATCH
+			try {
+#endif
+				pCallback->Invoke();
+#if ENABLE_THREAD_TRY_CATCH
+			}
+			catch( const WatsonException & ex )
+			{
+				Log::Error( "ThreadPool", "Caught Exception: %s", ex.Message() );
+			}
+#endif
+			pCallback->Destroy();
+
+			if ( --m_Pending == 0 )
+				return;
+		}
+
+		// more work is waiting, queue ourselves again behind the other tasks so they get a turn on this thread
+		m_pPool->YieldOnThread( new ( AllocCallback( sizeof(Callback<SP>) ) ) 
+			Callback<SP>( DELEGATE( State, Drain, SP, this ), a_spSelf ), m_Priority );
+	}
+
+	ThreadPool *		m_pPool;
+	Priority			m_Priority;
+	CallbackQueue		m_Queue;
+	boost::atomic<int>	m_Pending;
+};
+
+ThreadPool::Strand::Strand( ThreadPool * a_pPool /*= NULL*/, Priority a_Priority /*= PRIORITY_NORMAL*/ ) :
+	m_spState( new State( a_pPool != NULL ? a_pPool : ThreadPool::Instance(), a_Priority ) )
+{}
+
+ThreadPool::Strand::~Strand()
+{}
+
+int ThreadPool::Strand::GetPending() const
+{
+	return m_spState->m_Pending;
+}
+
+void ThreadPool::Strand::Invoke( ICallback * a_pCallback )
+{
+	m_spState->Invoke( m_spState, a_pCallback );
+}
+
+ThreadPool::Strand & ThreadPool::GetStrand( const void * a_pKey )
+{
+	// drop the alignment bits then mix, so neighbouring objects land on different strands
+	size_t key = (size_t)a_pKey >> 4;
+	key ^= key >> 7;
+	key *= 2654435761u;
+	return *m_Strands[ (key >> 8) % STRAND_COUNT ];
+}
+
+//! Shared state of a ParallelFor(), ranges are claimed with a CAS on the next index. Each claim takes a share
+//! of what is left divided across the participants, so ranges shrink as the work runs out (guided scheduling). 
+//! Helper tasks hold a reference so a helper that starts after the loop is done finds nothing to do and returns.
+class ParallelJob
+{
+public:
+	typedef boost::shared_ptr<ParallelJob>		SP;
+
+	ParallelJob( size_t a_Begin, size_t a_End, size_t a_Grain, size_t a_Participants, Delegate<ThreadPool::Range &> a_Body ) :
+		m_Next( a_Begin ),
+		m_End( a_End ),
+		m_Grain( a_Grain ),
+		m_Participants( a_Participants ),
+		m_Total( a_End - a_Begin ),
+		m_Done( 0 ),
+		m_Body( a_Body )
+	{}
+
+	bool Claim( ThreadPool::Range & a_Range )
+	{
+		size_t next = m_Next.load();
+		for(;;)
+		{
+			if ( next >= m_End )
+				return false;
+			size_t count = (m_End - next) / (m_Participants * 2);
+			if ( count < m_Grain )
+				count = m_Grain;
+			size_t end = (m_End - next) > count ? next + count : m_End;
+			if ( m_Next.compare_exchange_weak( next, end ) )
+			{
+				a_Range.m_Begin = next;
+				a_Range.m_End = end;
+				return true;
+			}
+		}
+	}
+
+	void Work()
+	{
+		ThreadPool::Range range;
+		while( Claim( range ) )
+		{
+			m_Body( range );
+
+			size_t count = range.m_End - range.m_Begin;
+			if ( (m_Done += count) == m_Total )
+			{
+				tthread::lock_guard<tthread::mutex> lock( m_Lock );
+				m_Finished.notify_all();
+			}
+		}
+	}
+
+	// the argument only keeps the job alive until the helper is done..
+	void Help( SP )
+	{
+		Work();
+	}
+
+	void Wait()
+	{
+		tthread::lock_guard<tthread::mutex> lock( m_Lock );
+		while( m_Done < m_Total )
+			m_Finished.wait( m_Lock );
+	}
+
+private:
+	boost::atomic<size_t>	m_Next;
+	size_t					m_End;
+	size_t					m_Grain;
+	size_t					m_Participants;
+	size_t					m_Total;
+	boost::atomic<size_t>	m_Done;
+	Delegate<ThreadPool::Range &>
+							m_Body;
+	tthread::mutex			m_Lock;
+	tthread::condition_variable
+							m_Finished;
+};
+
+void ThreadPool::ParallelFor( size_t a_Begin, size_t a_End, size_t a_Grain, Delegate<Range &> a_Body )
+{
+	if ( a_Begin >= a_End )
+		return;
+	if ( a_Grain < 1 )
+		a_Grain = 1;
+
+	// one helper per pool thread at most, the calling thread takes the place of one more..
+	size_t nRanges = (a_End - a_Begin + a_Grain - 1) / a_Grain;
+	size_t nHelpers = (size_t)m_ThreadCount;
+	if ( nHelpers > nRanges - 1 )
+		nHelpers = nRanges - 1;
+
+	if ( nHelpers == 0 )
+	{
+		// not worth splitting, no need for any shared state
+		Range range;
+		range.m_Begin = a_Begin;
+		range.m_End = a_End;
+		a_Body( range );
+		return;
+	}
+
+	ParallelJob::SP spJob( new ParallelJob( a_Begin, a_End, a_Grain, nHelpers + 1, a_Body ) );
+	for(size_t i=0;i<nHelpers;++i)
+		InvokeOnThread<ParallelJob::SP>( DELEGATE( ParallelJob, Help, ParallelJob::SP, spJob.get() ), spJob, PRIORITY_HIGH );
+
+	spJob->Work();
+	// only ranges already running on other threads are left, so this never waits on a queued task
+	spJob->Wait();
+}
+
+void ThreadPool::InvokeOnMain(ICallback * a_pCallback, Priority a_Priority )
+{
+	// the main thread belongs to the default pool..
+	ThreadPool * pMain = sm_pInstance;
+	if ( pMain != NULL && pMain != this )
+	{
+		pMain->InvokeOnMain( a_pCallback, a_Priority );
+		return;
+	}
+
+	a_pCallback->m_fQueuedTime = Time::GetCoarseMonotonicTime();
+	m_MainQueue[a_Priority].Push( a_pCallback );
+	m_MainLanePending[a_Priority] += 1;
+
+	// only signal the main thread when the queue goes from empty to non-empty, if it's already
+	// non-empty the main thread is either awake or will be woken by whoever made it non-empty.
+	if ( m_MainPending++ == 0 )
+	{
+		tthread::lock_guard<tthread::mutex> lock( m_MainWakeLock );
 		m_WakeMain.notify_one();
+	}
 }
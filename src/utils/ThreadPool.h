@@ -19,67 +19,279 @@
 #ifndef WDC_THREAD_POOL_H
 #define WDC_THREAD_POOL_H
 
+#include <algorithm>
 #include <list>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <new>
+
+#include "boost/atomic.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/tss.hpp"
 
 #include "Delegate.h"
+#include "SlabAllocator.h"
 #include "tinythread++/tinythread.h"
 #include "UtilsLib.h"
 
+template<typename T> class Future;
+template<typename T> class Promise;
+
 //! This class manages a pool of threads, and allows those threads to invoke functions back on the main thread.
+//! Each worker owns a task deque, it runs it's own work LIFO and steals from the other workers FIFO when it runs
+//! out. Tasks queued from outside the pool are spread across the workers, each worker runs those it was given
+//! oldest first, but there is no order between tasks given to different workers or taken by a thief.
 class UTILS_API ThreadPool 
 {
 public:
-	//! Singleton instance
+	//! Types
+	//! Lanes for queued work, higher lanes are served first but a lane passed over STARVATION_LIMIT times
+	//! in a row is served next.
+	enum Priority
+	{
+		PRIORITY_HIGH,				// latency critical work, request handlers, timeouts
+		PRIORITY_NORMAL,			// default
+		PRIORITY_BACKGROUND,		// bulk work that can wait, decoding, caching, long running loops
+		PRIORITY_COUNT
+	};
+
+	//! A slice of the index space passed to the body of a ParallelFor()
+	struct Range
+	{
+		Range() : m_Begin( 0 ), m_End( 0 )
+		{}
+
+		size_t			m_Begin;
+		size_t			m_End;
+	};
+	//! A slice of a ParallelReduce(), the body accumulates into m_Result which starts as the identity value.
+	template<typename T>
+	struct ReduceRange : public Range
+	{
+		ReduceRange( const T & a_Identity ) : m_Result( a_Identity )
+		{}
+
+		T				m_Result;
+	};
+
+	//! Time spent in main thread invokes queued from one source line, only collected with ENABLE_DELEGATE_DEBUG.
+	struct Callsite
+	{
+		Callsite() : m_pFile( "" ), m_nLine( 0 ), m_nCount( 0 ), m_fTotalTime( 0.0 ), m_fMaxTime( 0.0 )
+		{}
+
+		const char *	m_pFile;
+		int				m_nLine;
+		unsigned int	m_nCount;
+		double			m_fTotalTime;
+		double			m_fMaxTime;
+	};
+	typedef std::vector<Callsite>		CallsiteList;
+
+	//! Singleton instance, this is the default pool
 	static ThreadPool * Instance();
+	//! Returns the pool with the given name, NULL if not found. Named pools give a subsystem it's own threads,
+	//! InvokeOnMain() on a named pool still queues to the default pool since there is only one main thread.
+	static ThreadPool * Find( const std::string & a_Name );
+	//! Returns the pool with the given name, or the default pool if no pool has been created with that name.
+	static ThreadPool * Executor( const std::string & a_Name );
+
+	//! Number of times a lane may be passed over for a higher lane before it's served first.
+	static const int STARVATION_LIMIT = 16;
+	//! Hard limit on the number of threads in a pool, including the threads started to replace blocked threads.
+	static const int THREAD_LIMIT = 256;
+
+	//! Declare a section of a pool task that may block for a long time (I/O, a consume loop), the pool
+	//! doesn't count the thread against it's maximum and starts another thread if none are idle. 
+	//! This does nothing if the calling thread is not a pool thread.
+	class UTILS_API BlockingSection
+	{
+	public:
+		BlockingSection()
+		{
+			ThreadPool::BeginBlocking();
+		}
+		~BlockingSection()
+		{
+			ThreadPool::EndBlocking();
+		}
+	};
+
+	//! Runs the tasks invoked on it one at a time in the order they were invoked, using the threads of a pool.
+	//! Different strands run in parallel, so a strand per connection or per partition keeps each one in order 
+	//! without any locks in the handlers, where it would otherwise have to be invoked on the main thread. Tasks
+	//! still queued when the strand is destroyed are still invoked.
+	class Strand;
+
+	//! Number of strands each pool keeps for GetStrand().
+	static const int STRAND_COUNT = 64;
+	//! Number of tasks a strand runs before it gives the thread back to the pool.
+	static const int STRAND_BATCH = 32;
+
+	//! Size of a task slot in bytes. Callbacks are built in task slots from a shared slab so queuing a task
+	//! normally doesn't allocate, callbacks larger than this are allocated from the heap.
+	static const size_t TASK_SLOT_SIZE = 128;
+	//! Returns the allocator that provides the task slots.
+	static SlabAllocator * GetTaskSlab();
+	//! Returns the number of callbacks that did not fit into a task slot.
+	static unsigned int GetHeapCallbacks();
 
-	//! Construction
-	ThreadPool( int a_Threads = 20 );
+	//! Construction, the pool keeps a_Threads threads running until SetMaxThreads() lets it grow. A pool created 
+	//! without a name is the default pool returned by Instance(), a pool with a name is found with Find().
+	ThreadPool( int a_Threads = 20, const std::string & a_Name = std::string() );
 	~ThreadPool();
 
+	//! Mark the calling pool thread as blocked until EndBlocking() is called, calls may be nested.
+	static void BeginBlocking();
+	static void EndBlocking();
+
 	//! Invoke this function to queue the provided delegate to be invoked by one of the 
 	//! background threads from the thread pool.
 	template<typename ARG>
-	void InvokeOnThread( Delegate<ARG> a_Callback, ARG a_Arg )
+	void InvokeOnThread( Delegate<ARG> a_Callback, ARG a_Arg, Priority a_Priority = PRIORITY_NORMAL )
 	{
-		InvokeOnThread( new Callback<ARG>( a_Callback, a_Arg ) );
+		InvokeOnThread( new ( AllocCallback( sizeof(Callback<ARG>) ) ) Callback<ARG>( a_Callback, a_Arg ), a_Priority );
 	}
 
-	void InvokeOnThread( VoidDelegate a_Callback )
+	void InvokeOnThread( VoidDelegate a_Callback, Priority a_Priority = PRIORITY_NORMAL )
 	{
-		InvokeOnThread(new VoidCallback(a_Callback));
+		InvokeOnThread( new ( AllocCallback( sizeof(VoidCallback) ) ) VoidCallback( a_Callback ), a_Priority );
 	}
 
+	//! Queue a task that completes the given promise and return it's future, the task may also complete the 
+	//! promise later from another thread (e.g. when a request returns). This is defined in Future.h.
+	template<typename R>
+	Future<R> InvokeOnThread( Delegate< Promise<R> > a_Work, Priority a_Priority = PRIORITY_NORMAL );
+
+	//! Returns the strand for the given object, the same object always gets the same strand. Strands are shared
+	//! between keys, so unrelated objects may sometimes wait on each other but never run out of order.
+	Strand & GetStrand( const void * a_pKey );
+
+	//! Invoke the body over [a_Begin,a_End) in ranges of at least a_Grain items and return once all of them are done.
+	//! The calling thread works through the ranges along with the pool threads. Ranges start large and shrink as the 
+	//! work runs out so the threads finish together. The body is called from several threads at once.
+	void ParallelFor( size_t a_Begin, size_t a_End, size_t a_Grain, Delegate<Range &> a_Body );
+	//! Same as ParallelFor(), but each range is reduced on it's own and the results are joined in index order 
+	//! with a_Join( left, right ), so a_Join only needs to be associative.
+	template<typename T, typename JOIN>
+	T ParallelReduce( size_t a_Begin, size_t a_End, size_t a_Grain, const T & a_Identity, 
+		Delegate<ReduceRange<T> &> a_Body, JOIN a_Join );
+
 	//! This function can be invoked from any thread to invoke a function on the main thread.
 	template<typename ARG>
-	void InvokeOnMain( Delegate<ARG> a_Callback, ARG a_Arg )
+	void InvokeOnMain( Delegate<ARG> a_Callback, ARG a_Arg, Priority a_Priority = PRIORITY_NORMAL )
 	{
-		InvokeOnMain( new Callback<ARG>( a_Callback, a_Arg ) );
+		InvokeOnMain( new ( AllocCallback( sizeof(Callback<ARG>) ) ) Callback<ARG>( a_Callback, a_Arg ), a_Priority );
 	}
 
-	void InvokeOnMain( VoidDelegate a_Callback )
+	void InvokeOnMain( VoidDelegate a_Callback, Priority a_Priority = PRIORITY_NORMAL )
 	{
-		InvokeOnMain( new VoidCallback( a_Callback ) );
+		InvokeOnMain( new ( AllocCallback( sizeof(VoidCallback) ) ) VoidCallback( a_Callback ), a_Priority );
 	}
 
 	//! This function should be called by the main loop of the application to process any
-	//! main thread invokes.
+	//! main thread invokes. Only one thread may process the main queue at a time, a callback may
+	//! call this function again from the main thread to process more invokes.
 	void ProcessMainThread();
+	//! Same as ProcessMainThread(), but stops once a_fMaxTime seconds have passed or a_nMaxItems invokes have run,
+	//! zero means no limit. Invokes left over are run by the next call. Returns the number of invokes still waiting.
+	int ProcessMainThread( double a_fMaxTime, int a_nMaxItems = 0 );
 	//! This function runs the main thread until StopMainThread() is invoked.
 	int RunMainThread();
 	//! This is called to make ProcessMainThread() exit.
 	void StopMainThread(int a_ExitCode = 0);
 
+	//! Accessors
+	const std::string & GetName() const
+	{
+		return m_Name;
+	}
+	//! Returns the number of threads currently running in this pool.
+	int GetThreadCount() const
+	{
+		return m_ThreadCount;
+	}
+	int GetMinThreads() const
+	{
+		return m_MinThreads;
+	}
+	int GetMaxThreads() const
+	{
+		return m_MaxThreads;
+	}
+	//! Returns the number of pool threads inside a BlockingSection.
+	int GetBlockedThreads() const
+	{
+		return m_BlockedThreads;
+	}
+	//! Returns the number of threads waiting for work.
+	int GetIdleThreads() const
+	{
+		return m_IdleThreads;
+	}
+	double GetIdleTimeout() const
+	{
+		return m_IdleTimeout;
+	}
+	//! How long a thread may wait for work before it exits, threads never exit below the minimum.
+	void SetIdleTimeout( double a_IdleTimeout )
+	{
+		m_IdleTimeout = a_IdleTimeout;
+	}
+	//! Allow the pool to grow up to a_MaxThreads when tasks back up and every thread is busy, the thread count
+	//! the pool was constructed with is the minimum. Extra threads exit once idle for GetIdleTimeout() seconds,
+	//! a task about to block should use a BlockingSection. This is clamped to the minimum and THREAD_LIMIT.
+	void SetMaxThreads( int a_MaxThreads );
+	//! Returns the number of tasks queued for the background threads that have not started yet.
+	int GetPendingTasks() const
+	{
+		return m_PendingTasks;
+	}
+	//! Returns the number of tasks waiting in the given lane.
+	int GetPendingTasks( Priority a_Priority ) const
+	{
+		return m_LanePending[ a_Priority ];
+	}
+	//! Returns the number of invokes waiting to be processed by the main thread.
+	int GetPendingMain() const
+	{
+		return m_MainPending;
+	}
+	//! Returns the number of main thread invokes waiting in the given lane.
+	int GetPendingMain( Priority a_Priority ) const
+	{
+		return m_MainLanePending[ a_Priority ];
+	}
+	//! Returns how many seconds the oldest waiting invoke had been queued when ProcessMainThread() last returned,
+	//! 0 if nothing was left waiting.
+	double GetMainBacklogAge() const
+	{
+		return m_MainBacklogAge;
+	}
+	//! Returns the main thread time per callsite, sorted by total time.
+	void GetMainCallsites( CallsiteList & a_Callsites );
+	void ResetMainCallsites();
+
 private:
 	//! Types
 	class ICallback
 	{
 	public:
+		ICallback() : m_pNext( NULL ), m_fQueuedTime( 0.0 )
+		{}
 		virtual ~ICallback()
 		{}
 		virtual void Invoke() = 0;
 		virtual void Destroy() = 0;
 		virtual const char * GetFile() const = 0;
 		virtual int GetLine() const = 0;
+
+		boost::atomic<ICallback *>
+						m_pNext;		// link for the intrusive main queue
+		double			m_fQueuedTime;	// coarse monotonic time this was queued for the main thread
 	};
 
 	class VoidCallback : public ICallback
@@ -96,7 +308,8 @@ private:
 		}
 		virtual void Destroy()
 		{
-			delete this;
+			this->~VoidCallback();
+			FreeCallback( this, sizeof(VoidCallback) );
 		}
 
 		virtual const char * GetFile() const
@@ -135,7 +348,8 @@ private:
 		}
 		virtual void Destroy()
 		{
-			delete this;
+			this->~Callback();
+			FreeCallback( this, sizeof(Callback<ARG>) );
 		}
 
 		virtual const char * GetFile() const
@@ -160,36 +374,231 @@ private:
 		ARG m_Arg;
 	};
 	typedef std::list<ICallback *>			DelegateList;
-	typedef std::list<tthread::thread *>	ThreadList;
-	typedef std::list<ThreadPool *>			PoolList;
+	typedef std::deque<ICallback *>			TaskDeque;
+	typedef std::map<std::string,ThreadPool *>	ExecutorMap;
+	typedef std::map<std::pair<const char *,int>,Callsite>	CallsiteMap;
+
+	//! A worker thread and the deque of tasks it owns.
+	struct Worker
+	{
+		Worker( ThreadPool * a_pPool, int a_nIndex ) : 
+			m_pPool( a_pPool ), 
+			m_nIndex( a_nIndex ), 
+			m_pThread( NULL ), 
+			m_bRunning( false ), 
+			m_bExited( false ), 
+			m_nBlocking( 0 )
+		{
+			for(int i=0;i<PRIORITY_COUNT;++i)
+				m_Skipped[i] = 0;
+		}
+
+		ThreadPool *		m_pPool;
+		int					m_nIndex;
+		tthread::thread *	m_pThread;
+		volatile bool		m_bRunning;		// true while a thread is assigned to this worker
+		boost::atomic<bool>	m_bExited;		// set by the thread as the last thing it does
+		int					m_nBlocking;	// nesting depth of BeginBlocking()
+		tthread::mutex		m_TaskLock;		// protects m_Tasks, owner uses the back, thieves use the front
+		TaskDeque			m_Tasks[ PRIORITY_COUNT ];
+		int					m_Skipped[ PRIORITY_COUNT ];	// times each lane was passed over by this worker
+	};
+	typedef std::vector<Worker *>			WorkerList;
+
+	//! Reduces each range of a ParallelReduce() and keeps the result by it's starting index.
+	template<typename T>
+	class Reducer
+	{
+	public:
+		typedef std::vector< std::pair<size_t, T> >	ResultList;
+
+		Reducer( const T & a_Identity, Delegate<ReduceRange<T> &> a_Body ) : m_Identity( a_Identity ), m_Body( a_Body )
+		{}
+
+		void Reduce( Range & a_Range )
+		{
+			ReduceRange<T> range( m_Identity );
+			range.m_Begin = a_Range.m_Begin;
+			range.m_End = a_Range.m_End;
+			m_Body( range );
+
+			tthread::lock_guard<tthread::mutex> lock( m_Lock );
+			m_Results.push_back( std::make_pair( range.m_Begin, range.m_Result ) );
+		}
+
+		static bool SortByBegin( const std::pair<size_t, T> & a_Left, const std::pair<size_t, T> & a_Right )
+		{
+			return a_Left.first < a_Right.first;
+		}
+
+		const T &		m_Identity;
+		Delegate<ReduceRange<T> &>
+						m_Body;
+		tthread::mutex	m_Lock;
+		ResultList		m_Results;
+	};
+
+	//! Intrusive lock-free multi-producer/single-consumer queue of callbacks. Push() may be called from 
+	//! any thread and never blocks, Pop() must only be called by one thread at a time.
+	class CallbackQueue
+	{
+	public:
+		CallbackQueue() : m_pHead( &m_Stub ), m_pTail( &m_Stub )
+		{}
+
+		void Push( ICallback * a_pCallback )
+		{
+			a_pCallback->m_pNext.store( NULL, boost::memory_order_relaxed );
+			ICallback * pPrev = m_pHead.exchange( a_pCallback, boost::memory_order_acq_rel );
+			pPrev->m_pNext.store( a_pCallback, boost::memory_order_release );
+		}
+
+		//! Returns the next item Pop() would return without removing it, NULL if there is none.
+		ICallback * Peek() const
+		{
+			ICallback * pTail = m_pTail;
+			if ( pTail == &m_Stub )
+				pTail = pTail->m_pNext.load( boost::memory_order_acquire );
+			return pTail;
+		}
+
+		//! Returns NULL if the queue is empty or a producer is in the middle of a Push().
+		ICallback * Pop()
+		{
+			ICallback * pTail = m_pTail;
+			ICallback * pNext = pTail->m_pNext.load( boost::memory_order_acquire );
+			if ( pTail == &m_Stub )
+			{
+				if ( pNext == NULL )
+					return NULL;
+				m_pTail = pTail = pNext;
+				pNext = pNext->m_pNext.load( boost::memory_order_acquire );
+			}
+			if ( pNext != NULL )
+			{
+				m_pTail = pNext;
+				return pTail;
+			}
+			if ( pTail != m_pHead.load( boost::memory_order_acquire ) )
+				return NULL;
+
+			// pTail is the last item, push the stub back so we can detach it..
+			Push( &m_Stub );
+			pNext = pTail->m_pNext.load( boost::memory_order_acquire );
+			if ( pNext != NULL )
+			{
+				m_pTail = pNext;
+				return pTail;
+			}
+			return NULL;
+		}
+
+	private:
+		VoidCallback		m_Stub;
+		boost::atomic<ICallback *>
+							m_pHead;		// producers exchange onto the head
+		ICallback *			m_pTail;		// only touched by the consumer
+	};
 
 	//! Functions
-	void InvokeOnThread( ICallback * a_pCallback );
-	void InvokeOnMain( ICallback * a_pCallback );
+	static void * AllocCallback( size_t a_Size );
+	static void FreeCallback( void * a_pCallback, size_t a_Size );
+	void InvokeOnThread( ICallback * a_pCallback, Priority a_Priority );
+	//! Queue a task from a pool thread behind the tasks already waiting on that thread, instead of ahead of them.
+	void YieldOnThread( ICallback * a_pCallback, Priority a_Priority );
+	void InvokeOnMain( ICallback * a_pCallback, Priority a_Priority );
+	bool PopTask( Worker * a_pWorker, ICallback * & a_pCallback );
+	bool PopLane( Worker * a_pWorker, int a_nLane, ICallback * & a_pCallback );
+	bool StealTask( Worker * a_pThief, int a_nLane, ICallback * & a_pCallback );
+	bool GrowThreads( bool a_bCompensate );
+	bool RetireThread( Worker * a_pWorker );
+	static int GetStarvedLane( const int * a_pSkipped, const int * a_pPending );
+	static void UpdateSkipped( int a_nLane, int * a_pSkipped, const int * a_pPending );
+	void WakeThread();
 
 	//! Data
+	std::string			m_Name;
 	volatile bool		m_StopMain;
-	int					m_ThreadCount;
-	ThreadList			m_Threads;
 	int 				m_ExitCode;
+	int					m_MinThreads;
+	volatile int		m_MaxThreads;
+	double				m_IdleTimeout;
+
+	tthread::mutex		m_GrowLock;			// protects starting and retiring threads
+	WorkerList			m_Workers;			// THREAD_LIMIT slots, created on demand and never removed while the pool exists
+	std::vector<Strand *>
+						m_Strands;			// STRAND_COUNT strands handed out by GetStrand()
+	boost::atomic<int>	m_WorkerCount;		// number of slots that have been created
+	boost::atomic<int>	m_ThreadCount;		// number of running threads
+	boost::atomic<int>	m_StartingThreads;	// threads started but not yet running
+	boost::atomic<int>	m_BlockedThreads;
+	boost::atomic<unsigned int>
+						m_NextWorker;		// round-robin index for tasks queued from outside the pool
+	boost::atomic<int>	m_PendingTasks;		// total number of tasks in all worker deques
+	boost::atomic<int>	m_LanePending[ PRIORITY_COUNT ];
 
-	tthread::recursive_mutex		
-						m_ThreadQueueLock;
-	DelegateList		m_ThreadQueue;
-	tthread::recursive_mutex
-						m_MainQueueLock;
-	DelegateList		m_MainQueue;
+	CallbackQueue		m_MainQueue[ PRIORITY_COUNT ];
+	boost::atomic<int>	m_MainPending;		// number of invokes pushed but not yet processed
+	volatile double		m_MainBacklogAge;
+	tthread::mutex		m_CallsiteLock;
+	CallsiteMap			m_Callsites;		// keyed by the file pointer and line of the delegate
+	boost::atomic<int>	m_MainLanePending[ PRIORITY_COUNT ];
+	int					m_MainSkipped[ PRIORITY_COUNT ];	// only touched by the thread processing the main queue
+	boost::atomic<bool>	m_MainProcessing;	// set while a thread is inside ProcessMainThread()
+	tthread::thread::id	m_MainThread;		// the thread that set m_MainProcessing
 
+	tthread::mutex		m_IdleLock;			// only taken to put a worker to sleep or to wake one up
 	tthread::condition_variable
 						m_WakeThread;
+	tthread::mutex		m_MainWakeLock;		// only taken when the main queue goes from empty to non-empty
 	tthread::condition_variable
 						m_WakeMain;
-	volatile int		m_ActiveThreads;
-	volatile int		m_BusyThreads;
+	boost::atomic<int>	m_IdleThreads;
+	boost::atomic<int>	m_ActiveThreads;
+	boost::atomic<int>	m_BusyThreads;
 	volatile bool		m_Shutdown;
 
+	static boost::thread_specific_ptr<Worker>
+						sm_pCurrentWorker;	// the worker for the calling thread, NULL if not a pool thread
+
+	static SlabAllocator *
+						sm_pTaskSlab;		// never deleted, callbacks may outlive any pool
+	static boost::atomic<unsigned int>
+						sm_HeapCallbacks;
+
 	static void ThreadMain( void * arg );
 	static ThreadPool *	sm_pInstance;
+	static ExecutorMap &	GetExecutorMap();
+	static tthread::mutex &	GetExecutorLock();
+};
+
+class UTILS_API ThreadPool::Strand
+{
+public:
+	//! Construction, a NULL pool uses the default pool.
+	Strand( ThreadPool * a_pPool = NULL, Priority a_Priority = PRIORITY_NORMAL );
+	~Strand();
+
+	template<typename ARG>
+	void Invoke( Delegate<ARG> a_Callback, ARG a_Arg )
+	{
+		Invoke( new ( AllocCallback( sizeof(Callback<ARG>) ) ) Callback<ARG>( a_Callback, a_Arg ) );
+	}
+	void Invoke( VoidDelegate a_Callback )
+	{
+		Invoke( new ( AllocCallback( sizeof(VoidCallback) ) ) VoidCallback( a_Callback ) );
+	}
+
+	//! Returns the number of tasks invoked on this strand that have not finished.
+	int GetPending() const;
+
+private:
+	class State;
+
+	//! Data
+	boost::shared_ptr<State>	m_spState;
+
+	void Invoke( ICallback * a_pCallback );
 };
 
 inline ThreadPool * ThreadPool::Instance()
@@ -197,5 +606,24 @@ inline ThreadPool * ThreadPool::Instance()
 	return sm_pInstance;
 }
 
+template<typename T, typename JOIN>
+T ThreadPool::ParallelReduce( size_t a_Begin, size_t a_End, size_t a_Grain, const T & a_Identity, 
+	Delegate<ReduceRange<T> &> a_Body, JOIN a_Join )
+{
+	Reducer<T> reducer( a_Identity, a_Body );
+	ParallelFor( a_Begin, a_End, a_Grain, DELEGATE( Reducer<T>, Reduce, Range &, &reducer ) );
+
+	// ranges finish in any order, sort them back into index order before joining
+	std::sort( reducer.m_Results.begin(), reducer.m_Results.end(), Reducer<T>::SortByBegin );
+
+	T result( a_Identity );
+	for( typename Reducer<T>::ResultList::const_iterator iResult = reducer.m_Results.begin(); 
+		iResult != reducer.m_Results.end(); ++iResult )
+	{
+		result = a_Join( result, iResult->second );
+	}
+	return result;
+}
+
 #endif
 
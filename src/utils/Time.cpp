@@ -24,6 +24,101 @@
 #include <time.h>
 #include <sys/stat.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+
+boost::uint64_t Time::GetMonotonicMicroseconds()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = { 0 };
+	if ( frequency.QuadPart == 0 )
+		QueryPerformanceFrequency( &frequency );
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	// split the division so the multiply can't overflow
+	return (boost::uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000 
+		+ ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t timebase = { 0, 0 };
+	if ( timebase.denom == 0 )
+		mach_timebase_info( &timebase );
+
+	return (boost::uint64_t)(((double)mach_absolute_time() * timebase.numer) / (timebase.denom * 1000.0));
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ((boost::uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#endif
+}
+
+boost::uint64_t Time::GetCoarseMonotonicMicroseconds()
+{
+#if defined(CLOCK_MONOTONIC_COARSE)
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+	return ((boost::uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#else
+	return GetMonotonicMicroseconds();
+#endif
+}
+
+Time Time::GetCoarseTime()
+{
+#ifdef _WIN32
+	// the system time is only updated once per tick, unlike ftime() it doesn't look up the time zone
+	FILETIME ft;
+	GetSystemTimeAsFileTime( &ft );
+	boost::uint64_t ms = ((((boost::uint64_t)ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 10000;
+	ms -= 11644473600000ULL;		// 1601 to 1970
+	Time now( (time_t)(ms / 1000) );
+	now.m_tb.millitm = (unsigned short)(ms % 1000);
+#elif defined(CLOCK_REALTIME_COARSE)
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME_COARSE, &ts );
+	Time now( (time_t)ts.tv_sec );
+	now.m_tb.millitm = (unsigned short)(ts.tv_nsec / 1000000);
+#else
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	Time now( (time_t)tv.tv_sec );
+	now.m_tb.millitm = (unsigned short)(tv.tv_usec / 1000);
+#endif
+	now.m_tb.timezone = 0;
+	now.m_tb.dstflag = 0;
+
+	return now;
+}
+
+double Time::GetCoarseResolution()
+{
+	static double resolution = 0.0;
+	if ( resolution == 0.0 )
+	{
+#ifdef _WIN32
+		DWORD adjustment, increment;
+		BOOL bDisabled;
+		if ( GetSystemTimeAdjustment( &adjustment, &increment, &bDisabled ) && increment > 0 )
+			resolution = increment / 10000000.0;		// in 100 ns units
+		else
+			resolution = 0.016;
+#elif defined(CLOCK_MONOTONIC_COARSE)
+		struct timespec ts;
+		if ( clock_getres( CLOCK_MONOTONIC_COARSE, &ts ) == 0 )
+			resolution = ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+		else
+			resolution = 0.01;
+#else
+		resolution = 0.000001;
+#endif
+	}
+
+	return resolution;
+}
+
 std::string Time::GetFormattedTime( const char * a_pFormat )
 {
 	char buffer[ 1024 ];
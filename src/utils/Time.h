@@ -28,6 +28,8 @@
 #include <stdlib.h>
 #include <string>
 
+#include "boost/cstdint.hpp"
+
 #include "UtilsLib.h"
 
 class UTILS_API Time
@@ -78,6 +80,32 @@ public:
 		return epochTime;
 	}
 
+	//! Returns microseconds from a steady clock that never steps with changes to the wall clock, only the 
+	//! difference between two values has any meaning. Use this for measuring intervals and scheduling.
+	static boost::uint64_t GetMonotonicMicroseconds();
+	//! Returns GetMonotonicMicroseconds() in seconds.
+	static double GetMonotonicTime()
+	{
+		return (double)GetMonotonicMicroseconds() / 1000000.0;
+	}
+
+	//! Returns a monotonic time that is only updated once per scheduler tick (1-10 ms depending on the OS) 
+	//! but costs a fraction of GetMonotonicMicroseconds(). Use this for timestamps on hot paths that don't 
+	//! need better than GetCoarseResolution(). This is the same clock as GetMonotonicMicroseconds(), so the two
+	//! may be compared, the coarse value is never ahead. Where the OS has no coarse clock this is the precise clock.
+	static boost::uint64_t GetCoarseMonotonicMicroseconds();
+	//! Returns GetCoarseMonotonicMicroseconds() in seconds.
+	static double GetCoarseMonotonicTime()
+	{
+		return (double)GetCoarseMonotonicMicroseconds() / 1000000.0;
+	}
+	//! Returns the current wall clock time from the coarse clock, the milliseconds are only as precise as
+	//! GetCoarseResolution(). The dstflag and timezone are not set.
+	static Time GetCoarseTime();
+	//! Returns the tick length of the coarse clocks in seconds, as reported by the OS. This is not a bound on
+	//! how far they lag behind the precise clocks, a tickless kernel can update them less often than this.
+	static double GetCoarseResolution();
+
 	//! Get a string containing a formatted time, see strftime()
 	std::string GetFormattedTime( const char * a_pFormat );
 	//! Converts time from string to seconds - "1:15:00"
@@ -16,22 +16,438 @@
 */
 
 
+#include <math.h>
+#include <set>
+#include <vector>
+
+#include "boost/cstdint.hpp"
+
 #include "TimerPool.h"
 #include "ThreadPool.h"
+#include "SlabAllocator.h"
+#include "WatsonException.h"
 #include "../utils/Log.h"
 #include "Time.h"
 
 const double MIN_INTERVAL_TIME = 0.01;		// the minimum amount of time for a recurring timer
+const double HIGH_RES_MIN_INTERVAL = 0.0001;	// the minimum for a recurring timer in high resolution mode
+const double HIGH_RES_SPIN_TIME = 0.001;	// in high resolution mode the timer thread yields instead of sleeping this close to a timer
+
+const double TimerPool::WHEEL_TICK = 0.001;
+const double TimerPool::HIGH_RES_WHEEL_TICK = 0.0001;
+const double TimerPool::TIMEOUT_SLACK = 0.25;
+const double TimerPool::INLINE_BUDGET = 0.001;
 
 TimerPool * TimerPool::sm_pInstance = NULL;
 
-TimerPool::TimerPool()
-	: m_bShutdown( false ), m_pTimerThread( NULL )
+//! Interface for the container of pending timers, all functions are called with m_TimerQueueLock held.
+class TimerPool::ITimerQueue
+{
+public:
+	typedef std::vector<ITimer::SP>		TimerList;
+
+	virtual ~ITimerQueue()
+	{}
+
+	virtual void Insert( const ITimer::SP & a_spTimer ) = 0;
+	virtual bool Remove( const ITimer::SP & a_spTimer ) = 0;
+	virtual void Clear() = 0;
+	virtual size_t GetCount() const = 0;
+	//! Returns false if there are no timers, otherwise the earliest time a timer may be due.
+	virtual bool GetNextSignal( double & a_NextSignal ) = 0;
+	//! Remove the timers that are due at a_Now, timers that have been destroyed are dropped.
+	virtual void PopExpired( double a_Now, TimerList & a_Expired ) = 0;
+};
+
+//! The original ordered set of timers
+class TimerPool::MultiSetQueue : public ITimerQueue
+{
+public:
+	virtual void Insert( const ITimer::SP & a_spTimer )
+	{
+		m_Timers.insert( TimerMultiSetStruct( a_spTimer ) );
+	}
+
+	virtual bool Remove( const ITimer::SP & a_spTimer )
+	{
+		// Cannot use built in erase(key_value)... would remove all timers with same next signal time
+		for( TimerMultiSet::iterator iTimerStruct = m_Timers.begin(); iTimerStruct != m_Timers.end(); ++iTimerStruct )
+		{
+			if ( (iTimerStruct->m_pTimer).lock() == a_spTimer)
+			{
+				m_Timers.erase( iTimerStruct );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	virtual void Clear()
+	{
+		m_Timers.clear();
+	}
+
+	virtual size_t GetCount() const
+	{
+		return m_Timers.size();
+	}
+
+	virtual bool GetNextSignal( double & a_NextSignal )
+	{
+		// timer objects destroyed, just remove them from the list..
+		while( m_Timers.begin() != m_Timers.end() && m_Timers.begin()->m_pTimer.expired() )
+			m_Timers.erase( m_Timers.begin() );
+		if ( m_Timers.begin() == m_Timers.end() )
+			return false;
+
+		a_NextSignal = m_Timers.begin()->m_NextSignalEpochTime;
+		return true;
+	}
+
+	virtual void PopExpired( double a_Now, TimerList & a_Expired )
+	{
+		while( m_Timers.begin() != m_Timers.end() )
+		{
+			if ( a_Now < m_Timers.begin()->m_NextSignalEpochTime )
+				break;				// not time yet, stop enumerating timers..
+
+			ITimer::SP spTimer = (m_Timers.begin()->m_pTimer).lock();
+			m_Timers.erase( m_Timers.begin() );
+			if ( spTimer )
+				a_Expired.push_back( spTimer );
+		}
+	}
+
+private:
+	//! Types
+	// Timer struct to enable the sorting of weak pointers within multiset
+	struct TimerMultiSetStruct
+	{
+		TimerMultiSetStruct( ITimer::SP a_pTimer )
+		{
+			m_NextSignalEpochTime = a_pTimer->GetDueTime();
+			m_pTimer = a_pTimer;
+		}
+		ITimer::WP 		m_pTimer;
+		double 			m_NextSignalEpochTime;
+	};
+
+	struct TimerCompare {
+		bool operator() (const TimerMultiSetStruct & a_Timer1, const TimerMultiSetStruct & a_Timer2) const {
+			return a_Timer1.m_NextSignalEpochTime < a_Timer2.m_NextSignalEpochTime;
+		}
+	};
+
+	typedef std::multiset<TimerMultiSetStruct, TimerCompare, std::allocator<TimerMultiSetStruct> >				TimerMultiSet;
+
+	//! Data
+	TimerMultiSet		m_Timers;
+};
+
+//! Hierarchical timing wheel, LEVELS wheels of SLOTS slots each. Level 0 holds the timers due within SLOTS ticks, 
+//! one slot per tick, each higher level covers SLOTS times the range of the level below. When level 0 wraps 
+//! around, the current slot of the next level is cascaded down into the lower levels. Each slot is an intrusive 
+//! list and the timer keeps a pointer to it's entry, so starting and stopping a timer are both O(1).
+class TimerPool::WheelQueue : public ITimerQueue
+{
+public:
+	WheelQueue( double a_Tick ) : m_Tick( a_Tick ), m_Start( Time::GetMonotonicTime() ), m_Current( 0 ), m_Count( 0 )
+	{
+		for(int i=0;i<LEVELS * SLOTS;++i)
+			m_Slots[i] = NULL;
+		for(int i=0;i<LEVELS;++i)
+			for(int k=0;k<WORDS;++k)
+				m_Occupied[i][k] = 0;
+	}
+	~WheelQueue()
+	{
+		Clear();
+	}
+
+	virtual void Insert( const ITimer::SP & a_spTimer )
+	{
+		Entry * pEntry = new ( GetEntrySlab()->Alloc() ) Entry();
+		pEntry->m_wpTimer = a_spTimer;
+		pEntry->m_Due = GetTick( a_spTimer->GetDueTime() );
+		a_spTimer->m_pQueueEntry = pEntry;
+
+		Link( pEntry );
+		m_Count += 1;
+	}
+
+	virtual bool Remove( const ITimer::SP & a_spTimer )
+	{
+		Entry * pEntry = (Entry *)a_spTimer->m_pQueueEntry;
+		if ( pEntry == NULL )
+			return false;
+
+		a_spTimer->m_pQueueEntry = NULL;
+		Unlink( pEntry );
+		FreeEntry( pEntry );
+		return true;
+	}
+
+	virtual void Clear()
+	{
+		for(int i=0;i<LEVELS * SLOTS;++i)
+		{
+			while( m_Slots[i] != NULL )
+			{
+				Entry * pEntry = m_Slots[i];
+				ITimer::SP spTimer = pEntry->m_wpTimer.lock();
+				if ( spTimer )
+					spTimer->m_pQueueEntry = NULL;
+				Unlink( pEntry );
+				FreeEntry( pEntry );
+			}
+		}
+	}
+
+	virtual size_t GetCount() const
+	{
+		return m_Count;
+	}
+
+	virtual bool GetNextSignal( double & a_NextSignal )
+	{
+		if ( m_Count == 0 )
+			return false;
+
+		// the next occupied slot in level 0, or the next time level 0 wraps and cascades the higher levels
+		boost::uint64_t next = (m_Current | SLOT_MASK) + 1;
+		int nSlot = FindOccupied( (int)(m_Current & SLOT_MASK) );
+		if ( nSlot >= 0 )
+			next = (m_Current & ~(boost::uint64_t)SLOT_MASK) + nSlot;
+
+		a_NextSignal = m_Start + (double)next * m_Tick;
+		return true;
+	}
+
+	virtual void PopExpired( double a_Now, TimerList & a_Expired )
+	{
+		if ( a_Now < m_Start )
+			return;
+		boost::uint64_t now = (boost::uint64_t)((a_Now - m_Start) / m_Tick);
+
+		while( m_Current <= now )
+		{
+			if ( m_Count == 0 )
+			{
+				m_Current = now + 1;
+				break;
+			}
+
+			// cascade each level that the lower level just wrapped into
+			for(int i=1;i<LEVELS;++i)
+			{
+				if ( ((m_Current >> (SLOT_BITS * (i - 1))) & SLOT_MASK) != 0 )
+					break;
+				Cascade( i );
+			}
+
+			int nSlot = (int)(m_Current & SLOT_MASK);
+			Entry * pEntry = Detach( nSlot );
+			while( pEntry != NULL )
+			{
+				Entry * pNext = pEntry->m_pNext;
+				if ( pEntry->m_Due > m_Current )
+				{
+					// beyond the range of the wheel when inserted, place it again
+					Link( pEntry );
+				}
+				else
+				{
+					ITimer::SP spTimer = pEntry->m_wpTimer.lock();
+					if ( spTimer )
+					{
+						spTimer->m_pQueueEntry = NULL;
+						a_Expired.push_back( spTimer );
+					}
+					m_Count -= 1;
+					pEntry->~Entry();
+					GetEntrySlab()->Free( pEntry );
+				}
+				pEntry = pNext;
+			}
+
+			// skip the empty slots up to the end of level 0, so a long sleep doesn't walk every tick
+			m_Current += 1;
+			if ( (m_Current & SLOT_MASK) != 0 && FindOccupied( (int)(m_Current & SLOT_MASK) ) < 0 )
+			{
+				boost::uint64_t wrap = (m_Current | SLOT_MASK) + 1;
+				m_Current = wrap < now + 1 ? wrap : now + 1;
+			}
+		}
+	}
+
+private:
+	//! Types
+	struct Entry
+	{
+		Entry() : m_Due( 0 ), m_Index( -1 ), m_pPrev( NULL ), m_pNext( NULL )
+		{}
+
+		ITimer::WP			m_wpTimer;
+		boost::uint64_t		m_Due;			// tick this timer is due
+		int					m_Index;		// slot this entry is linked into
+		Entry *				m_pPrev;
+		Entry *				m_pNext;
+	};
+
+	//! Constants
+	static const int SLOT_BITS = 8;
+	static const int SLOTS = 1 << SLOT_BITS;
+	static const int SLOT_MASK = SLOTS - 1;
+	static const int LEVELS = 4;
+	static const int WORDS = SLOTS / 64;
+
+	//! Data
+	double				m_Tick;			// seconds per tick
+	double				m_Start;		// time of tick 0
+	boost::uint64_t		m_Current;		// next tick to expire
+	size_t				m_Count;
+	Entry *				m_Slots[ LEVELS * SLOTS ];
+	boost::uint64_t		m_Occupied[ LEVELS ][ WORDS ];
+
+	//! Entries are recycled through a slab, it's never deleted since other threads may cache blocks from it
+	static SlabAllocator * GetEntrySlab()
+	{
+		static SlabAllocator * pSLAB = new SlabAllocator( sizeof(Entry) );
+		return pSLAB;
+	}
+
+	//! Returns the tick a timer due at the given time should fire, rounded up so a timer never fires early.
+	boost::uint64_t GetTick( double a_Time ) const
+	{
+		if ( a_Time <= m_Start )
+			return m_Current;
+		double ticks = (a_Time - m_Start) / m_Tick;
+		boost::uint64_t tick = (boost::uint64_t)ticks;
+		if ( (double)tick < ticks )
+			tick += 1;
+		return tick > m_Current ? tick : m_Current;
+	}
+
+	void Link( Entry * a_pEntry )
+	{
+		boost::uint64_t delta = a_pEntry->m_Due > m_Current ? a_pEntry->m_Due - m_Current : 0;
+		boost::uint64_t place = a_pEntry->m_Due;
+
+		int nLevel = 0;
+		while( nLevel < (LEVELS - 1) && delta >= ((boost::uint64_t)1 << (SLOT_BITS * (nLevel + 1))) )
+			nLevel += 1;
+
+		// too far out for the wheel, park it in the last slot of the top level and place it again once it expires
+		boost::uint64_t range = (boost::uint64_t)1 << (SLOT_BITS * LEVELS);
+		if ( delta >= range )
+			place = m_Current + range - 1;
+
+		int nSlot = (int)((place >> (SLOT_BITS * nLevel)) & SLOT_MASK);
+		int nIndex = (nLevel * SLOTS) + nSlot;
+
+		a_pEntry->m_Index = nIndex;
+		a_pEntry->m_pPrev = NULL;
+		a_pEntry->m_pNext = m_Slots[nIndex];
+		if ( a_pEntry->m_pNext != NULL )
+			a_pEntry->m_pNext->m_pPrev = a_pEntry;
+		m_Slots[nIndex] = a_pEntry;
+		m_Occupied[nLevel][nSlot / 64] |= (boost::uint64_t)1 << (nSlot % 64);
+	}
+
+	void Unlink( Entry * a_pEntry )
+	{
+		int nIndex = a_pEntry->m_Index;
+		if ( a_pEntry->m_pPrev != NULL )
+			a_pEntry->m_pPrev->m_pNext = a_pEntry->m_pNext;
+		else
+			m_Slots[nIndex] = a_pEntry->m_pNext;
+		if ( a_pEntry->m_pNext != NULL )
+			a_pEntry->m_pNext->m_pPrev = a_pEntry->m_pPrev;
+		if ( m_Slots[nIndex] == NULL )
+			ClearOccupied( nIndex );
+
+		a_pEntry->m_Index = -1;
+		a_pEntry->m_pPrev = a_pEntry->m_pNext = NULL;
+	}
+
+	void FreeEntry( Entry * a_pEntry )
+	{
+		m_Count -= 1;
+		a_pEntry->~Entry();
+		GetEntrySlab()->Free( a_pEntry );
+	}
+
+	//! Remove and return the whole list in the given slot
+	Entry * Detach( int a_nIndex )
+	{
+		Entry * pList = m_Slots[a_nIndex];
+		m_Slots[a_nIndex] = NULL;
+		ClearOccupied( a_nIndex );
+		return pList;
+	}
+
+	void ClearOccupied( int a_nIndex )
+	{
+		int nLevel = a_nIndex / SLOTS;
+		int nSlot = a_nIndex % SLOTS;
+		m_Occupied[nLevel][nSlot / 64] &= ~((boost::uint64_t)1 << (nSlot % 64));
+	}
+
+	void Cascade( int a_nLevel )
+	{
+		int nSlot = (int)((m_Current >> (SLOT_BITS * a_nLevel)) & SLOT_MASK);
+		Entry * pEntry = Detach( (a_nLevel * SLOTS) + nSlot );
+		while( pEntry != NULL )
+		{
+			Entry * pNext = pEntry->m_pNext;
+			Link( pEntry );
+			pEntry = pNext;
+		}
+	}
+
+	//! Returns the first occupied slot in level 0 at or after the given slot, -1 if none.
+	int FindOccupied( int a_nSlot ) const
+	{
+		for(int w=a_nSlot / 64;w<WORDS;++w)
+		{
+			boost::uint64_t bits = m_Occupied[0][w];
+			if ( w == a_nSlot / 64 )
+				bits &= ~(boost::uint64_t)0 << (a_nSlot % 64);
+			if ( bits == 0 )
+				continue;
+
+			int nBit = 0;
+			while( (bits & 1) == 0 )
+			{
+				bits >>= 1;
+				nBit += 1;
+			}
+			return (w * 64) + nBit;
+		}
+		return -1;
+	}
+};
+
+TimerPool::TimerPool( QueueType a_QueueType /*= QUEUE_MULTISET*/, bool a_bHighResolution /*= false*/ )
+	: m_bShutdown( false ), 
+	m_pTimerThread( NULL ), 
+	m_QueueType( a_QueueType ), 
+	m_bHighResolution( a_bHighResolution ),
+	m_pTimerQueue( NULL ), 
+	m_WakeTime( 0.0 ),
+	m_Wakeups( 0 ),
+	m_Dispatches( 0 ),
+	m_InlineBudget( INLINE_BUDGET ),
+	m_InlineOverruns( 0 )
 {
 	if ( sm_pInstance != NULL )
 		Log::Error( "TimerPool", "Multiple instances of TimerPool created." );
 	sm_pInstance = this;
 
+	if ( m_QueueType == QUEUE_WHEEL )
+		m_pTimerQueue = new WheelQueue( m_bHighResolution ? HIGH_RES_WHEEL_TICK : WHEEL_TICK );
+	else
+		m_pTimerQueue = new MultiSetQueue();
 	m_pTimerThread = new boost::thread( TimerThread, this );
 }
 
@@ -47,31 +463,43 @@ TimerPool::~TimerPool()
 
 	m_pTimerThread->join();
 	delete m_pTimerThread;
+	delete m_pTimerQueue;
+}
+
+double TimerPool::AlignToSlack( double a_Time, double a_Slack )
+{
+	if ( a_Slack <= 0.0 )
+		return a_Time;
+
+	double fGranularity = 1.0;
+	while( fGranularity > a_Slack )
+		fGranularity /= 2.0;
+	while( (fGranularity * 2.0) <= a_Slack )
+		fGranularity *= 2.0;
+
+	double fAligned = ceil( a_Time / fGranularity ) * fGranularity;
+	return fAligned > a_Time ? fAligned : a_Time;
+}
+
+size_t TimerPool::GetPendingTimers()
+{
+	tthread::lock_guard<tthread::mutex> lock( m_TimerQueueLock );
+	return m_pTimerQueue->GetCount();
 }
 
 bool TimerPool::StopTimer( ITimer::SP a_spTimer )
 {
-	boost::lock_guard<boost::mutex> lock( m_TimerQueueLock );
+	tthread::lock_guard<tthread::mutex> lock( m_TimerQueueLock );
 	if ( !a_spTimer )
 		return false;
 
-	// Cannot use built in erase(key_value)... would remove all timers with same next signal time
-	for( TimerMultiSet::iterator iTimerStruct = m_TimerQueue.begin(); iTimerStruct != m_TimerQueue.end(); ++iTimerStruct )
-	{
-		if ( (iTimerStruct->m_pTimer).lock() == a_spTimer)
-		{
-			m_TimerQueue.erase( iTimerStruct );
-			return true;
-		}
-	}
-
-	return false;
+	return m_pTimerQueue->Remove( a_spTimer );
 }
 
 void TimerPool::StopAllTimers()
 {
-	boost::lock_guard<boost::mutex> lock(m_TimerQueueLock);
-	m_TimerQueue.clear();
+	tthread::lock_guard<tthread::mutex> lock(m_TimerQueueLock);
+	m_pTimerQueue->Clear();
 }
 
 void TimerPool::InsertTimer( ITimer::SP a_pTimer, bool a_bNewTimer )
@@ -79,12 +507,10 @@ void TimerPool::InsertTimer( ITimer::SP a_pTimer, bool a_bNewTimer )
 	if (a_bNewTimer)
 		m_TimerQueueLock.lock();
 
-	// Insert new timer struct
-	TimerMultiSet::iterator itInserted = m_TimerQueue.insert( TimerMultiSetStruct(a_pTimer) );
-	bool bNewFirstTimer = itInserted == m_TimerQueue.begin();
+	m_pTimerQueue->Insert( a_pTimer );
 
-	// new timer inserted, so wake our timer thread..
-	if ( bNewFirstTimer && a_bNewTimer )
+	// new timer is due before the timer thread wakes up, so wake our timer thread..
+	if ( a_bNewTimer && a_pTimer->GetDueTime() < m_WakeTime )
 		m_WakeTimer.notify_one();
 	if (a_bNewTimer)
 		m_TimerQueueLock.unlock();
@@ -98,77 +524,162 @@ void TimerPool::InvokeTimer(ITimer::WP a_wpTimer)
 		spTimer->Invoke();
 }
 
+//! Timers with slack that expired together and are invoked by the same pool
+struct TimerBatchEntry
+{
+	TimerBatchEntry( ThreadPool * a_pExecutor, bool a_bInvokeOnMain ) : 
+		m_pExecutor( a_pExecutor ), 
+		m_bInvokeOnMain( a_bInvokeOnMain ), 
+		m_spTimers( new std::vector<TimerPool::ITimer::WP>() )
+	{}
+
+	ThreadPool *	m_pExecutor;
+	bool			m_bInvokeOnMain;
+	boost::shared_ptr< std::vector<TimerPool::ITimer::WP> >
+					m_spTimers;
+};
+typedef std::vector<TimerBatchEntry>		BatchList;
+
+void TimerPool::InvokeBatch(TimerBatch a_spBatch)
+{
+	for( std::vector<ITimer::WP>::iterator iTimer = a_spBatch->begin(); iTimer != a_spBatch->end(); ++iTimer )
+		InvokeTimer( *iTimer );
+}
+
+void TimerPool::InvokeInline( const std::vector<ITimer::WP> & a_Timers )
+{
+	for( std::vector<ITimer::WP>::const_iterator iTimer = a_Timers.begin(); iTimer != a_Timers.end(); ++iTimer )
+	{
+		// a timer released by its owner since it was popped, maybe by one of the timers before it, is not invoked..
+		ITimer::SP spTimer = iTimer->lock();
+		if (! spTimer )
+			continue;
+
+		double startTime = Time::GetMonotonicTime();
+		try {
+			spTimer->Invoke();
+		}
+		catch( const WatsonException & ex )
+		{
+			Log::Error( "TimerPool", "Caught Exception: %s", ex.Message() );
+		}
+
+		double elapsed = Time::GetMonotonicTime() - startTime;
+		if ( elapsed > m_InlineBudget )
+		{
+			m_InlineOverruns += 1;
+			Log::Warning( "TimerPool", "Inline timer %s:%d took %.3f ms, the budget is %.3f ms.",
+				spTimer->GetFile(), spTimer->GetLine(), elapsed * 1000.0, m_InlineBudget * 1000.0 );
+		}
+	}
+}
+
 void TimerPool::TimerThread( void * arg )
 {
 	TimerPool * pPool = (TimerPool *)arg;
 
-	boost::unique_lock<boost::mutex> lock(pPool->m_TimerQueueLock);
+	boost::unique_lock<tthread::mutex> lock(pPool->m_TimerQueueLock);
 
-	TimerMultiSet & timers = pPool->m_TimerQueue;
+	ITimerQueue::TimerList expired;
+	std::vector<ITimer::WP> inlineTimers;
+	BatchList batches;
 	while(! pPool->m_bShutdown )
 	{
-		if ( timers.begin() != timers.end() )
+		double nextSignal = 0.0;
+		if (! pPool->m_pTimerQueue->GetNextSignal( nextSignal ) )
 		{
-			ITimer::SP spTimer = (timers.begin()->m_pTimer).lock();
-			if (!spTimer)
-			{
-				// timer object destroyed, just remove it from the list..
-				timers.erase(timers.begin());
-				continue;
-			}
+			pPool->m_WakeTime = Time::GetMonotonicTime() + 1.0;
+			pPool->m_WakeTimer.wait( pPool->m_TimerQueueLock, 1000 );
+			pPool->m_WakeTime = 0.0;
+			continue;
+		}
 
-			double sleepTime = spTimer->m_NextSignal.GetEpochTime() - Time().GetEpochTime();
-			if (sleepTime > 0.0)
-			{
-				spTimer.reset();		// release the shared_ptr while sleeping..
-				pPool->m_WakeTimer.timed_wait(lock, boost::posix_time::milliseconds( (int64_t)(sleepTime * 1000) ) );
+		// read the clock once per loop, it's used for the sleep and for popping the expired timers..
+		double now = Time::GetMonotonicTime();
+		double sleepTime = nextSignal - now;
+		if ( sleepTime > 0.0 && pPool->m_bHighResolution && sleepTime < HIGH_RES_SPIN_TIME )
+		{
+			// a sleep may overshoot by more than the time left, give up the CPU without sleeping instead..
+			pPool->m_WakeTime = nextSignal;
+			lock.unlock();
+			boost::this_thread::yield();
+			lock.lock();
+			pPool->m_WakeTime = 0.0;
+			continue;
+		}
+		if (sleepTime > 0.0)
+		{
+			// the remaining time is measured again after every wake up, so waking early only costs a loop. The wait
+			// is on the monotonic clock like the timers, a step of the system clock doesn't move it..
+			pPool->m_WakeTime = nextSignal;
+			pPool->m_WakeTimer.wait_us( pPool->m_TimerQueueLock, (boost::uint64_t)(sleepTime * 1000000) + 1 );
+			pPool->m_WakeTime = 0.0;
+			continue;
+		}
 
-				if (pPool->m_bShutdown)
-					break;
-				if (timers.begin() == timers.end())
-					continue;
+		pPool->m_pTimerQueue->PopExpired( now, expired );
+		if ( expired.size() > 0 )
+			pPool->m_Wakeups += 1;
 
-				spTimer = (timers.begin()->m_pTimer).lock();		// re-acquire the shared_ptr
-				if (!spTimer)
-					continue;
-			}
+		batches.clear();
+		for( ITimerQueue::TimerList::iterator iTimer = expired.begin(); iTimer != expired.end(); ++iTimer )
+		{
+			ITimer::SP & spTimer = *iTimer;
 
-			double now = Time().GetEpochTime();
-			while( true )
+			ThreadPool * pExecutor = spTimer->m_pExecutor != NULL ? spTimer->m_pExecutor : ThreadPool::Instance();
+			if ( spTimer->m_Inline )
 			{
-				if (timers.begin() == timers.end())
-					break;
-				spTimer = (timers.begin()->m_pTimer).lock();
-				if (!spTimer)
-				{
-					timers.erase(timers.begin());
-					continue;
-				}
-				if (now < spTimer->m_NextSignal.GetEpochTime())
-					break;				// not time yet, stop enumerating timers..
-
-				// remove and invoke the timer..
-				timers.erase(timers.begin());
-
+				inlineTimers.push_back( spTimer );
+			}
+			else if ( spTimer->m_Slack > 0.0 )
+			{
+				// timers with slack are invoked together, one task per pool and thread..
+				BatchList::iterator iBatch = batches.begin();
+				while( iBatch != batches.end() && (iBatch->m_pExecutor != pExecutor || iBatch->m_bInvokeOnMain != spTimer->m_InvokeOnMain) )
+					++iBatch;
+				if ( iBatch == batches.end() )
+					iBatch = batches.insert( batches.end(), TimerBatchEntry( pExecutor, spTimer->m_InvokeOnMain ) );
+				iBatch->m_spTimers->push_back( spTimer );
+			}
+			else
+			{
+				// timers are deadlines (timeouts, heartbeats), so they go into the high priority lane..
 				if (spTimer->m_InvokeOnMain)
-					ThreadPool::Instance()->InvokeOnMain<ITimer::WP>(DELEGATE(TimerPool, InvokeTimer, ITimer::WP, pPool ), spTimer);
+					pExecutor->InvokeOnMain<ITimer::WP>(DELEGATE(TimerPool, InvokeTimer, ITimer::WP, pPool ), spTimer, ThreadPool::PRIORITY_HIGH);
 				else
-					ThreadPool::Instance()->InvokeOnThread<ITimer::WP>(DELEGATE(TimerPool, InvokeTimer, ITimer::WP, pPool ), spTimer);
+					pExecutor->InvokeOnThread<ITimer::WP>(DELEGATE(TimerPool, InvokeTimer, ITimer::WP, pPool ), spTimer, ThreadPool::PRIORITY_HIGH);
+				pPool->m_Dispatches += 1;
+			}
 
-				if (spTimer->m_Recurring)
-				{
-					double fInterval = spTimer->m_Interval;
-					if ( fInterval < MIN_INTERVAL_TIME )
-						fInterval = MIN_INTERVAL_TIME;		
+			if (spTimer->m_Recurring)
+			{
+				double fMinInterval = pPool->m_bHighResolution ? HIGH_RES_MIN_INTERVAL : MIN_INTERVAL_TIME;
+				double fInterval = spTimer->m_Interval;
+				if ( fInterval < fMinInterval )
+					fInterval = fMinInterval;		
 
-					spTimer->m_NextSignal = spTimer->m_NextSignal.GetEpochTime() + fInterval;
-					pPool->InsertTimer(spTimer, false);
-				}
+				spTimer->m_NextSignal += fInterval;
+				pPool->InsertTimer(spTimer, false);
 			}
 		}
-		else
+		expired.clear();
+
+		for( BatchList::iterator iBatch = batches.begin(); iBatch != batches.end(); ++iBatch )
+		{
+			if ( iBatch->m_bInvokeOnMain )
+				iBatch->m_pExecutor->InvokeOnMain<TimerBatch>(DELEGATE(TimerPool, InvokeBatch, TimerBatch, pPool ), iBatch->m_spTimers, ThreadPool::PRIORITY_HIGH);
+			else
+				iBatch->m_pExecutor->InvokeOnThread<TimerBatch>(DELEGATE(TimerPool, InvokeBatch, TimerBatch, pPool ), iBatch->m_spTimers, ThreadPool::PRIORITY_HIGH);
+			pPool->m_Dispatches += 1;
+		}
+
+		if ( inlineTimers.size() > 0 )
 		{
-			pPool->m_WakeTimer.timed_wait( lock, boost::posix_time::milliseconds(1000));
+			// invoke with no lock, so the callback may start or stop timers..
+			lock.unlock();
+			pPool->InvokeInline( inlineTimers );
+			inlineTimers.clear();
+			lock.lock();
 		}
 	}
 
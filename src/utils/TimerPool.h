@@ -19,7 +19,7 @@
 #ifndef WDC_TIMERPOOL_H
 #define WDC_TIMERPOOL_H
 
-#include <set>
+#include <vector>
 
 #include "boost/enable_shared_from_this.hpp"
 #include "boost/shared_ptr.hpp"
@@ -30,6 +30,8 @@
 #include "UtilsLib.h"
 
 //! This class manages one or more timers, invoking functions using the provided ThreadPool object.
+//! Pending timers are kept either in an ordered set or in a hierarchical timing wheel, the wheel starts and
+//! stops timers in constant time which matters once there are many thousands of timers (e.g. request timeouts).
 class UTILS_API TimerPool
 {
 public:
@@ -37,6 +39,21 @@ public:
 	static TimerPool * Instance();
 
 	//! Types
+	enum QueueType
+	{
+		QUEUE_MULTISET,		// timers ordered by their next signal, O(log n) to start and O(n) to stop
+		QUEUE_WHEEL			// timing wheel with WHEEL_TICK resolution, O(1) to start and stop, expires a tick at a time
+	};
+
+	//! Resolution of the timing wheel in seconds
+	static const double WHEEL_TICK;
+	//! Resolution of the timing wheel in high resolution mode
+	static const double HIGH_RES_WHEEL_TICK;
+	//! Slack used for request and connection timeouts, which don't need to fire at an exact time
+	static const double TIMEOUT_SLACK;
+	//! Default time an inline timer may run before a warning is logged
+	static const double INLINE_BUDGET;
+
 	struct ITimer : public boost::enable_shared_from_this<ITimer>
 	{
 		//! Types
@@ -44,28 +61,82 @@ public:
 		typedef boost::weak_ptr<ITimer>			WP;
 
 		//! Construction
-		ITimer( double a_Interval, bool a_invokeOnMain, bool a_Recurring ) :
+		ITimer( double a_Interval, bool a_invokeOnMain, bool a_Recurring, ThreadPool * a_pExecutor = NULL, double a_Slack = 0.0 ) :
 			m_Interval( a_Interval ),
 			m_InvokeOnMain( a_invokeOnMain ),
 			m_Recurring( a_Recurring ),
-			m_NextSignal( Time().GetEpochTime() + a_Interval )
+			m_pExecutor( a_pExecutor ),
+			m_NextSignal( GetStartTime( a_Slack ) + a_Interval ),
+			m_Slack( a_Slack ),
+			m_Inline( false ),
+			m_pQueueEntry( NULL )
 		{}
 		virtual ~ITimer()
 		{}
 
 		virtual void Invoke() = 0;
+		//! Returns where the delegate was created, only known with ENABLE_DELEGATE_DEBUG.
+		virtual const char * GetFile() const = 0;
+		virtual int GetLine() const = 0;
+
+		//! Timers with slack start from the coarse clock, moved ahead by its resolution so they don't usually fire
+		//! early. The coarse clock can lag by more than a tick, so they may still fire a few milliseconds early.
+		static double GetStartTime( double a_Slack )
+		{
+			if ( a_Slack > 0.0 )
+				return Time::GetCoarseMonotonicTime() + Time::GetCoarseResolution();
+			return Time::GetMonotonicTime();
+		}
+
+		//! Returns when this timer will actually fire, m_NextSignal rounded up to the slack.
+		double GetDueTime() const
+		{
+			return AlignToSlack( m_NextSignal, m_Slack );
+		}
 
 		TimerPool *		m_pPool;
 		double			m_Interval;
 		bool			m_InvokeOnMain;
 		bool			m_Recurring;
-		Time			m_NextSignal;
+		ThreadPool *	m_pExecutor;		// pool that invokes this timer, NULL for the default pool
+		double			m_NextSignal;		// on the monotonic clock, see Time::GetMonotonicTime()
+		double			m_Slack;			// how much later than m_NextSignal this timer may fire
+		bool			m_Inline;			// invoked by the timer thread itself
+		void *			m_pQueueEntry;		// entry in the timing wheel while this timer is pending
 	};
 
-	//! Construction
-	TimerPool();
+	//! Construction, timers are scheduled on the monotonic clock so changes to the wall clock don't move them. 
+	//! In high resolution mode recurring timers may run faster than every 10 ms (down to 0.1 ms) and the timer 
+	//! thread yields instead of sleeping when a timer is less than a millisecond away, at the cost of some CPU.
+	TimerPool( QueueType a_QueueType = QUEUE_MULTISET, bool a_bHighResolution = false );
 	~TimerPool();
 
+	//! Accessors
+	QueueType GetQueueType() const
+	{
+		return m_QueueType;
+	}
+	bool IsHighResolution() const
+	{
+		return m_bHighResolution;
+	}
+	//! Returns the number of pending timers, this may include timers that have been destroyed but not yet removed.
+	size_t GetPendingTimers();
+	//! Returns the number of times the timer thread has woken up with timers to fire.
+	unsigned int GetWakeups() const
+	{
+		return m_Wakeups;
+	}
+	//! Returns the number of tasks queued to a ThreadPool to invoke timers.
+	unsigned int GetDispatches() const
+	{
+		return m_Dispatches;
+	}
+
+	//! Round a time up to the largest power of two fraction of a second (or whole seconds) that is no larger 
+	//! than the slack, so timers with similar slack line up on the same boundaries.
+	static double AlignToSlack( double a_Time, double a_Slack );
+
 	//! Invoke this function to queue the provided delegate to be invoked by one of the 
 	//! background threads from the thread pool.
 	//! a_Callback .. The function to invoke when the timer fires.
@@ -73,23 +144,65 @@ public:
 	//! a_Interval .. When to call the function, in seconds.
 	//! a_InvokeOnMain .. If false, then the function will be invoked on a background thread.
 	//! a_Recurring .. If true, the timer will keep invoking.
+	//! a_pExecutor .. The pool that invokes the function when a_InvokeOnMain is false, NULL for the default pool. 
+	//!		The pool must outlive the timer.
+	//! a_Slack .. How many seconds late the timer may fire. Timers with slack are rounded up to a common boundary 
+	//!		so timers due close together fire on the same wake up, and are queued to the pool as a single task.
 	template<typename ARG>
-	ITimer::SP StartTimer( Delegate<ARG> a_Callback, ARG a_Arg, double a_Interval, bool a_InvokeOnMain, bool a_Recurring )
+	ITimer::SP StartTimer( Delegate<ARG> a_Callback, ARG a_Arg, double a_Interval, bool a_InvokeOnMain, bool a_Recurring,
+		ThreadPool * a_pExecutor = NULL, double a_Slack = 0.0 )
 	{
-		ITimer::SP spNewTimer( new Timer<ARG>( a_Callback, a_Arg, a_Interval, a_InvokeOnMain, a_Recurring ) );
+		ITimer::SP spNewTimer( new Timer<ARG>( a_Callback, a_Arg, a_Interval, a_InvokeOnMain, a_Recurring, a_pExecutor, a_Slack ) );
 		InsertTimer( spNewTimer, true );
 
 		return spNewTimer;
 	}
 
-	ITimer::SP StartTimer( VoidDelegate a_Callback, double a_Interval, bool a_InvokeOnMain, bool a_Recurring )
+	ITimer::SP StartTimer( VoidDelegate a_Callback, double a_Interval, bool a_InvokeOnMain, bool a_Recurring,
+		ThreadPool * a_pExecutor = NULL, double a_Slack = 0.0 )
 	{
-		ITimer::SP spNewTimer( new VoidTimer( a_Callback, a_Interval, a_InvokeOnMain, a_Recurring ) );
+		ITimer::SP spNewTimer( new VoidTimer( a_Callback, a_Interval, a_InvokeOnMain, a_Recurring, a_pExecutor, a_Slack ) );
 		InsertTimer( spNewTimer, true );
 
 		return spNewTimer;
 	}
 
+	//! Start a timer that is invoked directly by the timer thread, this saves queuing a task for each fire but
+	//! every other timer waits while it runs. Only use this for trivial work (setting a flag, closing a socket),
+	//! a warning is logged when the callback takes longer than GetInlineBudget().
+	template<typename ARG>
+	ITimer::SP StartInlineTimer( Delegate<ARG> a_Callback, ARG a_Arg, double a_Interval, bool a_Recurring )
+	{
+		ITimer::SP spNewTimer( new Timer<ARG>( a_Callback, a_Arg, a_Interval, false, a_Recurring, NULL ) );
+		spNewTimer->m_Inline = true;
+		InsertTimer( spNewTimer, true );
+
+		return spNewTimer;
+	}
+
+	ITimer::SP StartInlineTimer( VoidDelegate a_Callback, double a_Interval, bool a_Recurring )
+	{
+		ITimer::SP spNewTimer( new VoidTimer( a_Callback, a_Interval, false, a_Recurring, NULL ) );
+		spNewTimer->m_Inline = true;
+		InsertTimer( spNewTimer, true );
+
+		return spNewTimer;
+	}
+
+	double GetInlineBudget() const
+	{
+		return m_InlineBudget;
+	}
+	void SetInlineBudget( double a_Budget )
+	{
+		m_InlineBudget = a_Budget;
+	}
+	//! Returns the number of times an inline timer ran longer than the budget.
+	unsigned int GetInlineOverruns() const
+	{
+		return m_InlineOverruns;
+	}
+
 	//! Stop the given timer.
 	bool StopTimer( ITimer::SP a_pTimer );
 	//! Stop all Timers
@@ -98,31 +211,16 @@ public:
 
 private:
 	//! Types
-	// Timer struct to enable the sorting of weak pointers within multiset
-	struct TimerMultiSetStruct
-	{
-		TimerMultiSetStruct( ITimer::SP a_pTimer )
-		{
-			m_NextSignalEpochTime = a_pTimer->m_NextSignal.GetEpochTime();
-			m_pTimer = a_pTimer;
-		}
-		ITimer::WP 		m_pTimer;
-		double 			m_NextSignalEpochTime;
-	};
-
-	struct TimerCompare {
-		bool operator() (const TimerMultiSetStruct & a_Timer1, const TimerMultiSetStruct & a_Timer2) const {
-			return a_Timer1.m_NextSignalEpochTime < a_Timer2.m_NextSignalEpochTime;
-		}
-	};
-
-	typedef std::multiset<TimerMultiSetStruct, TimerCompare, std::allocator<TimerMultiSetStruct> >				TimerMultiSet;
+	class ITimerQueue;
+	class MultiSetQueue;
+	class WheelQueue;
 
 	template<typename ARG>
 	struct Timer : public ITimer
 	{
-		Timer( Delegate<ARG> a_Delegate, ARG a_Arg, double a_Interval, bool a_invokeOnMain, bool a_Recurring ) :
-			ITimer( a_Interval, a_invokeOnMain, a_Recurring ), 
+		Timer( Delegate<ARG> a_Delegate, ARG a_Arg, double a_Interval, bool a_invokeOnMain, bool a_Recurring, ThreadPool * a_pExecutor,
+			double a_Slack = 0.0 ) :
+			ITimer( a_Interval, a_invokeOnMain, a_Recurring, a_pExecutor, a_Slack ), 
 			m_Delegate( a_Delegate ), 
 			m_Arg( a_Arg )
 		{}
@@ -132,6 +230,22 @@ private:
 			if (m_Delegate.IsValid())
 				m_Delegate(m_Arg);
 		}
+		virtual const char * GetFile() const
+		{
+#if ENABLE_DELEGATE_DEBUG
+			return m_Delegate.GetFile();
+#else
+			return "";
+#endif
+		}
+		virtual int GetLine() const
+		{
+#if ENABLE_DELEGATE_DEBUG
+			return m_Delegate.GetLine();
+#else
+			return 0;
+#endif
+		}
 
 		Delegate<ARG>	m_Delegate;
 		ARG				m_Arg;
@@ -139,8 +253,9 @@ private:
 
 	struct VoidTimer : public ITimer
 	{
-		VoidTimer( VoidDelegate a_Delegate, double a_Interval, bool a_invokeOnMain, bool a_Recurring ) :
-			ITimer(a_Interval, a_invokeOnMain, a_Recurring),
+		VoidTimer( VoidDelegate a_Delegate, double a_Interval, bool a_invokeOnMain, bool a_Recurring, ThreadPool * a_pExecutor,
+			double a_Slack = 0.0 ) :
+			ITimer(a_Interval, a_invokeOnMain, a_Recurring, a_pExecutor, a_Slack),
 			m_Delegate( a_Delegate )
 		{}
 
@@ -149,22 +264,52 @@ private:
 			if (m_Delegate.IsValid())
 				m_Delegate();
 		}
+		virtual const char * GetFile() const
+		{
+#if ENABLE_DELEGATE_DEBUG
+			return m_Delegate.GetFile();
+#else
+			return "";
+#endif
+		}
+		virtual int GetLine() const
+		{
+#if ENABLE_DELEGATE_DEBUG
+			return m_Delegate.GetLine();
+#else
+			return 0;
+#endif
+		}
 
 		VoidDelegate m_Delegate;
 	};
 
 	void InsertTimer( ITimer::SP a_pTimer, bool newTimer );
+	typedef boost::shared_ptr< std::vector<ITimer::WP> >	TimerBatch;
+
 	void InvokeTimer(ITimer::WP a_wpTimer);
+	void InvokeBatch(TimerBatch a_spBatch);
+	void InvokeInline( const std::vector<ITimer::WP> & a_Timers );
 
 	static void TimerThread( void * arg );
 
 	//! Data
 	volatile bool		m_bShutdown;
 	boost::thread *		m_pTimerThread;
-	boost::mutex		m_TimerQueueLock;
-	TimerMultiSet		m_TimerQueue;
-	boost::condition_variable
-						m_WakeTimer;
+	tthread::mutex		m_TimerQueueLock;
+	QueueType			m_QueueType;
+	bool				m_bHighResolution;
+	ITimerQueue *		m_pTimerQueue;
+	double				m_WakeTime;			// when the timer thread will wake up next, 0 if it's not waiting
+	volatile unsigned int
+						m_Wakeups;
+	volatile unsigned int
+						m_Dispatches;
+	double				m_InlineBudget;
+	volatile unsigned int
+						m_InlineOverruns;
+	tthread::condition_variable
+						m_WakeTimer;		// timed waits are on the monotonic clock
 	static TimerPool *	sm_pInstance;
 
 };
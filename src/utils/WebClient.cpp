@@ -20,13 +20,14 @@
 
 //! Define to 1 to enable lots of debugging output
 #define ENABLE_DEBUGGING			0
-#define ENABLE_KEEP_ALIVE			0
+#define ENABLE_KEEP_ALIVE			1
 //! How many times to re-call Send()
 #define MAX_ATTEMPTS				1
 
 #include "IWebClient.h"
 #include "WebSocketFramer.h"
 
+#include "boost/bind.hpp"
 #include "boost/thread/thread.hpp"
 #include "boost/algorithm/string.hpp"
 #include "boost/asio.hpp"		// not including SSL at this level on purpose
@@ -37,11 +38,14 @@
 #include "utf8_v2_3_4/source/utf8.h"
 
 #include "Log.h"
+#include "BinaryLog.h"
 #include "ThreadPool.h"
+#include "Time.h"
 #include "WatsonException.h"
 #include "WebClientService.h"
 
 #include <string>
+#include <vector>
 
 #if ENABLE_DELEGATE_DEBUG
 #define WARNING_DELEGATE_TIME (0.1)
@@ -64,14 +68,40 @@ RTTI_IMPL( IWebClient, IWebSocket );
 boost::atomic<unsigned int>		IWebClient::sm_RequestsSent;
 boost::atomic<unsigned int>		IWebClient::sm_BytesSent;
 boost::atomic<unsigned int>		IWebClient::sm_BytesRecv;
+boost::atomic<unsigned int>		IWebClient::sm_ConnectionsReused;
+boost::atomic<unsigned int>		IWebClient::sm_ConnectionsEvicted;
 std::string						IWebClient::sm_ClientId;
 
+static volatile size_t			s_MaxIdleConnections = 4;
+static volatile double			s_IdleTimeout = 30.0;
+static volatile double			s_ConnectDelay = 0.25;
+
+static std::string GetPoolId( const URL & a_URL )
+{
+	return a_URL.GetProtocol() + "." + a_URL.GetHost() + "." + StringUtil::Format( "%d", a_URL.GetPort() );
+}
+
+//! Closes connections taken out of the pool, this is done after the pool lock is released.
+static void CloseConnections( IWebClient::ConnectionList & a_Connections )
+{
+	for( IWebClient::ConnectionList::iterator iConnection = a_Connections.begin(); iConnection != a_Connections.end(); ++iConnection )
+		iConnection->m_spClient->Close();
+	IWebClient::sm_ConnectionsEvicted += (unsigned int)a_Connections.size();
+	a_Connections.clear();
+}
+
 IWebClient::ConnectionMap &	IWebClient::GetConnectionMap()
 {
 	static ConnectionMap * pMAP = new ConnectionMap();
 	return *pMAP;
 }
 
+boost::mutex & IWebClient::GetConnectionLock()
+{
+	static boost::mutex * pLOCK = new boost::mutex();
+	return *pLOCK;
+}
+
 Factory<IWebClient> & IWebClient::GetFactory()
 {
 	static Factory<IWebClient> FACTORY;
@@ -80,30 +110,44 @@ Factory<IWebClient> & IWebClient::GetFactory()
 
 IWebClient::SP IWebClient::Create( const URL & a_URL )
 {
-	std::string hashId( a_URL.GetProtocol() + "." + a_URL.GetHost() + "." + StringUtil::Format( "%d", a_URL.GetPort() ) );
-	ConnectionMap::iterator iConnections = GetConnectionMap().find( hashId );
-	while( iConnections != GetConnectionMap().end() )
+	SP spClient;
+	ConnectionList expired;
+
 	{
-		ConnectionList & connections = iConnections->second;
-		IWebClient::SP spConnection = connections.front();
-		connections.pop_front();
+		boost::lock_guard<boost::mutex> lock( GetConnectionLock() );
 
-		if ( connections.begin() == connections.end() )
+		ConnectionMap::iterator iConnections = GetConnectionMap().find( GetPoolId( a_URL ) );
+		if ( iConnections != GetConnectionMap().end() )
 		{
-			GetConnectionMap().erase( iConnections );
-			iConnections = GetConnectionMap().end();
-		}
+			// take the most recently used connection, it's the least likely to have been closed by the server..
+			double now = Time::GetCoarseMonotonicTime();
+			ConnectionList & connections = iConnections->second;
+			while(! spClient && connections.begin() != connections.end() )
+			{
+				IdleConnection & idle = connections.back();
+				if ( (now - idle.m_IdleTime) < s_IdleTimeout && idle.m_spClient->IsReusable() )
+					spClient = idle.m_spClient;
+				else
+					expired.push_back( idle );
+				connections.pop_back();
+			}
 
-		if ( spConnection->GetState() == IWebClient::CONNECTED )
-		{
-			spConnection->SetURL( a_URL );
-			return spConnection;
+			if ( connections.begin() == connections.end() )
+				GetConnectionMap().erase( iConnections );
 		}
 	}
+	CloseConnections( expired );
+
+	if ( spClient )
+	{
+		sm_ConnectionsReused++;
+		spClient->SetURL( a_URL );
+		return spClient;
+	}
 
 	bool bSecure = (_stricmp( a_URL.GetProtocol().c_str(), "https" ) == 0 || 
 		_stricmp( a_URL.GetProtocol().c_str(), "wss" ) == 0 );
-	SP spClient = SP( GetFactory().CreateObject( bSecure ? "SecureWebClient" : "WebClient" ) );
+	spClient = SP( GetFactory().CreateObject( bSecure ? "SecureWebClient" : "WebClient" ) );
 	if ( spClient )
 		spClient->SetURL( a_URL );
 
@@ -116,15 +160,112 @@ void IWebClient::Free( const SP & a_spClient )
 	{
 		a_spClient->ClearDelegates();
 
-		if ( a_spClient->GetState() == CONNECTED )
+		if ( s_MaxIdleConnections > 0 && a_spClient->IsReusable() )
 		{
-			const URL & url = a_spClient->GetURL();
-			std::string hashId( url.GetProtocol() + "." + url.GetHost() + "." + StringUtil::Format( "%d", url.GetPort() ) );
-			GetConnectionMap()[ hashId ].push_back( a_spClient );
+			ConnectionList expired;
+			{
+				boost::lock_guard<boost::mutex> lock( GetConnectionLock() );
+
+				ConnectionList & connections = GetConnectionMap()[ GetPoolId( a_spClient->GetURL() ) ];
+				connections.push_back( IdleConnection( a_spClient, Time::GetCoarseMonotonicTime() ) );
+				while( connections.size() > s_MaxIdleConnections )
+				{
+					expired.push_back( connections.front() );
+					connections.pop_front();
+				}
+			}
+			CloseConnections( expired );
 		}
 	}
 }
 
+void IWebClient::SetMaxIdleConnections( size_t a_Max )
+{
+	s_MaxIdleConnections = a_Max;
+	if ( a_Max == 0 )
+		ClearIdleConnections();
+}
+
+size_t IWebClient::GetMaxIdleConnections()
+{
+	return s_MaxIdleConnections;
+}
+
+void IWebClient::SetIdleTimeout( double a_Timeout )
+{
+	s_IdleTimeout = a_Timeout;
+}
+
+double IWebClient::GetIdleTimeout()
+{
+	return s_IdleTimeout;
+}
+
+void IWebClient::SetConnectDelay( double a_Delay )
+{
+	s_ConnectDelay = a_Delay;
+}
+
+double IWebClient::GetConnectDelay()
+{
+	return s_ConnectDelay;
+}
+
+size_t IWebClient::EvictIdleConnections()
+{
+	ConnectionList expired;
+	{
+		boost::lock_guard<boost::mutex> lock( GetConnectionLock() );
+
+		double now = Time::GetCoarseMonotonicTime();
+		ConnectionMap & connectionMap = GetConnectionMap();
+		for( ConnectionMap::iterator iConnections = connectionMap.begin(); iConnections != connectionMap.end(); )
+		{
+			// connections are returned to the back, so the oldest are at the front..
+			ConnectionList & connections = iConnections->second;
+			while( connections.begin() != connections.end() && (now - connections.front().m_IdleTime) >= s_IdleTimeout )
+			{
+				expired.push_back( connections.front() );
+				connections.pop_front();
+			}
+
+			if ( connections.begin() == connections.end() )
+				connectionMap.erase( iConnections++ );
+			else
+				++iConnections;
+		}
+	}
+
+	size_t evicted = expired.size();
+	CloseConnections( expired );
+	return evicted;
+}
+
+void IWebClient::ClearIdleConnections()
+{
+	ConnectionList expired;
+	{
+		boost::lock_guard<boost::mutex> lock( GetConnectionLock() );
+
+		ConnectionMap & connectionMap = GetConnectionMap();
+		for( ConnectionMap::iterator iConnections = connectionMap.begin(); iConnections != connectionMap.end(); ++iConnections )
+			expired.splice( expired.end(), iConnections->second );
+		connectionMap.clear();
+	}
+	CloseConnections( expired );
+}
+
+size_t IWebClient::GetIdleConnections()
+{
+	boost::lock_guard<boost::mutex> lock( GetConnectionLock() );
+
+	size_t count = 0;
+	ConnectionMap & connectionMap = GetConnectionMap();
+	for( ConnectionMap::iterator iConnections = connectionMap.begin(); iConnections != connectionMap.end(); ++iConnections )
+		count += iConnections->second.size();
+	return count;
+}
+
 //----------------------------------------------
 
 template<typename socket_type>
@@ -164,7 +305,13 @@ public:
 		m_SendCount( 0 ),
 		m_RequestsSent( 0 ),
 		m_RetryAttempts( 0 ),
-		m_pResponse( NULL )
+		m_pResponse( NULL ),
+		m_bKeepAlive( false ),
+		m_pService( NULL ),
+		m_Endpoint( 0 ),
+		m_Connecting( 0 ),
+		m_ConnectId( 0 ),
+		m_pConnectTimer( NULL )
 	{}
 
 	~WebClientT()
@@ -187,6 +334,29 @@ public:
 		return m_Headers;
 	}
 
+	virtual bool IsReusable()
+	{
+		if ( m_eState != CONNECTED || m_WebSocket || !m_bKeepAlive || m_pResponse != NULL || m_pSocket == NULL )
+			return false;
+
+		// nothing should be readable on an idle connection, so peek without blocking. Anything other than
+		// would_block means the server closed the connection or sent something we didn't ask for..
+		boost::asio::ip::tcp::socket & socket = static_cast<boost::asio::ip::tcp::socket &>( m_pSocket->lowest_layer() );
+		boost::system::error_code error;
+		bool bNonBlocking = socket.non_blocking();
+		socket.non_blocking( true, error );
+		if ( error )
+			return false;
+
+		char peek = 0;
+		socket.receive( boost::asio::buffer( &peek, sizeof(peek) ), boost::asio::socket_base::message_peek, error );
+		bool bReusable = error == boost::asio::error::would_block;
+
+		boost::system::error_code ignored;
+		socket.non_blocking( bNonBlocking, ignored );
+		return bReusable;
+	}
+
 	virtual void SetURL(const URL & a_URL)
 	{
 		m_URL = a_URL;
@@ -254,13 +424,15 @@ public:
 			m_RequestsSent = 0;			// reset each time we re-connect
 
 			Cleanup();
+			// every handler of this connection runs on the io_service it's assigned..
+			m_pService = &pService->AssignService( m_URL.GetHost() );
 			CreateSocket();
 			SetState(CONNECTING);
 
 			//Log::DebugMed("WebClientT", "Connecting to %s:%u", m_URL.GetHost().c_str(), m_URL.GetPort());
 
 			m_eInternalState = RESOLVING_DNS;
-			WebClientService::Instance()->GetService().post( 
+			m_pService->post( 
 				boost::bind( &WebClientT::BeginConnect, shared_from_this() ) );
 		}
 		else
@@ -288,8 +460,15 @@ public:
 		m_eInternalState = INVALID_INTERNAL;
 		m_RetryAttempts = 0;
 
-		Log::DebugLow( "WebClientT", "Closing socket. (%p)", this );
-		m_pSocket->lowest_layer().close();
+		BLOG_DEBUG_LOW( "WebClientT", "Closing socket. (%p)", this );
+		{
+			// close any other sockets still racing to connect as well..
+			boost::lock_guard<boost::mutex> lock( m_ConnectLock );
+			for( typename SocketList::iterator iSocket = m_Attempts.begin(); iSocket != m_Attempts.end(); ++iSocket )
+				if ( *iSocket != m_pSocket )
+					(*iSocket)->lowest_layer().close();
+			m_pSocket->lowest_layer().close();
+		}
 
 		return true;
 	}
@@ -379,42 +558,109 @@ protected:
 			m_StateReceiver( this );
 	}
 
-	virtual void CreateSocket() = 0;
+	//! Makes a new unconnected socket.
+	virtual socket_type * NewSocket() = 0;
+
+	void CreateSocket()
+	{
+		m_pSocket = NewSocket();
+	}
 
 	void BeginConnect()
 	{
 		WebClientService * pService = WebClientService::Instance();
 		assert( pService != NULL );
 
-		// resolve DNS first before we bother making the socket/stream objects..
-		boost::asio::ip::tcp::resolver::iterator i = boost::asio::ip::tcp::resolver::iterator();
-		try {
-			if ( pService != NULL )
-			{
-				boost::asio::ip::tcp::resolver resolver(pService->GetService());
-				boost::asio::ip::tcp::resolver::query q(m_URL.GetHost(), StringUtil::Format("%u", m_URL.GetPort()));
-				i = resolver.resolve(q);
-			}
-		}
-		catch (const std::exception & ex)
+		// resolve DNS first before we bother making the socket/stream objects. Lookups complete on the
+		// DNS cache's io_service, wrap() brings the result back to ours..
+		if ( pService != NULL )
 		{
-			Log::Error("WebClientT", "Caught exception: %s, URL: %s", ex.what(), m_URL.GetURL().c_str() );
-			i = boost::asio::ip::tcp::resolver::iterator();
+			pService->GetDnsCache().Resolve( m_URL.GetHost(), m_URL.GetPort(),
+				m_pService->wrap( boost::bind( &WebClientT::OnResolved, shared_from_this(), _1, _2 ) ) );
 		}
+		else
+			ThreadPool::Instance()->InvokeOnMain( VOID_DELEGATE( WebClientT, OnDisconnected, shared_from_this() ) );
+	}
 
-		if (i == boost::asio::ip::tcp::resolver::iterator())
+	void OnResolved( const boost::system::error_code & error, DnsCache::EndpointsSP a_spEndpoints )
+	{
+		bool bFailed = false;
+		if ( m_eInternalState != RESOLVING_DNS )
 		{
-			Log::DebugLow("WebClientT", "Failed to resolve %s", m_URL.GetHost().c_str());
-			ThreadPool::Instance()->InvokeOnMain( VOID_DELEGATE( WebClientT, OnDisconnected, shared_from_this() ) );
+			// Close() was called while we were waiting on DNS..
+			bFailed = true;
+		}
+		else if ( error )
+		{
+			BLOG_DEBUG_LOW("WebClientT", "Failed to resolve %s: %s", m_URL.GetHost().c_str(), error.message().c_str() );
+			bFailed = true;
 		}
 		else
 		{
+			boost::lock_guard<boost::mutex> lock( m_ConnectLock );
+
 			m_eInternalState = ASYNC_CONNECT;
-			Log::DebugLow( "WebClientT", "Connecting to %s:%s", (*i).host_name().c_str(), (*i).service_name().c_str() );
-			m_pSocket->lowest_layer().close();
-			m_pSocket->lowest_layer().async_connect(*i,
-				boost::bind(&WebClientT::HandleConnect, shared_from_this(), boost::asio::placeholders::error, i));
+			m_spEndpoints = a_spEndpoints;
+			m_Endpoint = 0;
+			m_Connecting = 0;
+			m_ConnectId++;
+			if ( m_pConnectTimer == NULL )
+				m_pConnectTimer = new boost::asio::deadline_timer( *m_pService );
+
+			bFailed = !StartAttempt();
+		}
+
+		if ( bFailed )
+			ThreadPool::Instance()->InvokeOnMain( VOID_DELEGATE( WebClientT, OnDisconnected, shared_from_this() ) );
+	}
+
+	//! Starts connecting to the next endpoint from DNS, the first attempt uses m_pSocket and the others are 
+	//! made with a new socket. If it hasn't connected or failed after the connect delay, another attempt is 
+	//! started, so one endpoint that doesn't answer doesn't hold up the rest. Called with m_ConnectLock held, 
+	//! returns false if there are no endpoints left to try.
+	bool StartAttempt()
+	{
+		while( m_Endpoint < m_spEndpoints->size() )
+		{
+			size_t index = m_Endpoint++;
+			const DnsCache::Endpoint & endpoint = (*m_spEndpoints)[ index ];
+
+			socket_type * pSocket = NULL;
+			try {
+				pSocket = m_Attempts.size() == 0 ? m_pSocket : NewSocket();
+
+				BLOG_DEBUG_LOW( "WebClientT", "Connecting to %s:%u", endpoint.address().to_string().c_str(), (unsigned int)endpoint.port() );
+				pSocket->lowest_layer().close();
+				pSocket->lowest_layer().async_connect( endpoint,
+					boost::bind(&WebClientT::HandleConnect, shared_from_this(), boost::asio::placeholders::error, 
+					m_ConnectId, m_Attempts.size(), index) );
+				m_Attempts.push_back( pSocket );
+				m_Connecting++;
+
+				if ( m_Endpoint < m_spEndpoints->size() )
+				{
+					m_pConnectTimer->expires_from_now( boost::posix_time::microseconds( (boost::int64_t)(s_ConnectDelay * 1000000.0) ) );
+					m_pConnectTimer->async_wait( boost::bind( &WebClientT::OnConnectDelay, shared_from_this(), 
+						boost::asio::placeholders::error, m_ConnectId ) );
+				}
+				return true;
+			}
+			catch( const std::exception & ex )
+			{
+				BLOG_DEBUG_LOW("WebClientT", "Caught exception: %s", ex.what());
+				if ( pSocket != m_pSocket )
+					delete pSocket;
+			}
 		}
+
+		return m_Connecting > 0;
+	}
+
+	void OnConnectDelay( const boost::system::error_code & error, int a_ConnectId )
+	{
+		boost::lock_guard<boost::mutex> lock( m_ConnectLock );
+		if (! error && a_ConnectId == m_ConnectId && m_eInternalState == ASYNC_CONNECT )
+			StartAttempt();
 	}
 
 	//! This is used by SecureWebClient to start the hand-shake
@@ -423,10 +669,42 @@ protected:
 		return false;
 	}
 
-	void HandleConnect(const boost::system::error_code & error,
-		boost::asio::ip::tcp::resolver::iterator i)
+	void HandleConnect(const boost::system::error_code & error, int a_ConnectId, size_t a_Attempt, size_t a_Endpoint)
 	{
-		if (! error )
+		bool bConnected = false;
+		bool bFailed = false;
+		{
+			boost::lock_guard<boost::mutex> lock( m_ConnectLock );
+			if ( a_ConnectId != m_ConnectId || a_Attempt >= m_Attempts.size() )
+				return;		// another attempt already connected
+			m_Connecting--;
+
+			socket_type * pSocket = m_Attempts[ a_Attempt ];
+			const DnsCache::Endpoint & endpoint = (*m_spEndpoints)[ a_Endpoint ];
+			if (! error && m_eInternalState == ASYNC_CONNECT )
+			{
+				// the first to connect wins, close the rest. Their handlers see a new connect id and return..
+				BLOG_DEBUG_LOW( "WebClientT", "Connected to %s:%u", endpoint.address().to_string().c_str(), (unsigned int)endpoint.port() );
+				for( typename SocketList::iterator iSocket = m_Attempts.begin(); iSocket != m_Attempts.end(); ++iSocket )
+					if ( *iSocket != pSocket )
+						delete *iSocket;
+				m_Attempts.clear();
+				m_pSocket = pSocket;
+				m_ConnectId++;
+				m_pConnectTimer->cancel();
+				bConnected = true;
+			}
+			else
+			{
+				BLOG_DEBUG_LOW( "WebClientT", "Failed to connect to %s:%u: %s", 
+					endpoint.address().to_string().c_str(), (unsigned int)endpoint.port(), error.message().c_str() );
+				// try the next end-point in DNS right away instead of waiting for the delay..
+				if ( m_eInternalState != ASYNC_CONNECT || !StartAttempt() )
+					bFailed = m_Connecting == 0;
+			}
+		}
+
+		if ( bConnected )
 		{
 			if (! StartHandshake() )
 			{
@@ -438,7 +716,7 @@ protected:
 			try {
 				// this helps recognizing disconnected sockets..
 				boost::asio::socket_base::keep_alive option(true);
-				m_pSocket->set_option(option);
+				m_pSocket->lowest_layer().set_option(option);
 			}
 			catch( const std::exception & ex )
 			{
@@ -446,38 +724,19 @@ protected:
 			}
 	#endif
 		}
-		else 
+		else if ( bFailed )
 		{
-			Log::DebugLow( "WebClientT", "Failed to connect to %s:%s", (*i).host_name().c_str(), (*i).service_name().c_str() );
-			if ( ++i != boost::asio::ip::tcp::resolver::iterator() )
-			{
-				// try the next end-point in DNS..
-				try {
-					m_pSocket->lowest_layer().close();
-					Log::DebugLow( "WebClientT", "Connecting to %s:%s", (*i).host_name().c_str(), (*i).service_name().c_str() );
-					m_pSocket->lowest_layer().async_connect( *i,
-						boost::bind(&WebClientT::HandleConnect, shared_from_this(), boost::asio::placeholders::error, i));
-				}
-				catch( const std::exception & ex )
-				{
-					Log::DebugLow("WebClientT", "Caught exception: %s", ex.what());
-					ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this() ));
-				}
-			}
-			else
-			{
-				// set our state to disconnected..
-				Log::DebugLow("WebClientT", "Failed to connect to %s:%d: %s", 
-					m_URL.GetHost().c_str(), m_URL.GetPort(), error.message().c_str() );
-				ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this() ));
-			}
+			// set our state to disconnected..
+			BLOG_DEBUG_LOW("WebClientT", "Failed to connect to %s:%d: %s", 
+				m_URL.GetHost().c_str(), m_URL.GetPort(), error.message().c_str() );
+			ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this() ));
 		}
 	}
 
 	//! Invoked on main thread.
 	void OnConnected()
 	{
-		Log::DebugLow( "WebClientT", "OnConnected, URL: %s", m_URL.GetURL().c_str() );
+		BLOG_DEBUG_LOW( "WebClientT", "OnConnected, URL: %s", m_URL.GetURL().c_str() );
 		if ( m_eState == CONNECTING )
 		{
 			SetState( CONNECTED );
@@ -485,7 +744,7 @@ protected:
 		}
 		else
 		{
-			Log::Debug( "WebClientT", "State is not CONNECTING, URL: %s", m_URL.GetURL().c_str());
+			BLOG_DEBUG( "WebClientT", "State is not CONNECTING, URL: %s", m_URL.GetURL().c_str());
 			if ( m_eState == CLOSING )
 				ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnClose, shared_from_this()));
 			else
@@ -504,6 +763,7 @@ protected:
 		m_eInternalState = SENDING_REQUEST;
 		m_LastRequest = m_Request;
 		m_ContentLen = 0;
+		m_bKeepAlive = !m_WebSocket;
 
 		std::string & req = m_Request;
 		if ( !m_WebSocket )
@@ -585,7 +845,7 @@ protected:
 			delete m_pResponse;
 			m_pResponse = NULL;
 
-			Log::DebugLow( "WebClientT", "Error on RequestSent(): %s, URL: %s", error.message().c_str(), m_URL.GetURL().c_str() );
+			BLOG_DEBUG_LOW( "WebClientT", "Error on RequestSent(): %s, URL: %s", error.message().c_str(), m_URL.GetURL().c_str() );
 			ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this()));
 		}
 	}
@@ -632,7 +892,7 @@ protected:
 					// send all pending packets now..
 					if ( m_Pending.begin() != m_Pending.end() )
 					{
-						Log::Debug( "WebClientT", "Sending %u pending frames.", m_Pending.size() );
+						BLOG_DEBUG( "WebClientT", "Sending %u pending frames.", m_Pending.size() );
 						for (BufferList::iterator iSend = m_Pending.begin(); iSend != m_Pending.end(); ++iSend)
 							WS_QueueSend(*iSend);
 						m_Pending.clear();
@@ -643,7 +903,7 @@ protected:
 				}
 				else
 				{
-					Log::DebugLow( "WebClientT", "Websocket failed to connect, status code %u: %s", 
+					BLOG_DEBUG_LOW( "WebClientT", "Websocket failed to connect, status code %u: %s", 
 						m_pResponse->m_StatusCode, m_pResponse->m_StatusMessage.c_str() );
 					m_SendError = true;
 					if ( m_SendCount == 0 )
@@ -689,7 +949,7 @@ protected:
 		}
 		else 
 		{
-			Log::DebugLow( "WebClientT", "HTTP_ReadHeaders: %s, URL: %s", error.message().c_str(), m_URL.GetURL().c_str() );
+			BLOG_DEBUG_LOW( "WebClientT", "HTTP_ReadHeaders: %s, URL: %s", error.message().c_str(), m_URL.GetURL().c_str() );
 			ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this()));
 
 			delete m_pResponse;
@@ -790,7 +1050,7 @@ protected:
 		}
 		else
 		{
-			Log::DebugLow( "WebClientT", "HTTP_OnChunkLength: %s", error.message().c_str() );
+			BLOG_DEBUG_LOW( "WebClientT", "HTTP_OnChunkLength: %s", error.message().c_str() );
 			ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this()));
 
 			delete m_pResponse;
@@ -856,7 +1116,7 @@ protected:
 		}
 		else
 		{
-			Log::DebugLow( "WebClientT", "Error on HTTP_ReadContent(): %s, URL: %s", error.message().c_str(), m_URL.GetURL().c_str() );
+			BLOG_DEBUG_LOW( "WebClientT", "Error on HTTP_ReadContent(): %s, URL: %s", error.message().c_str(), m_URL.GetURL().c_str() );
 			ThreadPool::Instance()->InvokeOnMain(VOID_DELEGATE(WebClientT, OnDisconnected, shared_from_this()));
 			delete m_pResponse;
 			m_pResponse = NULL;
@@ -889,7 +1149,7 @@ protected:
 
 				bool bClose = pFrame->m_Op == CLOSE;
 				if ( bClose )
-					Log::DebugLow( "WebClientT", "Received close op: %s (%p)", pFrame->m_Data.c_str(), this );
+					BLOG_DEBUG_LOW( "WebClientT", "Received close op: %s (%p)", pFrame->m_Data.c_str(), this );
 
 				ThreadPool::Instance()->InvokeOnMain<IWebSocket::Frame *>(
 					DELEGATE( WebClientT, OnWebSocketFrame, IWebSocket::Frame *, shared_from_this() ), pFrame );
@@ -916,7 +1176,7 @@ protected:
 				}
 				else
 				{
-					Log::DebugLow("WebClientT", "Error on WS_Read(): %s (%p), URL: %s", error.message().c_str(), this, m_URL.GetURL().c_str() );
+					BLOG_DEBUG_LOW("WebClientT", "Error on WS_Read(): %s (%p), URL: %s", error.message().c_str(), this, m_URL.GetURL().c_str() );
 
 					m_SendError = true;
 					if ( m_SendCount == 0 && ThreadPool::Instance() != NULL )
@@ -963,7 +1223,7 @@ protected:
 		{
 			// we ignore any sends once m_SendError is true, this lets the m_SendCount get down
 			// to 0 so we can notify the main thread we are disconnected.
-			Log::Debug("WebClientT", "Ignoring send because of error state.");
+			BLOG_DEBUG("WebClientT", "Ignoring send because of error state.");
 		}
 	}
 
@@ -978,7 +1238,7 @@ protected:
 			m_Send.pop_front();
 
 	#if ENABLE_DEBUGGING
-			Log::Debug("WebClientT", "Sending %u bytes (%p).", pFrame->size(), pFrame);
+			BLOG_DEBUG("WebClientT", "Sending %u bytes (%p).", pFrame->size(), pFrame);
 	#endif
 
 			boost::asio::async_write(*m_pSocket,
@@ -1018,7 +1278,7 @@ protected:
 		else
 		{
 	#if ENABLE_DEBUGGING
-			Log::Debug( "WebClientT", "WS_Sent %u bytes (%p) (%u pending)", bytes_transferred, pBuffer, m_SendCount );
+			BLOG_DEBUG( "WebClientT", "WS_Sent %u bytes (%p) (%u pending)", bytes_transferred, pBuffer, m_SendCount );
 	#endif
 			// send the next block, this will do nothing if nothing is queued..
 			if ( m_SendCount == 0 )
@@ -1030,10 +1290,20 @@ protected:
 
 	void OnResponse(RequestData * a_pData)
 	{
-		bool bClose = false;
+		// HTTP/1.1 connections stay open unless the server says otherwise, HTTP/1.0 only if it asks for keep-alive..
+		bool bClose = a_pData->m_Version == "HTTP/1.0";
 		Headers::iterator iConnection = a_pData->m_Headers.find( "Connection" );
 		if ( iConnection != a_pData->m_Headers.end() )
-			bClose = _stricmp( iConnection->second.c_str(), "close") == 0;
+			bClose = _stricmp( iConnection->second.c_str(), "close") == 0 
+				|| (bClose && _stricmp( iConnection->second.c_str(), "keep-alive" ) != 0);
+		// without a length the content ends when the server closes the connection..
+		if (! m_bChunked && a_pData->m_Headers.find( "Content-Length" ) == a_pData->m_Headers.end() 
+			&& a_pData->m_StatusCode != 204 && a_pData->m_StatusCode != 304 )
+			bClose = true;
+
+		// this must be set before the receiver is invoked, since it may return this client to the pool..
+		if ( a_pData->m_bDone )
+			m_bKeepAlive = !bClose;
 
 	#if defined(WARNING_DELEGATE_TIME) && defined(ERROR_DELEGATE_TIME)
 		double startTime = Time().GetEpochTime();
@@ -1075,14 +1345,14 @@ protected:
 			m_eState == CONNECTING || 
 			m_eState == CLOSING )
 		{
-			Log::DebugLow( "WebClientT", "OnClose() closing socket. (%p), URL: %s", this, m_URL.GetURL().c_str() );
+			BLOG_DEBUG_LOW( "WebClientT", "OnClose() closing socket. (%p), URL: %s", this, m_URL.GetURL().c_str() );
 			SetState( CLOSED );
 		}
 	}
 
 	void OnDisconnected()
 	{
-		Log::DebugLow( "WebClientT", "OnDisconnected");
+		BLOG_DEBUG_LOW( "WebClientT", "OnDisconnected");
 		if ( m_eState == CONNECTED || 
 			m_eState == CONNECTING || 
 			m_eState == CLOSING )
@@ -1096,7 +1366,7 @@ protected:
 			{
 				if ( m_RetryAttempts++ < MAX_ATTEMPTS )
 				{
-					Log::DebugMed( "WebClientT", "Resending (Sent: %d, Retry %d of %d), URL: %s", 
+					BLOG_DEBUG_MED( "WebClientT", "Resending (Sent: %d, Retry %d of %d), URL: %s", 
 						m_RequestsSent, m_RetryAttempts, MAX_ATTEMPTS, m_URL.GetURL().c_str() );
 
 					SetState( RETRY );
@@ -1105,7 +1375,7 @@ protected:
 				}
 				else
 				{
-					Log::Error( "WebClientT", "Failed send, URL: %s", m_URL.GetURL().c_str() );
+					LOG_LIMITED( LL_ERROR, "WebClientT", "Failed send, URL: %s", m_URL.GetURL().c_str() );
 					SetState(DISCONNECTED);
 				}
 			}
@@ -1116,6 +1386,20 @@ protected:
 
 	virtual void Cleanup()
 	{
+		{
+			boost::lock_guard<boost::mutex> lock( m_ConnectLock );
+			for( typename SocketList::iterator iSocket = m_Attempts.begin(); iSocket != m_Attempts.end(); ++iSocket )
+				if ( *iSocket != m_pSocket )
+					delete *iSocket;
+			m_Attempts.clear();
+			m_ConnectId++;
+
+			if ( m_pConnectTimer != NULL )
+			{
+				delete m_pConnectTimer;
+				m_pConnectTimer = NULL;
+			}
+		}
 		if ( m_pSocket != NULL )
 		{
 			delete m_pSocket;
@@ -1130,6 +1414,7 @@ protected:
 protected:
 	//! Types
 	typedef std::list<std::string *>		BufferList;
+	typedef std::vector<socket_type *>		SocketList;
 
 	//! Data
 	SocketState		m_eState;				// state of connection
@@ -1165,6 +1450,18 @@ protected:
 	size_t			m_ContentLen;			// length of the content from the response
 	int				m_RequestsSent;			// number of requests sent on this connection so far
 	int				m_RetryAttempts;		// number of retries
+	bool			m_bKeepAlive;			// false if the server will close the connection after the response
+	boost::asio::io_service *
+					m_pService;				// io_service this connection is assigned to
+	DnsCache::EndpointsSP
+					m_spEndpoints;			// endpoints of m_URL from DNS
+	size_t			m_Endpoint;				// index of the next endpoint to try
+	SocketList		m_Attempts;				// sockets racing to connect, the first is m_pSocket
+	size_t			m_Connecting;			// number of attempts still connecting
+	int				m_ConnectId;			// changed when a race is over, so late handlers are ignored
+	boost::asio::deadline_timer *
+					m_pConnectTimer;		// starts the next attempt after the connect delay
+	boost::mutex	m_ConnectLock;
 
 	volatile bool	m_SendError;			// set to true when a send fails
 	boost::atomic<size_t>
@@ -1181,12 +1478,9 @@ public:
 	RTTI_DECL();
 
 	//! WebClientT interface
-	virtual void CreateSocket()
+	virtual boost::asio::ip::tcp::socket * NewSocket()
 	{
-		WebClientService * pService = WebClientService::Instance();
-		assert( pService != NULL );
-
-		m_pSocket = new boost::asio::ip::tcp::socket( pService->GetService() );
+		return new boost::asio::ip::tcp::socket( *m_pService );
 	}
 };
 
@@ -1212,15 +1506,18 @@ public:
 	{}
 
 	//! WebClientT interface
-	virtual void CreateSocket()
+	virtual SocketType * NewSocket()
 	{
 		WebClientService * pService = WebClientService::Instance();
 		assert( pService != NULL );
 
-		// make the socket..
-		m_pSSL = new boost::asio::ssl::context( pService->GetService(), boost::asio::ssl::context::sslv23 );
-		m_pSSL->set_verify_mode(boost::asio::ssl::context::verify_none);
-		m_pSocket = new boost::asio::ssl::stream<boost::asio::ip::tcp::socket>( pService->GetService(), *m_pSSL );
+		// make the socket, the sockets racing to connect share one context..
+		if ( m_pSSL == NULL )
+		{
+			m_pSSL = new boost::asio::ssl::context( pService->GetService(), boost::asio::ssl::context::sslv23 );
+			m_pSSL->set_verify_mode(boost::asio::ssl::context::verify_none);
+		}
+		return new boost::asio::ssl::stream<boost::asio::ip::tcp::socket>( *m_pService, *m_pSSL );
 	}
 	virtual bool StartHandshake()
 	{
@@ -1247,7 +1544,7 @@ protected:
 		}
 		else
 		{
-			Log::DebugLow( "WebClientT", "Handshake Failed with %s %s", 
+			BLOG_DEBUG_LOW( "WebClientT", "Handshake Failed with %s %s", 
 				m_URL.GetURL().c_str(), error.message().c_str() );
 			ThreadPool::Instance()->InvokeOnMain( VOID_DELEGATE( WebClientT<SocketType>, OnDisconnected, shared_from_this() ) );
 		}
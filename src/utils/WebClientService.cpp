@@ -19,9 +19,20 @@
 #include "WebClientService.h"
 #include "Log.h"
 #include "IWebClient.h"
+#include "StringHash.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 WebClientService * WebClientService::sm_pInstance = NULL;
 int WebClientService::sm_ThreadCount = 1;					// how many threads to start for the WebClient
+int WebClientService::sm_ServiceCount = 1;					// how many io_services to run, 0 for one per core
+WebClientService::AssignMode WebClientService::sm_AssignMode = WebClientService::ASSIGN_ROUND_ROBIN;
+double WebClientService::sm_EvictInterval = 5.0;			// how often idle connections are checked for eviction
 
 //! This internal singleton class runs the io service for all Socket objects.
 WebClientService * WebClientService::Instance()
@@ -42,12 +53,38 @@ WebClientService * WebClientService::Instance()
 }
 
 WebClientService::WebClientService() :
-	m_Work(m_Service)										// this prevents the IO service from stopping on it's own
+	m_Work(m_Service),										// this prevents the IO service from stopping on it's own
+	m_DnsCache(m_Service),
+	m_NextService(0)
 {
-	for(int i=0;i<sm_ThreadCount;++i)
-		m_Threads.push_back(ThreadSP( new Thread(boost::bind(&boost::asio::io_service::run, &m_Service) ) ) );
+	int cores = boost::thread::hardware_concurrency();
+	if ( cores < 1 )
+		cores = 1;
+	int services = sm_ServiceCount > 0 ? sm_ServiceCount : cores;
+
+	m_Services.push_back( &m_Service );
+	if ( services > 1 )
+	{
+		for(int i=1;i<services;++i)
+		{
+			m_ExtraServices.push_back( ServiceSP( new boost::asio::io_service() ) );
+			m_ExtraWork.push_back( WorkSP( new Work( *m_ExtraServices.back() ) ) );
+			m_Services.push_back( m_ExtraServices.back().get() );
+		}
+		for(size_t i=0;i<m_Services.size();++i)
+			m_Threads.push_back(ThreadSP( new Thread(boost::bind(&WebClientService::RunService, m_Services[i], (int)(i % cores)) ) ) );
+	}
+	else
+	{
+		for(int i=0;i<sm_ThreadCount;++i)
+			m_Threads.push_back(ThreadSP( new Thread(boost::bind(&boost::asio::io_service::run, &m_Service) ) ) );
+	}
 	if (TimerPool::Instance() != NULL)
+	{
 		m_spStatsTimer = TimerPool::Instance()->StartTimer(VOID_DELEGATE(WebClientService, OnDumpStats, this), 60.0, true, true);
+		m_spEvictTimer = TimerPool::Instance()->StartTimer(VOID_DELEGATE(WebClientService, OnEvictConnections, this), 
+			sm_EvictInterval, true, true, NULL, TimerPool::TIMEOUT_SLACK);
+	}
 }
 
 WebClientService::~WebClientService()
@@ -55,18 +92,63 @@ WebClientService::~WebClientService()
 	if (sm_pInstance == this)
 		sm_pInstance = NULL;
 	m_spStatsTimer.reset();
+	m_spEvictTimer.reset();
 
-	m_Service.stop();
+	// the pooled connections use our io_service, so close them before it goes away..
+	IWebClient::ClearIdleConnections();
+
+	for (size_t i = 0; i < m_Services.size(); ++i)
+		m_Services[i]->stop();
 	for (ThreadList::iterator iThread = m_Threads.begin(); iThread != m_Threads.end(); ++iThread)
 		(*iThread)->join();
 	m_Threads.clear();
 }
 
+boost::asio::io_service & WebClientService::AssignService( const std::string & a_Host )
+{
+	if ( m_Services.size() == 1 )
+		return m_Service;
+
+	size_t index = 0;
+	if ( sm_AssignMode == ASSIGN_HOST_HASH )
+		index = StringHash::DJB( a_Host.c_str() ) % m_Services.size();
+	else
+		index = m_NextService++ % m_Services.size();
+
+	return *m_Services[ index ];
+}
+
+void WebClientService::RunService( boost::asio::io_service * a_pService, int a_Core )
+{
+	// keep this thread on one core, so the connections assigned to it stay in that core's cache..
+#ifdef _WIN32
+	SetThreadAffinityMask( GetCurrentThread(), ((DWORD_PTR)1) << a_Core );
+#elif defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO( &cpus );
+	CPU_SET( a_Core, &cpus );
+	if ( pthread_setaffinity_np( pthread_self(), sizeof(cpus), &cpus ) != 0 )
+		Log::Warning( "WebClientService", "Failed to pin thread to core %d", a_Core );
+#endif
+	a_pService->run();
+}
+
 void WebClientService::OnDumpStats()
 {
-	Log::Status("WebClient", "STAT: Requests: %u, Bytes Sent: %u, Bytes Recv: %u",
+	Log::Status("WebClient", "STAT: Requests: %u, Bytes Sent: %u, Bytes Recv: %u, Reused: %u, Evicted: %u, Idle: %u, DNS Hits: %u, DNS Misses: %u",
 		IWebClient::sm_RequestsSent.load(),
 		IWebClient::sm_BytesSent.load(),
-		IWebClient::sm_BytesRecv.load());
+		IWebClient::sm_BytesRecv.load(),
+		IWebClient::sm_ConnectionsReused.load(),
+		IWebClient::sm_ConnectionsEvicted.load(),
+		(unsigned int)IWebClient::GetIdleConnections(),
+		m_DnsCache.GetHits(),
+		m_DnsCache.GetMisses());
+}
+
+void WebClientService::OnEvictConnections()
+{
+	IWebClient::EvictIdleConnections();
+	m_DnsCache.Purge();
 }
 
@@ -20,6 +20,8 @@
 #define WDC_WEB_CLIENT_SERVICE_H
 
 #include <map>
+#include <string>
+#include <vector>
 
 #include "boost/asio.hpp"		// not including SSL at this level on purpose
 #include "boost/thread.hpp"
@@ -45,23 +47,52 @@ namespace boost {
 #endif
 #include "boost/atomic.hpp"
 
+#include "DnsCache.h"
 #include "TimerPool.h"
 #include "UtilsLib.h"		
 
-//! This singleton class manages the boost::asio::io_service object and a pool of already established connections.
+//! This singleton class manages the boost::asio::io_service objects, the DNS cache and a pool of already established connections.
+//! By default one io_service runs on sm_ThreadCount threads. Setting sm_ServiceCount runs that many io_services instead,
+//! each on one thread pinned to a core, and each new connection is assigned to one of them. All the handlers of a
+//! connection then run on the same thread, and parsing and TLS for different connections run in parallel.
 class UTILS_API WebClientService
 {
 public:
+	//! Types
+	enum AssignMode
+	{
+		ASSIGN_ROUND_ROBIN,						// connections take turns
+		ASSIGN_HOST_HASH						// connections to the same host share an io_service
+	};
+
 	static WebClientService * Instance();
 	static int sm_ThreadCount;					// how many threads to start for the WebClient
+	static int sm_ServiceCount;					// io_services with one thread each, 0 for one per core, 1 uses sm_ThreadCount
+	static AssignMode sm_AssignMode;			// how connections are assigned to the io_services
+	static double sm_EvictInterval;				// seconds between checks for idle connections to close
 
 	WebClientService();
 	~WebClientService();
 
+	//! Returns the first io_service, this one runs DNS lookups and anything not tied to a connection.
 	boost::asio::io_service & GetService()
 	{
 		return m_Service;
 	}
+	boost::asio::io_service & GetService( size_t a_Index )
+	{
+		return *m_Services[ a_Index ];
+	}
+	size_t GetServiceCount() const
+	{
+		return m_Services.size();
+	}
+	//! Returns the io_service for a new connection to a_Host, this may be called from any thread.
+	boost::asio::io_service & AssignService( const std::string & a_Host );
+	DnsCache & GetDnsCache()
+	{
+		return m_DnsCache;
+	}
 
 private:
 	//! Types
@@ -69,19 +100,32 @@ private:
 	typedef boost::thread					Thread;
 	typedef boost::shared_ptr<Thread>		ThreadSP;
 	typedef std::list<ThreadSP>				ThreadList;
+	typedef boost::shared_ptr<boost::asio::io_service>
+											ServiceSP;
+	typedef boost::shared_ptr<Work>			WorkSP;
 
 	//! Data
 	boost::asio::io_service	m_Service;
 	boost::asio::io_service::work
 							m_Work;
+	DnsCache				m_DnsCache;
+	std::vector<ServiceSP>	m_ExtraServices;		// the io_services after m_Service
+	std::vector<WorkSP>		m_ExtraWork;
+	std::vector<boost::asio::io_service *>
+							m_Services;				// all io_services, starting with m_Service
+	boost::atomic<unsigned int>
+							m_NextService;
 	ThreadList				m_Threads;
 
 	TimerPool::ITimer::SP	m_spStatsTimer;
+	TimerPool::ITimer::SP	m_spEvictTimer;
 
 	static WebClientService *
 							sm_pInstance;
 
+	static void RunService( boost::asio::io_service * a_pService, int a_Core );
 	void OnDumpStats();
+	void OnEvictConnections();
 };
 
 
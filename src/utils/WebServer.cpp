@@ -30,6 +30,7 @@
 #include "TimerPool.h"
 #include "WebSocketFramer.h"
 #include "Log.h"
+#include "BinaryLog.h"
 #include "SHA1.h"
 #include "IWebServer.h"
 #include "UtilsLib.h"		// include last always
@@ -60,7 +61,8 @@ public:
 			m_bWebSocket(false),
 			m_pServer(a_pServer),
 			m_pSocket(a_pSocket),
-			m_ReadBuffer(new StreamBuffer())
+			m_ReadBuffer(new StreamBuffer()),
+			m_BodyLeft(0)
 		{}
 		virtual ~Connection()
 		{
@@ -85,12 +87,26 @@ public:
 		{
 			TimerPool * pPool = TimerPool::Instance();
 			if (pPool != NULL)
-				m_spTimeoutTimer = pPool->StartTimer(VOID_DELEGATE(Connection, OnTimeout, this), a_fSeconds, true, false);
+				m_spTimeoutTimer = pPool->StartTimer(VOID_DELEGATE(Connection, OnTimeout, this), a_fSeconds, true, false, NULL, TimerPool::TIMEOUT_SLACK);
 		}
 		void CancelTimeout()
 		{
 			m_spTimeoutTimer.reset();
 		}
+		//! Called with the headers of each request, so any of the body the handler doesn't read can be
+		//! skipped before the next request on this connection is read.
+		void SetRequestBody(const Headers & a_Headers)
+		{
+			m_BodyLeft = 0;
+			if (a_Headers.find("Transfer-Encoding") != a_Headers.end())
+				m_BodyLeft = UNKNOWN_BODY;
+			else
+			{
+				typename Headers::const_iterator iContentLen = a_Headers.find("Content-Length");
+				if (iContentLen != a_Headers.end())
+					m_BodyLeft = strtoul(iContentLen->second.c_str(), NULL, 10);
+			}
+		}
 
 		//! IWebSocket interface
 		virtual void ClearDelegates()
@@ -172,7 +188,7 @@ public:
 				}
 				catch (const std::exception & ex)
 				{
-					Log::Debug("Connection", "Caught Exception: %s", ex.what());
+					BLOG_DEBUG("Connection", "Caught Exception: %s", ex.what());
 				}
 			}
 			return m_bClosed;
@@ -213,25 +229,26 @@ public:
 			std::string response(StringUtil::Format("HTTP/1.1 %d %s\r\n", a_nStatusCode, a_Reply.c_str()));
 			for (typename Headers::const_iterator iHeader = a_Headers.begin(); iHeader != a_Headers.end(); ++iHeader)
 				response += iHeader->first + " : " + iHeader->second + "\r\n";
+			if (a_bClose)
+				response += "Connection: close\r\n";
+			else if (a_Headers.find("Content-Length") == a_Headers.end())
+				response += StringUtil::Format("Content-Length: %u\r\n", (unsigned int)a_Content.size());
 			response += "\r\n";
 			if (a_Content.size() > 0)
 				response += a_Content;
 
+			// a body we can't find the end of would be read as the next request, so close instead..
 			SendAsync(response);
-			if (a_bClose)
+			if (a_bClose || m_BodyLeft == UNKNOWN_BODY)
 				Close();
+			else
+				ReadNextRequest();
 		}
 
 		virtual void SendResponse(int a_nStatusCode, const std::string & a_Reply,
 			const std::string & a_Content, bool a_bClose = true)
 		{
-			std::string response(StringUtil::Format("HTTP/1.1 %d %s\r\n\r\n", a_nStatusCode, a_Reply.c_str()));
-			if (a_Content.size() > 0)
-				response += a_Content;
-
-			SendAsync(response);
-			if (a_bClose)
-				Close();
+			SendResponse(a_nStatusCode, a_Reply, Headers(), a_Content, a_bClose);
 		}
 
 		virtual void StartWebSocket(const std::string & a_WebSocketKey)
@@ -267,6 +284,9 @@ public:
 		typedef std::list< FrameSP >		FrameList;
 		typedef std::list< std::string >	SendList;
 
+		//! Constants
+		static const size_t UNKNOWN_BODY = (size_t)-1;		// the request body has a Transfer-Encoding
+
 		//! Data
 		bool			m_bClosed;
 		bool			m_bWebSocket;
@@ -284,9 +304,39 @@ public:
 						m_SendLock;
 		SendList		m_Sending;
 		StreamBufferSP	m_ReadBuffer;
+		size_t			m_BodyLeft;				// bytes of the request body not yet read by the handler
 		TimerPool::ITimer::SP
 						m_spTimeoutTimer;
 
+		//! Skips what is left of the request body, then reads the next request on this connection.
+		void ReadNextRequest()
+		{
+			size_t nSkip = (size_t)m_ReadBuffer->size();
+			if (nSkip > m_BodyLeft)
+				nSkip = m_BodyLeft;
+			m_ReadBuffer->consume(nSkip);
+			m_BodyLeft -= nSkip;
+
+			if (m_BodyLeft > 0)
+			{
+				StartTimeout(m_pServer->m_fRequestTimeout);
+				boost::asio::async_read(*m_pSocket, *m_ReadBuffer,
+					boost::asio::transfer_at_least(1),
+					boost::bind(&Connection::OnBodySkipped, shared_from_this(), boost::asio::placeholders::error));
+			}
+			else
+				m_pServer->ReadRequest(shared_from_this());
+		}
+
+		void OnBodySkipped(const boost::system::error_code & error)
+		{
+			CancelTimeout();
+			if (!error)
+				ReadNextRequest();
+			else
+				Close();
+		}
+
 		void OnReadWS(const boost::system::error_code& ec)
 		{
 			if (!ec)
@@ -341,6 +391,8 @@ public:
 					std::string * content = new std::string();
 					content->resize(max_read);
 					input.read(&(*content)[0], max_read);
+					if (m_BodyLeft != UNKNOWN_BODY)
+						m_BodyLeft = max_read < m_BodyLeft ? m_BodyLeft - max_read : 0;
 
 					ThreadPool::Instance()->InvokeOnMain<std::string *>( a_ReadCallback, content );
 				}
@@ -398,7 +450,7 @@ public:
 
 		void OnTimeout()
 		{
-			Log::Debug("Connection", "OnTimeout()");
+			BLOG_DEBUG("Connection", "OnTimeout()");
 			Close();
 		}
 	};
@@ -487,13 +539,14 @@ public:
 	//! Add an end-point to this server, the provided delegate will be invoked with the 
 	//! Request object when an incoming client connections makes a request that matches 
 	//! the provided end-point mask.
-	//! NOTE: the delegate will be invoked in a thread from this servers thread-pool.
+	//! NOTE: the delegate will be invoked in a thread from this servers thread-pool, unless an executor is provided.
 	virtual void AddEndpoint(const std::string & a_EndPointMask,
 		Delegate<RequestSP> a_RequestHandler,
-		bool a_bInvokeOnMain = true)
+		bool a_bInvokeOnMain = true,
+		ThreadPool * a_pExecutor = NULL)
 	{
 		boost::lock_guard<Mutex> lock(m_EndPointLock);
-		m_EndPoints.push_back(EndPoint(a_EndPointMask, a_RequestHandler, a_bInvokeOnMain));
+		m_EndPoints.push_back(EndPoint(a_EndPointMask, a_RequestHandler, a_bInvokeOnMain, a_pExecutor));
 	}
 
 	//! Remove a register end-point.
@@ -528,13 +581,14 @@ protected:
 	//! Structure for a end-point.
 	struct EndPoint
 	{
-		EndPoint(const std::string & a_EndPointMask, Delegate<RequestSP> a_RequestHandler, bool a_bInvokeOnMain) :
-			m_EndPointMask(a_EndPointMask), m_RequestHandler(a_RequestHandler), m_bInvokeOnMain(a_bInvokeOnMain)
+		EndPoint(const std::string & a_EndPointMask, Delegate<RequestSP> a_RequestHandler, bool a_bInvokeOnMain, ThreadPool * a_pExecutor) :
+			m_EndPointMask(a_EndPointMask), m_RequestHandler(a_RequestHandler), m_bInvokeOnMain(a_bInvokeOnMain), m_pExecutor(a_pExecutor)
 		{}
 
 		std::string			m_EndPointMask;
 		Delegate<RequestSP>	m_RequestHandler;
 		bool				m_bInvokeOnMain;
+		ThreadPool *		m_pExecutor;
 	};
 	typedef std::list<EndPoint>	EndPointList;
 
@@ -632,6 +686,7 @@ protected:
 					}
 
 					// hand off our stream buffer to the connect, so it can get any remaining bytes..
+					pConnection->SetRequestBody(spRequest->m_Headers);
 					ProcessRequest(spRequest);
 				}
 			}
@@ -643,6 +698,7 @@ protected:
 		// automatically upgrade connections to web-sockets if they have a key..
 		Delegate<RequestSP> spRequestHandler;
 		bool bInvokeOnMain = false;
+		ThreadPool * pExecutor = NULL;
 
 		m_EndPointLock.lock();
 		for (typename EndPointList::const_iterator iEndPoint = m_EndPoints.begin(); iEndPoint != m_EndPoints.end(); ++iEndPoint)
@@ -651,6 +707,7 @@ protected:
 			{
 				spRequestHandler = (*iEndPoint).m_RequestHandler;
 				bInvokeOnMain = (*iEndPoint).m_bInvokeOnMain;
+				pExecutor = (*iEndPoint).m_pExecutor;
 				break;
 			}
 		}
@@ -659,7 +716,9 @@ protected:
 		if (spRequestHandler.IsValid())
 		{
 			if (bInvokeOnMain)
-				ThreadPool::Instance()->InvokeOnMain<RequestSP>(spRequestHandler, a_spRequest);
+				ThreadPool::Instance()->InvokeOnMain<RequestSP>(spRequestHandler, a_spRequest, ThreadPool::PRIORITY_HIGH);
+			else if (pExecutor != NULL)
+				pExecutor->InvokeOnThread<RequestSP>(spRequestHandler, a_spRequest, ThreadPool::PRIORITY_HIGH);
 			else
 				spRequestHandler(a_spRequest);
 		}
@@ -0,0 +1,210 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "UnitTest.h"
+#include "utils/BinaryLog.h"
+#include "utils/Log.h"
+#include "utils/StringUtil.h"
+#include "utils/Time.h"
+
+class TestBinaryLog : UnitTest
+{
+public:
+	//! Types
+	class TextReactor : public ILogReactor
+	{
+	public:
+		TextReactor( LogLevel a_MinLevel ) : m_MinLevel( a_MinLevel )
+		{}
+
+		virtual void Process(const LogRecord & a_Record)
+		{
+			if ( a_Record.m_Level >= m_MinLevel && a_Record.m_SubSystem == "TestBinaryLog" )
+				m_Messages.push_back( a_Record.m_Message );
+		}
+		virtual void SetLogLevel( LogLevel a_Level )
+		{
+			m_MinLevel = a_Level;
+			Log::UpdateMinLevel();
+		}
+		virtual LogLevel GetLogLevel() const
+		{
+			return m_MinLevel;
+		}
+
+		LogLevel					m_MinLevel;
+		std::vector<std::string>	m_Messages;
+	};
+
+	//! Construction
+	TestBinaryLog() : UnitTest("TestBinaryLog")
+	{}
+
+	virtual void RunTest()
+	{
+		BinaryReactor::ArgList args;
+		Test( BinaryReactor::ParseFormat( "%d %5.2f %s %% %-*s %lu %llx %p %zu", args ) );
+		Test( args.size() == 9 );
+		Test( args[0] == BinaryReactor::ARG_INT && args[1] == BinaryReactor::ARG_DOUBLE && args[2] == BinaryReactor::ARG_STRING );
+		Test( args[3] == BinaryReactor::ARG_INT && args[4] == BinaryReactor::ARG_STRING );
+		Test( args[5] == BinaryReactor::ARG_LONG && args[6] == BinaryReactor::ARG_LONGLONG );
+		Test( args[7] == BinaryReactor::ARG_POINTER && args[8] == BinaryReactor::ARG_SIZE );
+		Test(! BinaryReactor::ParseFormat( "%d%n", args ) );
+
+		// a long string is cut short to leave room for the arguments after it
+		std::string longString( 5000, 'x' );
+		char encoded[ 448 ];
+		int encodedSize = Encode( encoded, sizeof(encoded), "Long %s %d", longString.c_str(), 42 );
+		Test( encodedSize > 0 && encodedSize <= (int)sizeof(encoded) );
+		char formatted[ 1024 ];
+		Test( encodedSize > 0 && BinaryReactor::FormatArgs( "Long %s %d", encoded, encodedSize, formatted, sizeof(formatted) ) );
+		Test( StringUtil::EndsWith( formatted, "x 42" ) );
+		Test( Encode( encoded, 4, "%d %d", 1, 2 ) < 0 );
+
+		// take out the registered reactors, so the text level and the benchmark only see the reactors made here
+		Log::ReactorList reactors( Log::GetReactorList() );
+		for( Log::ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor )
+			Log::RemoveReactor( *iReactor, false );
+
+		// records are decoded back into the same messages the text functions would have logged
+		const char * LOG_FILE = "TestBinaryLog.blog";
+		BinaryReactor * pReactor = new BinaryReactor( LOG_FILE, LL_DEBUG_LOW, 16 * 1024 * 1024 );
+		Log::RegisterReactor( pReactor );
+		Test( BinaryReactor::Instance() == pReactor );
+		// the other reactors get the records their level admits as text, the BinaryReactor doesn't get them twice
+		TextReactor * pText = new TextReactor( LL_DEBUG_MED );
+		Log::RegisterReactor( pText );
+		Test( Log::GetTextLevel() == LL_DEBUG_MED );
+
+		std::vector<std::string> expected;
+		for(int i=0;i<3;++i)
+		{
+			BLOG_DEBUG_LOW( "TestBinaryLog", "Request %d to %s took %.3f seconds (%lu bytes, %llx) %-*s|%%", 
+				i, "http://localhost/", 0.25 * i, (unsigned long)(1000 + i), (long long)0x1234567890LL, 6, "pad" );
+			expected.push_back( StringUtil::Format( "Request %d to %s took %.3f seconds (%lu bytes, %llx) %-*s|%%", 
+				i, "http://localhost/", 0.25 * i, (unsigned long)(1000 + i), (long long)0x1234567890LL, 6, "pad" ) );
+		}
+		BLOG_DEBUG( "TestBinaryLog", "No arguments" );
+		expected.push_back( "No arguments" );
+		BLOG_DEBUG_MED( "TestBinaryLog", "Null %s, char %c", (const char *)NULL, 'x' );
+		expected.push_back( "Null (null), char x" );
+		Log::DebugLow( "TestBinaryLog", "Text record %d", 42 );
+		expected.push_back( "Text record 42" );
+		BLOG_DEBUG_LOW( "TestBinaryLog", "Long %s %d", longString.c_str(), 42 );
+		size_t longRecord = expected.size();
+		expected.push_back( std::string() );
+		Test( pText->m_Messages.size() == 2 );
+		Test( pText->m_Messages.size() == 2 && pText->m_Messages[0] == "No arguments" && pText->m_Messages[1] == "Null (null), char x" );
+		Log::RemoveReactor( pText );
+
+		double startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			BLOG_DEBUG_LOW( "TestBinaryLog", "Bench %d of %d, URL: %s", i, BENCH_COUNT, "http://localhost/" );
+		double fBinary = Time::GetMonotonicTime() - startTime;
+		unsigned int nRecords = pReactor->GetRecords();
+		unsigned int nDropped = pReactor->GetDropped();
+
+		Log::RemoveReactor( pReactor );
+		Test( BinaryReactor::Instance() == NULL );
+		Test( nRecords == expected.size() + BENCH_COUNT );
+		Test( nDropped == 0 );
+
+		// the cost of formatting the same record as text, which is what DoLog() does
+		startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+		{
+			Time now;
+			LogRecord rec;
+			rec.m_Time = now.GetFormattedTime( "%x %X" ) + StringUtil::Format(".%0.3d", (int)now.GetMilliseconds()); 
+			rec.m_Message = StringUtil::Format( "Bench %d of %d, URL: %s", i, BENCH_COUNT, "http://localhost/" );
+		}
+		double fText = Time::GetMonotonicTime() - startTime;
+
+		std::stringstream decoded;
+		Test( BinaryReactor::Decode( LOG_FILE, decoded ) );
+		size_t binarySize = (size_t)boost::filesystem::file_size( LOG_FILE );
+		boost::filesystem::remove( LOG_FILE );
+
+		std::vector<std::string> lines;
+		std::string line;
+		while( std::getline( decoded, line ) )
+			lines.push_back( line );
+		Test( lines.size() == expected.size() + BENCH_COUNT );
+
+		bool bMatch = lines.size() >= expected.size();
+		for(size_t i=0;i<expected.size() && bMatch;++i)
+		{
+			size_t end = lines[i].find( "] " );
+			bMatch &= end != std::string::npos && (i == longRecord || lines[i].substr( end + 2 ) == expected[i]);
+		}
+		Test( bMatch );
+		Test( lines.size() > longRecord && StringUtil::EndsWith( lines[longRecord], "x 42" ) );
+		Test( lines.size() > 0 && lines[0].find( "][DEBL][TestBinaryLog] " ) != std::string::npos );
+		Test( lines.size() > 5 && lines[5].find( "][DEBL][TestBinaryLog] " ) != std::string::npos );
+		Test( lines.size() > 3 && lines[3].find( "][DEBH][TestBinaryLog] " ) != std::string::npos );
+		Test( lines.back() == lines.back().substr( 0, lines.back().find( "] " ) + 2 ) 
+			+ StringUtil::Format( "Bench %d of %d, URL: %s", BENCH_COUNT - 1, BENCH_COUNT, "http://localhost/" ) );
+
+		// async logging keeps a BLOG_ record the text reactors get out of the binary log as text..
+		pReactor = new BinaryReactor( LOG_FILE, LL_DEBUG_LOW, 1024 * 1024 );
+		Log::RegisterReactor( pReactor );
+		pText = new TextReactor( LL_DEBUG_LOW );
+		Log::RegisterReactor( pText );
+		Log::StartAsync();
+		BLOG_DEBUG( "TestBinaryLog", "Async record %d", 1 );
+		Log::StopAsync();
+		Test( pText->m_Messages.size() == 1 );
+		Log::RemoveReactor( pText );
+		Log::RemoveReactor( pReactor );
+
+		std::stringstream asyncDecoded;
+		Test( BinaryReactor::Decode( LOG_FILE, asyncDecoded ) );
+		boost::filesystem::remove( LOG_FILE );
+
+		lines.clear();
+		while( std::getline( asyncDecoded, line ) )
+			lines.push_back( line );
+		Test( lines.size() == 1 );
+		Test( lines.size() == 1 && StringUtil::EndsWith( lines[0], "] Async record 1" ) );
+
+		for( Log::ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor )
+			Log::RegisterReactor( *iReactor );
+
+		Log::Status( "TestBinaryLog", "%d records: binary %.0f ns each (%.1f bytes), text formatting %.0f ns each",
+			BENCH_COUNT, (fBinary * 1000000000.0) / BENCH_COUNT, (double)binarySize / nRecords, (fText * 1000000000.0) / BENCH_COUNT );
+	}
+
+	static int Encode( char * a_pBuffer, size_t a_Size, const char * a_pFormat, ... )
+	{
+		va_list args;
+		va_start( args, a_pFormat );
+		int size = BinaryReactor::EncodeArgs( a_pFormat, args, a_pBuffer, a_Size );
+		va_end( args );
+		return size;
+	}
+
+	static const int BENCH_COUNT = 100000;
+};
+
+TestBinaryLog TEST_BINARYLOG;
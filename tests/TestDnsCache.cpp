@@ -0,0 +1,153 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include "UnitTest.h"
+#include "utils/DnsCache.h"
+#include "utils/Log.h"
+#include "utils/Time.h"
+
+#include "boost/atomic.hpp"
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
+
+class TestDnsCache : UnitTest
+{
+public:
+	//! Construction
+	TestDnsCache() : UnitTest("TestDnsCache"), m_Resolved( 0 ), m_Failed( 0 )
+	{}
+
+	virtual void RunTest()
+	{
+		boost::asio::io_service service;
+		boost::asio::io_service::work work( service );
+		boost::thread thread( boost::bind( &boost::asio::io_service::run, &service ) );
+
+		{
+			DnsCache cache( service );
+			cache.SetTTL( 60.0 );
+			cache.SetNegativeTTL( 60.0 );
+
+			// many requests for a host that isn't cached share one lookup..
+			double startTime = Time::GetMonotonicTime();
+			for(int i=0;i<REQUESTS;++i)
+				cache.Resolve( "localhost", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( Wait( REQUESTS ) );
+			double fCold = Time::GetMonotonicTime() - startTime;
+			Test( m_Failed == 0 );
+			Test( cache.GetLookups() == 1 );
+			Test( cache.GetMisses() == REQUESTS );
+			Test( cache.GetHits() == 0 );
+
+			// the rest are answered from the cache before Resolve() returns..
+			startTime = Time::GetMonotonicTime();
+			for(int i=0;i<REQUESTS;++i)
+				cache.Resolve( "localhost", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			double fCached = Time::GetMonotonicTime() - startTime;
+			Test( m_Resolved == REQUESTS * 2 );
+			Test( cache.GetHits() == REQUESTS );
+			Test( cache.GetLookups() == 1 );
+
+			// failures are cached too..
+			cache.Resolve( "no-such-host.invalid", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( Wait( REQUESTS * 2 + 1 ) );
+			Test( m_Failed == 1 );
+			cache.Resolve( "no-such-host.invalid", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( m_Failed == 2 );
+			Test( cache.GetLookups() == 2 );
+
+			// an entry used shortly before it expires is refreshed in the background, and still answered from the cache..
+			cache.SetRefreshTime( 120.0 );
+			unsigned int hits = cache.GetHits();
+			cache.Resolve( "localhost", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( cache.GetHits() == hits + 1 );
+			Test( cache.GetLookups() == 3 );
+
+			// entries being looked up aren't cleared until the lookup is done..
+			cache.Clear();
+			for( double start = Time::GetMonotonicTime(); cache.GetSize() > 0 && Time::GetMonotonicTime() - start < 5.0; cache.Clear() )
+				boost::this_thread::sleep( boost::posix_time::milliseconds(1) );
+			Test( cache.GetSize() == 0 );
+
+			// expired entries are looked up again and purged..
+			cache.SetTTL( 0.0 );
+			int resolved = m_Resolved;
+			cache.Resolve( "localhost", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( Wait( resolved + 1 ) );
+			cache.Resolve( "localhost", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( Wait( resolved + 2 ) );
+			Test( cache.GetLookups() == 5 );
+			Test( cache.Purge() == 1 );
+			Test( cache.GetSize() == 0 );
+
+			// IPv6 and IPv4 addresses are alternated, starting with the first family..
+			DnsCache::Endpoints endpoints;
+			endpoints.push_back( DnsCache::Endpoint( boost::asio::ip::address::from_string( "::1" ), 80 ) );
+			endpoints.push_back( DnsCache::Endpoint( boost::asio::ip::address::from_string( "::2" ), 80 ) );
+			endpoints.push_back( DnsCache::Endpoint( boost::asio::ip::address::from_string( "::3" ), 80 ) );
+			endpoints.push_back( DnsCache::Endpoint( boost::asio::ip::address::from_string( "127.0.0.1" ), 80 ) );
+			endpoints.push_back( DnsCache::Endpoint( boost::asio::ip::address::from_string( "127.0.0.2" ), 80 ) );
+			DnsCache::Interleave( endpoints );
+			Test( endpoints.size() == 5 );
+			Test( endpoints[0].address().to_string() == "::1" );
+			Test( endpoints[1].address().to_string() == "127.0.0.1" );
+			Test( endpoints[2].address().to_string() == "::2" );
+			Test( endpoints[3].address().to_string() == "127.0.0.2" );
+			Test( endpoints[4].address().to_string() == "::3" );
+
+			// pinned endpoints are used as given and never expire..
+			cache.SetEndpoints( "pinned.test", 80, endpoints );
+			resolved = m_Resolved;
+			cache.Resolve( "pinned.test", 80, boost::bind( &TestDnsCache::OnResolved, this, _1, _2 ) );
+			Test( m_Resolved == resolved + 1 );
+			Test( cache.GetLookups() == 5 );
+			Test( cache.Purge() == 0 );
+
+			Log::Status( "TestDnsCache", "%d requests: %.3f ms with 1 lookup, %.3f ms cached",
+				REQUESTS, fCold * 1000.0, fCached * 1000.0 );
+		}
+
+		service.stop();
+		thread.join();
+	}
+
+	bool Wait( int a_Count )
+	{
+		for( double start = Time::GetMonotonicTime(); m_Resolved < a_Count; )
+		{
+			if ( Time::GetMonotonicTime() - start > 30.0 )
+				return false;
+			boost::this_thread::sleep( boost::posix_time::milliseconds(1) );
+		}
+		return true;
+	}
+
+	void OnResolved( const boost::system::error_code & a_Error, DnsCache::EndpointsSP a_spEndpoints )
+	{
+		if ( a_Error || !a_spEndpoints || a_spEndpoints->size() == 0 || (*a_spEndpoints)[0].port() != 80 )
+			m_Failed++;
+		m_Resolved++;
+	}
+
+	static const int REQUESTS = 100;
+
+	boost::atomic<int>	m_Resolved;
+	boost::atomic<int>	m_Failed;
+};
+
+TestDnsCache TEST_DNS_CACHE;
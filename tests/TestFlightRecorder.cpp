@@ -0,0 +1,175 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "boost/filesystem.hpp"
+#include "boost/thread.hpp"
+
+#include "UnitTest.h"
+#include "utils/BinaryLog.h"
+#include "utils/FlightRecorder.h"
+#include "utils/Log.h"
+#include "utils/StringUtil.h"
+#include "utils/Time.h"
+
+class TestFlightRecorder : UnitTest
+{
+public:
+	//! Construction
+	TestFlightRecorder() : UnitTest("TestFlightRecorder")
+	{}
+
+	virtual void RunTest()
+	{
+		const char * DUMP_FILE = "TestFlightRecorder.log";
+
+		// raise every registered reactor to errors only, so only the recorder wants the debug records
+		std::vector<LogLevel> levels;
+		Log::ReactorList & reactors = Log::GetReactorList();
+		for( Log::ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor )
+		{
+			levels.push_back( (*iReactor)->GetLogLevel() );
+			(*iReactor)->SetLogLevel( LL_ERROR );
+		}
+
+		// debug records are recorded even though no reactor wants them..
+		bool bWasEnabled = Log::IsEnabled( LL_DEBUG_LOW );
+		FlightRecorder::Start( RECORDS, LL_DEBUG_LOW );
+		Test( FlightRecorder::IsActive() );
+		Test( Log::IsEnabled( LL_DEBUG_LOW ) );
+
+		boost::uint64_t first = FlightRecorder::GetRecords();
+		for(int i=0;i<RECORDS + 10;++i)
+			LOG_DEBUG_LOW( "TestFlightRecorder", "Record %d to %s took %.3f seconds (%lu bytes) %-*s|",
+				i, "http://localhost/", 0.25 * i, (unsigned long)(1000 + i), 6, "pad" );
+		BLOG_DEBUG_MED( "TestFlightRecorder", "Binary %d, %s", 7, "call-site" );
+		Log::DebugHigh( "TestFlightRecorder", "Text %d %ls", 42, L"wide" );
+		Test( FlightRecorder::GetRecords() - first == RECORDS + 12 );
+
+		Test( FlightRecorder::Dump( DUMP_FILE ) );
+		std::vector<std::string> lines;
+		ReadLines( DUMP_FILE, lines );
+		Test( lines.size() == RECORDS + 1 );
+		Test( lines.size() > 0 && lines[0].find( "---- Flight recorder" ) == 0 );
+
+		// the oldest records were overwritten, the newest are formatted like the text functions would..
+		int expected = 12;
+		bool bMatch = lines.size() == RECORDS + 1;
+		for(size_t i=1;i<lines.size() - 2 && bMatch;++i, ++expected)
+		{
+			bMatch &= lines[i].find( "][DEBL][TestFlightRecorder] " ) != std::string::npos;
+			bMatch &= Message( lines[i] ) == StringUtil::Format( "Record %d to %s took %.3f seconds (%lu bytes) %-*s|",
+				expected, "http://localhost/", 0.25 * expected, (unsigned long)(1000 + expected), 6, "pad" );
+		}
+		Test( bMatch );
+		Test( lines.size() > 2 && Message( lines[ lines.size() - 2 ] ) == "Binary 7, call-site" );
+		Test( lines.size() > 2 && lines[ lines.size() - 2 ].find( "][DEBM][" ) != std::string::npos );
+		// wide strings can't be recorded lazily, so that one is formatted when recorded
+		Test( lines.size() > 1 && Message( lines.back() ) == "Text 42 wide" );
+
+		// dumping while threads are logging only skips the records being written..
+		m_bStop = false;
+		boost::thread_group threads;
+		for(int i=0;i<THREADS;++i)
+			threads.create_thread( boost::bind( &TestFlightRecorder::LogThread, this, i ) );
+		int dumps = 0;
+		bool bDumped = true;
+		for( double start = Time::GetMonotonicTime(); Time::GetMonotonicTime() - start < 0.2; ++dumps )
+			bDumped &= FlightRecorder::Dump( DUMP_FILE );
+		m_bStop = true;
+		threads.join_all();
+		Test( bDumped && dumps > 0 );
+		ReadLines( DUMP_FILE, lines );
+		Test( lines.size() > 1 && lines.size() <= RECORDS + 1 );
+
+		// the cost of recording a debug record no reactor wants..
+		double startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			LOG_DEBUG_LOW( "TestFlightRecorder", "Bench %d of %d, URL: %s", i, BENCH_COUNT, "http://localhost/" );
+		double fRecord = Time::GetMonotonicTime() - startTime;
+
+		FlightRecorder::Stop();
+		Test(! FlightRecorder::IsActive() );
+		Test( Log::IsEnabled( LL_DEBUG_LOW ) == bWasEnabled );
+
+#ifndef _WIN32
+		// a crashing process dumps the recorder before it dies..
+		boost::filesystem::remove( DUMP_FILE );
+		pid_t child = fork();
+		if ( child == 0 )
+		{
+			FlightRecorder::InstallCrashHandler( DUMP_FILE );
+			FlightRecorder::Start( RECORDS, LL_DEBUG_LOW );
+			LOG_DEBUG_LOW( "TestFlightRecorder", "Last words %d", 1 );
+			raise( SIGSEGV );
+			_exit( 0 );
+		}
+		int status = 0;
+		Test( child > 0 && waitpid( child, &status, 0 ) == child );
+		Test( WIFSIGNALED( status ) && WTERMSIG( status ) == SIGSEGV );
+		ReadLines( DUMP_FILE, lines );
+		Test( lines.size() > 1 && Message( lines.back() ) == "Last words 1" );
+#endif
+		boost::filesystem::remove( DUMP_FILE );
+
+		std::vector<LogLevel>::iterator iLevel = levels.begin();
+		for( Log::ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor )
+			(*iReactor)->SetLogLevel( *iLevel++ );
+
+		Log::Status( "TestFlightRecorder", "%d records: %.0f ns each, %d dumps while logging",
+			BENCH_COUNT, (fRecord * 1000000000.0) / BENCH_COUNT, dumps );
+	}
+
+	void LogThread( int a_Thread )
+	{
+		for(int i=0;!m_bStop;++i)
+			LOG_DEBUG_LOW( "TestFlightRecorder", "Thread %d record %d", a_Thread, i );
+	}
+
+	static void ReadLines( const char * a_pFile, std::vector<std::string> & a_Lines )
+	{
+		a_Lines.clear();
+		std::ifstream input( a_pFile );
+		std::string line;
+		while( std::getline( input, line ) )
+			a_Lines.push_back( line );
+	}
+
+	static std::string Message( const std::string & a_Line )
+	{
+		size_t end = a_Line.find( "] " );
+		return end != std::string::npos ? a_Line.substr( end + 2 ) : std::string();
+	}
+
+	static const int RECORDS = 64;
+	static const int THREADS = 4;
+	static const int BENCH_COUNT = 100000;
+
+	volatile bool	m_bStop;
+};
+
+TestFlightRecorder TEST_FLIGHTRECORDER;
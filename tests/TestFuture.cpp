@@ -0,0 +1,175 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include "boost/atomic.hpp"
+#include "boost/weak_ptr.hpp"
+#include <vector>
+
+#include "UnitTest.h"
+#include "utils/Future.h"
+#include "utils/Log.h"
+#include "utils/ThreadPool.h"
+#include "utils/Time.h"
+
+class TestFuture : UnitTest
+{
+public:
+	//! Construction
+	TestFuture() : UnitTest("TestFuture"), m_nThen( 0 ), m_nMainValue( 0 ), m_bMainDone( false )
+	{}
+
+	virtual void RunTest()
+	{
+		ThreadPool pool( 2 );
+		pool.SetMaxThreads( 4 );
+
+		// a completed future runs an inline continuation right away
+		Future<int> ready( 5 );
+		Test( ready.IsValid() && ready.IsReady() );
+		Test( ready.Get() == 5 );
+		m_nThen = 0;
+		ready.Then( DELEGATE(TestFuture, OnThen, int, this) );
+		Test( m_nThen == 5 );
+
+		// an unset promise times out, setting it completes the future and runs continuations added before
+		Promise<int> promise;
+		Future<int> pending( promise.GetFuture() );
+		Test( pending.IsValid() && !pending.IsReady() );
+		Test(! pending.Wait( 0.05 ) );
+		m_nThen = 0;
+		pending.Then( DELEGATE(TestFuture, OnThen, int, this) );
+		Test( m_nThen == 0 );
+		Test( promise.SetValue( 7 ) );
+		Test(! promise.SetValue( 8 ) );
+		Test( m_nThen == 7 );
+		Test( pending.Get() == 7 );
+
+		// work done on the pool, continuation on the main thread
+		m_bMainDone = false;
+		Future<int> work( pool.InvokeOnThread<int>( DELEGATE(TestFuture, Square, Promise<int>, this) ) );
+		work.Then( DELEGATE(TestFuture, OnMain, int, this), DISPATCH_MAIN );
+		double startTime = Time().GetEpochTime();
+		while(! m_bMainDone && (Time().GetEpochTime() - startTime) < 10.0 )
+		{
+			pool.ProcessMainThread();
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(1));
+		}
+		Test( m_bMainDone );
+		Test( m_nMainValue == 144 );
+
+		// WhenAll over a mix of completed and pending futures
+		std::vector< Future<int> > futures;
+		for(int i=0;i<FUTURE_COUNT;++i)
+		{
+			m_Promises.push_back( Promise<int>() );
+			if ( (i % 4) == 0 )
+				futures.push_back( Future<int>( i ) );
+			else
+				futures.push_back( m_Promises[i].GetFuture() );
+		}
+		Future< std::vector<int> > all( Future<int>::WhenAll( futures ) );
+		Future<size_t> any( Future<int>::WhenAny( futures ) );
+		Test( any.IsReady() && any.Get() == 0 );
+		Test(! all.IsReady() );
+		for(int i=0;i<FUTURE_COUNT;++i)
+		{
+			if ( (i % 4) != 0 )
+				pool.InvokeOnThread<int>( DELEGATE(TestFuture, SetIndex, int, this), i );
+		}
+		Test( all.Wait( 10.0 ) );
+		const std::vector<int> & values = all.Get();
+		Test( values.size() == FUTURE_COUNT );
+		bool bMatch = true;
+		for(size_t i=0;i<values.size();++i)
+			bMatch &= values[i] == (int)i;
+		Test( bMatch );
+
+		// WhenAny reports the first one to complete
+		std::vector< Promise<int> > racers;
+		std::vector< Future<int> > racing;
+		for(size_t i=0;i<3;++i)
+		{
+			racers.push_back( Promise<int>() );
+			racing.push_back( racers[i].GetFuture() );
+		}
+		Future<size_t> first( Future<int>::WhenAny( racing ) );
+		Test(! first.IsReady() );
+		racers[2].SetValue( 2 );
+		racers[0].SetValue( 0 );
+		Test( first.IsReady() && first.Get() == 2 );
+
+		// WhenAll of futures that are all complete doesn't need a promise
+		std::vector< Future<int> > done;
+		done.push_back( Future<int>( 1 ) );
+		done.push_back( Future<int>( 2 ) );
+		Future< std::vector<int> > allDone( Future<int>::WhenAll( done ) );
+		Test( allDone.IsReady() && allDone.Get().size() == 2 );
+
+		// nothing can complete a WhenAny() without a valid input, or a WhenAll() with an invalid one
+		std::vector< Future<int> > none;
+		Test(! Future<int>::WhenAny( none ).IsValid() );
+		none.push_back( Future<int>() );
+		Test(! Future<int>::WhenAny( none ).IsValid() );
+		none.push_back( racers[1].GetFuture() );
+		Test(! Future<int>::WhenAll( none ).IsValid() );
+
+		// a WhenAll() waiting on an abandoned promise is released along with the promise
+		boost::weak_ptr<int> wpValue;
+		{
+			boost::shared_ptr<int> spValue( new int( 1 ) );
+			wpValue = spValue;
+
+			Promise< boost::shared_ptr<int> > abandoned;
+			std::vector< Future< boost::shared_ptr<int> > > inputs;
+			inputs.push_back( Future< boost::shared_ptr<int> >( spValue ) );
+			inputs.push_back( abandoned.GetFuture() );
+			Test(! Future< boost::shared_ptr<int> >::WhenAll( inputs ).IsReady() );
+		}
+		Test( wpValue.expired() );
+	}
+
+	void OnThen( int v )
+	{
+		m_nThen = v;
+	}
+
+	void Square( Promise<int> a_Promise )
+	{
+		a_Promise.SetValue( 12 * 12 );
+	}
+
+	void SetIndex( int a_Index )
+	{
+		m_Promises[ a_Index ].SetValue( a_Index );
+	}
+
+	void OnMain( int v )
+	{
+		m_nMainValue = v;
+		m_bMainDone = true;
+	}
+
+	static const int FUTURE_COUNT = 64;
+
+	boost::atomic<int> m_nThen;
+	int m_nMainValue;
+	volatile bool m_bMainDone;
+	std::vector< Promise<int> > m_Promises;
+};
+
+TestFuture TEST_FUTURE;
@@ -0,0 +1,268 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include <stdio.h>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "boost/thread.hpp"
+
+#include "UnitTest.h"
+#include "utils/Log.h"
+#include "utils/StringUtil.h"
+#include "utils/Time.h"
+
+class TestLog : UnitTest
+{
+public:
+	static const int ASYNC_THREADS = 4;
+	static const int ASYNC_RECORDS = 5000;
+
+	//! Types
+	class CountReactor : public ILogReactor
+	{
+	public:
+		CountReactor( LogLevel a_MinLevel ) : m_MinLevel( a_MinLevel ), m_Count( 0 ), m_Summaries( 0 ), m_bOrdered( true )
+		{
+			for(int i=0;i<ASYNC_THREADS;++i)
+				m_Last[i] = -1;
+		}
+
+		virtual void Process(const LogRecord & a_Record)
+		{
+			// the async drain reports drops under its own sub-system
+			if ( a_Record.m_Level >= m_MinLevel && a_Record.m_SubSystem != "Log" )
+			{
+				m_Count += 1;
+				if ( a_Record.m_Message.find( "Suppressed " ) == 0 )
+					m_Summaries += 1;
+
+				int thread = 0, seq = 0;
+				if ( sscanf( a_Record.m_Message.c_str(), "Async %d %d", &thread, &seq ) == 2 )
+				{
+					m_bOrdered &= seq > m_Last[thread];
+					m_Last[thread] = seq;
+				}
+			}
+		}
+		virtual void SetLogLevel( LogLevel a_Level )
+		{
+			m_MinLevel = a_Level;
+			Log::UpdateMinLevel();
+		}
+		virtual LogLevel GetLogLevel() const
+		{
+			return m_MinLevel;
+		}
+
+		LogLevel	m_MinLevel;
+		int			m_Count;
+		int			m_Summaries;
+		bool		m_bOrdered;
+		int			m_Last[ ASYNC_THREADS ];
+	};
+
+	//! Construction
+	TestLog() : UnitTest("TestLog"), m_Evaluated( 0 )
+	{}
+
+	virtual void RunTest()
+	{
+		// raise every registered reactor to errors only, so the debug levels are disabled
+		std::vector<LogLevel> levels;
+		Log::ReactorList & reactors = Log::GetReactorList();
+		for( Log::ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor )
+		{
+			levels.push_back( (*iReactor)->GetLogLevel() );
+			(*iReactor)->SetLogLevel( LL_ERROR );
+		}
+
+		CountReactor * pCounter = new CountReactor( LL_WARNING );
+		Log::RegisterReactor( pCounter );
+		Test( Log::IsEnabled( LL_WARNING ) );
+		Test(! Log::IsEnabled( LL_STATUS ) );
+
+		// disabled levels don't evaluate their arguments
+		m_Evaluated = 0;
+		LOG_DEBUG_LOW( "TestLog", "Value %d", Evaluate() );
+		LOG_STATUS( "TestLog", "Value %d", Evaluate() );
+		Test( m_Evaluated == 0 );
+		LOG_WARNING( "TestLog", "Value %d", Evaluate() );
+		Test( m_Evaluated == 1 );
+		Test( pCounter->m_Count == 1 );
+
+		pCounter->SetLogLevel( LL_DEBUG_MED );
+		Test( Log::IsEnabled( LL_DEBUG_MED ) );
+		Test(! Log::IsEnabled( LL_DEBUG_LOW ) );
+
+		// a filtered level returns before any formatting
+		pCounter->SetLogLevel( LL_ERROR );
+		double startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			Log::DebugLow( "TestLog", "Filtered %d %s", i, "message" );
+		double fFiltered = Time::GetMonotonicTime() - startTime;
+		Test( pCounter->m_Count == 1 );
+
+		// a storm from one call-site is cut down to the burst, then a summary of what was suppressed
+		pCounter->SetLogLevel( LL_DEBUG_LOW );
+		pCounter->m_Count = 0;
+		Log::SetRateLimit( "TestLog", Log::RateLimit( 10.0, 5.0, 1, 0.1 ) );
+		for(int i=0;i<1000;++i)
+			Storm( i );
+		Test( pCounter->m_Count >= 5 && pCounter->m_Count <= 7 );
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 250 ) );
+		pCounter->m_Summaries = 0;
+		Storm( 1000 );
+		Test( pCounter->m_Summaries == 1 );
+
+		// a call-site that goes quiet is summarized when the log is flushed, without another message from it
+		for(int i=0;i<1000;++i)
+			Storm( i );
+		pCounter->m_Summaries = 0;
+		Log::Flush();
+		Test( pCounter->m_Summaries == 1 );
+		Log::Flush();
+		Test( pCounter->m_Summaries == 1 );
+
+		// sampling only considers 1 in N calls
+		Log::SetRateLimit( "TestLog", Log::RateLimit( 0.0, 0.0, 10, 1000.0 ) );
+		pCounter->m_Count = 0;
+		for(int i=0;i<100;++i)
+			LOG_LIMITED( LL_WARNING, "TestLog", "Sampled %d", i );
+		Test( pCounter->m_Count == 10 );
+		Log::ClearRateLimits();
+		Test( Log::GetRateLimit( "TestLog" ).m_Rate == Log::RateLimit().m_Rate );
+
+		// async, each thread's records stay in order and every record is either delivered or counted
+		pCounter->SetLogLevel( LL_DEBUG_LOW );
+		AsyncTest( pCounter, 16, Log::OVERFLOW_DROP );
+		AsyncTest( pCounter, 16, Log::OVERFLOW_SAMPLE );
+		unsigned int lost = AsyncTest( pCounter, 16, Log::OVERFLOW_BLOCK );
+		Test( lost == 0 );
+
+		Log::RemoveReactor( pCounter );
+
+		// the file reactor rotates and compresses while running, and writes everything before it's destroyed
+		FileRotation();
+
+		std::vector<LogLevel>::iterator iLevel = levels.begin();
+		for( Log::ReactorList::iterator iReactor = reactors.begin(); iReactor != reactors.end(); ++iReactor )
+			(*iReactor)->SetLogLevel( *iLevel++ );
+		Test( Log::IsEnabled( levels.size() > 0 ? levels.front() : LL_CRITICAL ) );
+
+		Log::Status( "TestLog", "%d filtered DebugLow() calls: %.1f ns each", BENCH_COUNT, (fFiltered * 1000000000.0) / BENCH_COUNT );
+		for( size_t i=0;i<m_Results.size();++i)
+			Log::Status( "TestLog", "%s", m_Results[i].c_str() );
+	}
+
+	void Storm( int a_Request )
+	{
+		LOG_LIMITED( LL_WARNING, "TestLog", "Request %d failed", a_Request );
+	}
+
+	void FileRotation()
+	{
+		const char * LOG_FILE = "TestLog.log";
+		FileReactor * pReactor = new FileReactor( LOG_FILE, LL_DEBUG_LOW, 3 );
+		pReactor->SetMaxSize( 4096 );
+		pReactor->SetCompress( true );
+		pReactor->SetFlushInterval( 10 );
+		pReactor->SetSyncPolicy( FileReactor::SYNC_INTERVAL, 0.1 );
+
+		LogRecord rec;
+		rec.m_Level = LL_STATUS;
+		rec.m_Time = "00:00:00";
+		rec.m_TimeEpoch = 0;
+		rec.m_SubSystem = "TestLog";
+		rec.m_Message = std::string( 100, 'x' );
+		for(int i=0;i<100;++i)
+		{
+			pReactor->Process( rec );
+			if ( (i % 10) == 9 )
+				boost::this_thread::sleep( boost::posix_time::milliseconds( 20 ) );
+		}
+		pReactor->Process( rec );
+		int nRotations = (int)pReactor->GetRotations();
+		delete pReactor;
+
+		// 101 lines of about 130 bytes, so 3 rotations of 4 KB and the rest in the current file
+		Test( nRotations >= 2 );
+		Test( boost::filesystem::exists( LOG_FILE ) );
+		Test( boost::filesystem::file_size( LOG_FILE ) > 0 );
+		Test( boost::filesystem::exists( StringUtil::Format( "%s.0.gz", LOG_FILE ) ) );
+		Test( boost::filesystem::exists( StringUtil::Format( "%s.1.gz", LOG_FILE ) ) );
+		Test(! boost::filesystem::exists( StringUtil::Format( "%s.0", LOG_FILE ) ) );
+		Test(! boost::filesystem::exists( StringUtil::Format( "%s.2.gz", LOG_FILE ) ) );
+		Test(! boost::filesystem::exists( StringUtil::Format( "%s.3.gz", LOG_FILE ) ) );
+
+		for(int i=0;i<3;++i)
+			boost::filesystem::remove( StringUtil::Format( "%s.%d.gz", LOG_FILE, i ) );
+		boost::filesystem::remove( LOG_FILE );
+	}
+
+	unsigned int AsyncTest( CountReactor * a_pCounter, size_t a_BufferSize, Log::OverflowPolicy a_Policy )
+	{
+		a_pCounter->m_Count = 0;
+		a_pCounter->m_bOrdered = true;
+		for(int i=0;i<ASYNC_THREADS;++i)
+			a_pCounter->m_Last[i] = -1;
+		unsigned int dropped = Log::GetDroppedRecords();
+		unsigned int sampled = Log::GetSampledRecords();
+
+		Log::StartAsync( a_BufferSize, a_Policy, 4 );
+		Test( Log::IsAsync() );
+		double startTime = Time::GetMonotonicTime();
+		boost::thread_group threads;
+		for(int i=0;i<ASYNC_THREADS;++i)
+			threads.create_thread( boost::bind( &TestLog::AsyncLogger, this, i ) );
+		threads.join_all();
+		double elapsed = Time::GetMonotonicTime() - startTime;
+		Log::StopAsync();
+		Test(! Log::IsAsync() );
+
+		dropped = Log::GetDroppedRecords() - dropped;
+		sampled = Log::GetSampledRecords() - sampled;
+		Test( a_pCounter->m_bOrdered );
+		Test( a_pCounter->m_Count + (int)dropped + (int)sampled == ASYNC_THREADS * ASYNC_RECORDS );
+		if ( a_Policy != Log::OVERFLOW_SAMPLE )
+			Test( sampled == 0 );
+
+		// the console is raised to errors during the test, so the results are logged at the end
+		m_Results.push_back( StringUtil::Format( "Async policy %d: %d threads logged %d records in %.3f seconds, %u dropped, %u sampled out",
+			a_Policy, ASYNC_THREADS, ASYNC_THREADS * ASYNC_RECORDS, elapsed, dropped, sampled ) );
+		return dropped + sampled;
+	}
+
+	void AsyncLogger( int a_Thread )
+	{
+		for(int i=0;i<ASYNC_RECORDS;++i)
+			Log::DebugLow( "TestLog", "Async %d %d", a_Thread, i );
+	}
+
+	int Evaluate()
+	{
+		return ++m_Evaluated;
+	}
+
+	static const int BENCH_COUNT = 1000000;
+
+	int m_Evaluated;
+	std::vector<std::string> m_Results;
+};
+
+TestLog TEST_LOG;
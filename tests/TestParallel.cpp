@@ -0,0 +1,124 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include <functional>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "UnitTest.h"
+#include "utils/Log.h"
+#include "utils/StringUtil.h"
+#include "utils/ThreadPool.h"
+#include "utils/Time.h"
+
+class TestParallel : UnitTest
+{
+public:
+	//! Construction
+	TestParallel() : UnitTest("TestParallel")
+	{}
+
+	virtual void RunTest()
+	{
+		ThreadPool pool( 4 );
+
+		// every index is visited exactly once
+		m_Output.assign( FOR_COUNT, 0 );
+		pool.ParallelFor( 0, FOR_COUNT, 64, DELEGATE(TestParallel, Fill, ThreadPool::Range &, this) );
+		bool bMatch = true;
+		for(int i=0;i<FOR_COUNT;++i)
+			bMatch &= m_Output[i] == (i * 2) + 1;
+		Test( bMatch );
+
+		// empty and single range loops run inline
+		m_Output[0] = m_Output[10] = 0;
+		pool.ParallelFor( 10, 10, 1, DELEGATE(TestParallel, Fill, ThreadPool::Range &, this) );
+		pool.ParallelFor( 0, 10, 100, DELEGATE(TestParallel, Fill, ThreadPool::Range &, this) );
+		Test( m_Output[0] == 1 && m_Output[10] == 0 );
+
+		double sum = pool.ParallelReduce<double>( 0, REDUCE_COUNT, 256, 0.0,
+			DELEGATE(TestParallel, Sum, ThreadPool::ReduceRange<double> &, this), std::plus<double>() );
+		Test( sum == ((double)REDUCE_COUNT * (REDUCE_COUNT - 1)) / 2.0 );
+
+		// the join is not commutative, the results must still come back in index order
+		std::string text = pool.ParallelReduce<std::string>( 0, 1000, 7, std::string(),
+			DELEGATE(TestParallel, Text, ThreadPool::ReduceRange<std::string> &, this), std::plus<std::string>() );
+		std::string expected;
+		for(int i=0;i<1000;++i)
+			expected += (char)('a' + (i % 26));
+		Test( text == expected );
+
+		// benchmark against a serial loop with a growing number of threads, the calling thread
+		// always takes part so N cores is N - 1 pool threads.
+		double startTime = Time().GetEpochTime();
+		ThreadPool::ReduceRange<double> serial( 0.0 );
+		serial.m_End = BENCH_COUNT;
+		Work( serial );
+		double serialTime = Time().GetEpochTime() - startTime;
+		Log::Status( "TestParallel", "Serial: %.3f seconds", serialTime );
+
+		int nCores = (int)tthread::thread::hardware_concurrency();
+		if ( nCores < 2 )
+			nCores = 2;
+		for(int nThreads=1;nThreads<nCores;++nThreads)
+		{
+			ThreadPool bench( nThreads, StringUtil::Format( "parallel-bench-%d", nThreads ) );
+
+			startTime = Time().GetEpochTime();
+			double result = bench.ParallelReduce<double>( 0, BENCH_COUNT, 1024, 0.0,
+				DELEGATE(TestParallel, Work, ThreadPool::ReduceRange<double> &, this), std::plus<double>() );
+			double parallelTime = Time().GetEpochTime() - startTime;
+			Log::Status( "TestParallel", "%d cores: %.3f seconds, speedup %.2fx",
+				nThreads + 1, parallelTime, serialTime / parallelTime );
+			Test( fabs( result - serial.m_Result ) <= fabs( serial.m_Result ) * 1e-9 );
+		}
+	}
+
+	void Fill( ThreadPool::Range & a_Range )
+	{
+		for(size_t i=a_Range.m_Begin;i<a_Range.m_End;++i)
+			m_Output[i] = (int)(i * 2) + 1;
+	}
+
+	void Sum( ThreadPool::ReduceRange<double> & a_Range )
+	{
+		for(size_t i=a_Range.m_Begin;i<a_Range.m_End;++i)
+			a_Range.m_Result += (double)i;
+	}
+
+	void Text( ThreadPool::ReduceRange<std::string> & a_Range )
+	{
+		for(size_t i=a_Range.m_Begin;i<a_Range.m_End;++i)
+			a_Range.m_Result += (char)('a' + (i % 26));
+	}
+
+	void Work( ThreadPool::ReduceRange<double> & a_Range )
+	{
+		for(size_t i=a_Range.m_Begin;i<a_Range.m_End;++i)
+			a_Range.m_Result += sqrt( (double)i ) * sin( (double)i );
+	}
+
+	static const int FOR_COUNT = 100000;
+	static const int REDUCE_COUNT = 1000000;
+	static const int BENCH_COUNT = 4000000;
+
+	std::vector<int> m_Output;
+};
+
+TestParallel TEST_PARALLEL;
@@ -16,21 +16,34 @@
 */
 
 
+#include "boost/atomic.hpp"
+#include <vector>
+
 #include "UnitTest.h"
 #include "utils/Log.h"
 #include "utils/ThreadPool.h"
 #include "utils/Time.h"
+#include "utils/WatsonException.h"
 
 class TestThreadPool : UnitTest
 {
 public:
 	//! Construction
-	TestThreadPool() : UnitTest("TestThreadPool")
+	TestThreadPool() : UnitTest("TestThreadPool"), m_Completed( 0 ), m_Blocked( 0 ), m_bRelease( false ), m_pExecutor( NULL ),
+		m_pBusyStrand( NULL ), m_BusyCount( 0 ), m_bOtherRan( false ), m_bStopBusy( false )
 	{}
 
 	virtual void RunTest()
 	{
+		// the default pool keeps a fixed number of threads..
 		m_Pool = new ThreadPool();
+		Test( m_Pool->GetMinThreads() == 20 && m_Pool->GetMaxThreads() == 20 );
+		delete m_Pool;
+
+		m_Pool = new ThreadPool( 4 );
+		m_Pool->SetMaxThreads( 20 );
+		Test( m_Pool->GetThreadCount() == 4 );
+		Test( m_Pool->GetMinThreads() == 4 && m_Pool->GetMaxThreads() == 20 );
 
 		int index = 0;
 		double startTime = Time().GetEpochTime();
@@ -40,10 +53,362 @@ public:
 			m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, ThreadInvoke, int, this), index++ );
 		}
 
+		// queue a batch of tasks that each queue a child task from the worker thread, this exercises
+		// both the local deque and stealing from the other workers.
+		const int TASK_COUNT = 10000;
+		m_Completed = 0;
+		for(int i=0;i<TASK_COUNT;++i)
+			m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, SpawnChild, int, this), i );
+
+		startTime = Time().GetEpochTime();
+		while( m_Completed < (TASK_COUNT * 2) && (Time().GetEpochTime() - startTime) < 30.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Log::Debug( "TestThreadPool", "Completed %d tasks in %g seconds.", m_Completed.load(), Time().GetEpochTime() - startTime );
+		Test( m_Completed == (TASK_COUNT * 2) );
+		Test( m_Pool->GetPendingTasks() == 0 );
+
+		// tasks queued from outside the pool run in the order they were queued, even while the worker is busy..
+		{
+			ThreadPool fifo( 1, "test-fifo" );
+			m_bRelease = false;
+			m_FifoOrder.clear();
+			fifo.InvokeOnThread<int>( DELEGATE(TestThreadPool, GateInvoke, int, this), -1 );
+			for(int i=0;i<FIFO_INVOKES;++i)
+				fifo.InvokeOnThread<int>( DELEGATE(TestThreadPool, RecordFifo, int, this), i );
+			m_bRelease = true;
+
+			startTime = Time().GetEpochTime();
+			while( fifo.GetPendingTasks() > 0 && (Time().GetEpochTime() - startTime) < 10.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		}
+		Test( m_FifoOrder.size() == (size_t)(FIFO_INVOKES + 1) );
+		for(size_t i=0;i<m_FifoOrder.size();++i)
+			Test( m_FifoOrder[i] == (int)i - 1 );
+
+		// many threads pushing onto the main queue at once, RunMainThread() should process all of them and exit
+		// once the last one calls StopMainThread().
+		m_MainCount = 0;
+		for(int i=0;i<MAIN_PRODUCERS;++i)
+			m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, ProduceMain, int, this), i );
+		Test( m_Pool->RunMainThread() == 0 );
+		Test( m_MainCount == (MAIN_PRODUCERS * MAIN_INVOKES) );
+		Test( m_Pool->GetPendingMain() == 0 );
+
+		// a limited ProcessMainThread() leaves the rest of the backlog for the next call
+		m_MainCount = 0;
+		for(int i=0;i<MAIN_INVOKES;++i)
+			m_Pool->InvokeOnMain<int>( DELEGATE(TestThreadPool, CountMain, int, this), i );
+		tthread::this_thread::sleep_for(tthread::chrono::milliseconds(20));
+		Test( m_Pool->ProcessMainThread( 0.0, 100 ) == (MAIN_INVOKES - 100) );
+		Test( m_MainCount == 100 );
+		Test( m_Pool->GetMainBacklogAge() >= 0.01 );
+		Test( m_Pool->ProcessMainThread( 0.0, 0 ) == 0 );
+		Test( m_MainCount == MAIN_INVOKES );
+		Test( m_Pool->GetMainBacklogAge() == 0.0 );
+
+		m_MainCount = 0;
+		m_Pool->ResetMainCallsites();
+		for(int i=0;i<SLOW_MAIN;++i)
+			m_Pool->InvokeOnMain<int>( DELEGATE(TestThreadPool, SlowMain, int, this), i );
+		int nRemaining = m_Pool->ProcessMainThread( 0.02 );
+		Log::Status( "TestThreadPool", "Processed %d slow invokes in 20 ms, %d remaining", m_MainCount, nRemaining );
+		Test( nRemaining > 0 && nRemaining < SLOW_MAIN );
+		Test( m_MainCount + nRemaining == SLOW_MAIN );
+		m_Pool->ProcessMainThread();
+		Test( m_MainCount == SLOW_MAIN );
+#if ENABLE_DELEGATE_DEBUG
+		ThreadPool::CallsiteList callsites;
+		m_Pool->GetMainCallsites( callsites );
+		Test( callsites.size() == 1 && callsites[0].m_nCount == SLOW_MAIN );
+#endif
+
+		// queue the background lane first, the high lane should still be served first and the lower lanes 
+		// should get a turn before the high lane is empty.
+		m_LaneOrder.clear();
+		for(int i=ThreadPool::PRIORITY_COUNT - 1;i>=0;--i)
+			for(int k=0;k<LANE_INVOKES;++k)
+				m_Pool->InvokeOnMain<int>( DELEGATE(TestThreadPool, RecordLane, int, this), i, (ThreadPool::Priority)i );
+		for(int i=0;i<ThreadPool::PRIORITY_COUNT;++i)
+			Test( m_Pool->GetPendingMain( (ThreadPool::Priority)i ) == LANE_INVOKES );
+		m_Pool->ProcessMainThread();
+		Test( m_Pool->GetPendingMain() == 0 );
+		Test( m_LaneOrder.size() == (size_t)(LANE_INVOKES * ThreadPool::PRIORITY_COUNT) );
+		Test( m_LaneOrder.size() > 0 && m_LaneOrder[0] == ThreadPool::PRIORITY_HIGH );
+
+		size_t nFirstBackground = m_LaneOrder.size();
+		double fLaneSum[ ThreadPool::PRIORITY_COUNT ] = { 0 };
+		for(size_t i=0;i<m_LaneOrder.size();++i)
+		{
+			if ( m_LaneOrder[i] == ThreadPool::PRIORITY_BACKGROUND && i < nFirstBackground )
+				nFirstBackground = i;
+			fLaneSum[ m_LaneOrder[i] ] += i;
+		}
+		Test( nFirstBackground < (size_t)LANE_INVOKES );
+		Test( fLaneSum[ThreadPool::PRIORITY_HIGH] < fLaneSum[ThreadPool::PRIORITY_NORMAL] );
+		Test( fLaneSum[ThreadPool::PRIORITY_NORMAL] < fLaneSum[ThreadPool::PRIORITY_BACKGROUND] );
+
+		// benchmark heap allocations per dispatched task, the first round warms up the task slots, the per-thread caches
+		// and grows the pool, the second round should be served entirely from recycled slots. Tasks are queued in 
+		// batches so the number of tasks in flight is the same for both rounds.
+		for(int round=0;round<2;++round)
+		{
+			SlabAllocator * pSlab = ThreadPool::GetTaskSlab();
+			unsigned int nAllocs = pSlab->GetHeapAllocations() + ThreadPool::GetHeapCallbacks();
+
+			m_Completed = 0;
+			startTime = Time().GetEpochTime();
+			for(int i=0;i<BENCH_TASKS;i += BENCH_BATCH)
+			{
+				for(int k=0;k<BENCH_BATCH;++k)
+					m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, ChildInvoke, int, this), i + k );
+				while( m_Completed < (i + BENCH_BATCH) && (Time().GetEpochTime() - startTime) < 30.0 )
+					tthread::this_thread::yield();
+			}
+			double elapsed = Time().GetEpochTime() - startTime;
+
+			nAllocs = (pSlab->GetHeapAllocations() + ThreadPool::GetHeapCallbacks()) - nAllocs;
+			double fPerTask = (double)nAllocs / BENCH_TASKS;
+			Log::Status( "TestThreadPool", "Round %d: %d tasks in %g seconds, %u heap allocations, %g allocations per task, %u slabs.", 
+				round, BENCH_TASKS, elapsed, nAllocs, fPerTask, pSlab->GetSlabCount() );
+			Test( m_Completed == BENCH_TASKS );
+			if ( round > 0 )
+				Test( fPerTask < 0.001 );
+		}
+		Test( ThreadPool::GetHeapCallbacks() == 0 );
+
+		// a backlog of slow tasks should grow the pool up to the maximum, then shrink back down once idle..
+		m_Pool->SetIdleTimeout( 0.5 );
+		m_Completed = 0;
+		int nMaxThreads = 0;
+		for(int i=0;i<SLOW_TASKS;++i)
+			m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, SlowInvoke, int, this), i );
+		startTime = Time().GetEpochTime();
+		while( m_Completed < SLOW_TASKS && (Time().GetEpochTime() - startTime) < 30.0 )
+		{
+			if ( m_Pool->GetThreadCount() > nMaxThreads )
+				nMaxThreads = m_Pool->GetThreadCount();
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(1));
+		}
+		Log::Status( "TestThreadPool", "Pool grew to %d threads for %d slow tasks.", nMaxThreads, SLOW_TASKS );
+		Test( m_Completed == SLOW_TASKS );
+		Test( nMaxThreads > m_Pool->GetMinThreads() && nMaxThreads <= m_Pool->GetMaxThreads() );
+
+		startTime = Time().GetEpochTime();
+		while( m_Pool->GetThreadCount() > m_Pool->GetMinThreads() && (Time().GetEpochTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Test( m_Pool->GetThreadCount() == m_Pool->GetMinThreads() );
+
+		// block more threads than the maximum, the pool should start threads in their place so other work still runs..
+		m_bRelease = false;
+		m_Blocked = 0;
+		int nBlocking = m_Pool->GetMaxThreads() + 2;
+		for(int i=0;i<nBlocking;++i)
+			m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, BlockingInvoke, int, this), i );
+		startTime = Time().GetEpochTime();
+		while( m_Blocked < nBlocking && (Time().GetEpochTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Test( m_Blocked == nBlocking );
+		Test( m_Pool->GetBlockedThreads() == nBlocking );
+
+		m_Completed = 0;
+		m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, ChildInvoke, int, this), 0 );
+		startTime = Time().GetEpochTime();
+		while( m_Completed == 0 && (Time().GetEpochTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Test( m_Completed == 1 );
+
+		m_bRelease = true;
+		startTime = Time().GetEpochTime();
+		while( m_Pool->GetBlockedThreads() > 0 && (Time().GetEpochTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Test( m_Pool->GetBlockedThreads() == 0 );
+
+		// named executors run their own threads, but invokes on main still go to the default pool..
+		ThreadPool * pExecutor = new ThreadPool( 1, "test-executor" );
+		pExecutor->SetMaxThreads( 2 );
+		Test( ThreadPool::Instance() == m_Pool );
+		Test( ThreadPool::Find( "test-executor" ) == pExecutor );
+		Test( ThreadPool::Executor( "test-executor" ) == pExecutor );
+		Test( ThreadPool::Executor( "no-such-executor" ) == m_Pool );
+
+		bool bThrown = false;
+		try {
+			ThreadPool duplicate( 1, "test-executor" );
+		}
+		catch( const WatsonException & )
+		{
+			bThrown = true;
+		}
+		Test( bThrown );
+
+		m_Completed = 0;
+		m_MainCount = 0;
+		m_pExecutor = pExecutor;
+		pExecutor->InvokeOnThread<int>( DELEGATE(TestThreadPool, ExecutorInvoke, int, this), 0 );
+		startTime = Time().GetEpochTime();
+		while( m_MainCount == 0 && (Time().GetEpochTime() - startTime) < 10.0 )
+		{
+			m_Pool->ProcessMainThread();
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		}
+		Test( m_Completed == 1 );
+		Test( m_MainCount == 1 );
+		Test( pExecutor->GetPendingMain() == 0 );
+
+		delete pExecutor;
+		m_pExecutor = NULL;
+		Test( ThreadPool::Find( "test-executor" ) == NULL );
+
+		// tasks on a strand run one at a time and in order, different strands run in parallel
+		m_Completed = 0;
+		m_StrandErrors = 0;
+		for(int i=0;i<STRAND_TESTS;++i)
+		{
+			m_StrandNext[i] = 0;
+			m_StrandActive[i] = 0;
+		}
+		{
+			ThreadPool::Strand strands[ STRAND_TESTS ];
+			for(int k=0;k<STRAND_INVOKES;++k)
+				for(int i=0;i<STRAND_TESTS;++i)
+					strands[i].Invoke<int>( DELEGATE(TestThreadPool, StrandInvoke, int, this), (i * STRAND_INVOKES) + k );
+
+			startTime = Time().GetEpochTime();
+			while( m_Completed < (STRAND_TESTS * STRAND_INVOKES) && (Time().GetEpochTime() - startTime) < 30.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+			Test( m_Completed == (STRAND_TESTS * STRAND_INVOKES) );
+			for(int i=0;i<STRAND_TESTS;++i)
+				Test( strands[i].GetPending() == 0 );
+		}
+		Test( m_StrandErrors == 0 );
+		Test( &m_Pool->GetStrand( this ) == &m_Pool->GetStrand( this ) );
+
+		// a strand that never runs out of work still gives the only thread of a pool to other tasks
+		ThreadPool * pSingle = new ThreadPool( 1, "test-strand" );
+		{
+			ThreadPool::Strand strand( pSingle );
+			m_pBusyStrand = &strand;
+			m_BusyCount = 0;
+			m_bOtherRan = false;
+			m_bStopBusy = false;
+			strand.Invoke<int>( DELEGATE(TestThreadPool, BusyStrandInvoke, int, this), 0 );
+			startTime = Time().GetEpochTime();
+			while( m_BusyCount < STRAND_BATCHES * ThreadPool::STRAND_BATCH && (Time().GetEpochTime() - startTime) < 10.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(1));
+
+			pSingle->InvokeOnThread<int>( DELEGATE(TestThreadPool, OtherInvoke, int, this), 0 );
+			startTime = Time().GetEpochTime();
+			while(! m_bOtherRan && (Time().GetEpochTime() - startTime) < 10.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+			Test( m_bOtherRan );
+
+			m_bStopBusy = true;
+			while( strand.GetPending() > 0 && (Time().GetEpochTime() - startTime) < 20.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+			Test( strand.GetPending() == 0 );
+		}
+		m_pBusyStrand = NULL;
+		delete pSingle;
+
 		delete m_Pool;
 		m_Pool = NULL;
 	}
 
+	void SpawnChild( int v )
+	{
+		m_Pool->InvokeOnThread<int>( DELEGATE(TestThreadPool, ChildInvoke, int, this), v );
+		m_Completed += 1;
+	}
+
+	void ChildInvoke( int )
+	{
+		m_Completed += 1;
+	}
+
+	void ProduceMain( int )
+	{
+		for(int i=0;i<MAIN_INVOKES;++i)
+			m_Pool->InvokeOnMain<int>( DELEGATE(TestThreadPool, CountMain, int, this), i );
+	}
+
+	void SlowMain( int )
+	{
+		tthread::this_thread::sleep_for(tthread::chrono::milliseconds(2));
+		m_MainCount += 1;
+	}
+
+	void CountMain( int )
+	{
+		m_MainCount += 1;
+		if ( m_MainCount == (MAIN_PRODUCERS * MAIN_INVOKES) )
+			m_Pool->StopMainThread( 0 );
+	}
+
+	void SlowInvoke( int )
+	{
+		tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		m_Completed += 1;
+	}
+
+	void BlockingInvoke( int )
+	{
+		ThreadPool::BlockingSection blocking;
+		m_Blocked += 1;
+		while(! m_bRelease )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		m_Blocked -= 1;
+	}
+
+	void ExecutorInvoke( int v )
+	{
+		// the worker should belong to the executor, not the default pool..
+		ThreadPool::BlockingSection blocking;
+		if ( m_pExecutor->GetBlockedThreads() == 1 && m_Pool->GetBlockedThreads() == 0 )
+			m_Completed += 1;
+		m_pExecutor->InvokeOnMain<int>( DELEGATE(TestThreadPool, CountMain, int, this), v );
+	}
+
+	void StrandInvoke( int v )
+	{
+		int nStrand = v / STRAND_INVOKES;
+		if ( m_StrandActive[nStrand]++ != 0 )
+			m_StrandErrors += 1;
+		if ( m_StrandNext[nStrand] != (v % STRAND_INVOKES) )
+			m_StrandErrors += 1;
+		m_StrandNext[nStrand] = (v % STRAND_INVOKES) + 1;
+		m_StrandActive[nStrand] -= 1;
+		m_Completed += 1;
+	}
+
+	void BusyStrandInvoke( int v )
+	{
+		m_BusyCount += 1;
+		if (! m_bStopBusy )
+			m_pBusyStrand->Invoke<int>( DELEGATE(TestThreadPool, BusyStrandInvoke, int, this), v );
+	}
+
+	void OtherInvoke( int )
+	{
+		m_bOtherRan = true;
+	}
+
+	void GateInvoke( int v )
+	{
+		while(! m_bRelease )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(1));
+		m_FifoOrder.push_back( v );
+	}
+
+	void RecordFifo( int v )
+	{
+		m_FifoOrder.push_back( v );
+	}
+
+	void RecordLane( int v )
+	{
+		m_LaneOrder.push_back( v );
+	}
+
 	void ThreadInvoke(int v )
 	{
 		Log::Debug( "TestThreadPool", "Thread arg = %d", v );
@@ -55,7 +420,33 @@ public:
 		Log::Debug( "TestThreadPool", "Main arg = %d", v );
 	}
 
+	static const int MAIN_PRODUCERS = 16;
+	static const int MAIN_INVOKES = 1000;
+	static const int BENCH_TASKS = 100000;
+	static const int BENCH_BATCH = 1000;
+	static const int LANE_INVOKES = 100;
+	static const int FIFO_INVOKES = 100;
+	static const int SLOW_TASKS = 500;
+	static const int SLOW_MAIN = 50;
+	static const int STRAND_TESTS = 8;
+	static const int STRAND_INVOKES = 1000;
+	static const int STRAND_BATCHES = 4;
+
 	ThreadPool * m_Pool;
+	boost::atomic<int> m_Completed;
+	int m_MainCount;
+	std::vector<int> m_LaneOrder;
+	std::vector<int> m_FifoOrder;
+	boost::atomic<int> m_Blocked;
+	volatile bool m_bRelease;
+	ThreadPool * m_pExecutor;
+	boost::atomic<int> m_StrandErrors;
+	boost::atomic<int> m_StrandActive[ STRAND_TESTS ];
+	int m_StrandNext[ STRAND_TESTS ];
+	ThreadPool::Strand * m_pBusyStrand;
+	boost::atomic<int> m_BusyCount;
+	volatile bool m_bOtherRan;
+	volatile bool m_bStopBusy;
 };
 
 TestThreadPool TEST_THREADPOOL;
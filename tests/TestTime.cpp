@@ -0,0 +1,89 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include "UnitTest.h"
+#include "utils/Log.h"
+#include "utils/Time.h"
+
+class TestTime : UnitTest
+{
+public:
+	//! Construction
+	TestTime() : UnitTest("TestTime")
+	{}
+
+	virtual void RunTest()
+	{
+		double resolution = Time::GetCoarseResolution();
+		Test( resolution > 0.0 && resolution < 0.1 );
+
+		// the coarse clocks are never ahead of the precise clocks, how far they lag depends on the kernel so
+		// that is only checked against a generous bound
+		double precise = Time::GetMonotonicTime();
+		double coarse = Time::GetCoarseMonotonicTime();
+		Test( coarse <= Time::GetMonotonicTime() );
+		Test( coarse >= precise - 0.1 );
+
+		double epoch = Time().GetEpochTime();
+		double coarseEpoch = Time::GetCoarseTime().GetEpochTime();
+		Test( coarseEpoch >= epoch - 0.1 && coarseEpoch <= Time().GetEpochTime() + 0.001 );
+
+		boost::uint64_t last = Time::GetCoarseMonotonicMicroseconds();
+		bool bMonotonic = true;
+		for(int i=0;i<BENCH_COUNT;++i)
+		{
+			boost::uint64_t now = Time::GetCoarseMonotonicMicroseconds();
+			bMonotonic &= now >= last;
+			last = now;
+		}
+		Test( bMonotonic );
+
+		// cost of each clock, volatile so the calls are not optimized away
+		volatile double sink = 0.0;
+		double startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			sink = Time().GetEpochTime();
+		double fTime = Time::GetMonotonicTime() - startTime;
+
+		startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			sink = Time::GetCoarseTime().GetEpochTime();
+		double fCoarseTime = Time::GetMonotonicTime() - startTime;
+
+		startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			sink = Time::GetMonotonicTime();
+		double fMonotonic = Time::GetMonotonicTime() - startTime;
+
+		startTime = Time::GetMonotonicTime();
+		for(int i=0;i<BENCH_COUNT;++i)
+			sink = Time::GetCoarseMonotonicTime();
+		double fCoarseMonotonic = Time::GetMonotonicTime() - startTime;
+		Test( sink > 0.0 );
+
+		Log::Status( "TestTime", "%d calls: Time() %.1f ns, GetCoarseTime() %.1f ns, GetMonotonicTime() %.1f ns, "
+			"GetCoarseMonotonicTime() %.1f ns, coarse resolution %.3f ms", BENCH_COUNT,
+			(fTime * 1000000000.0) / BENCH_COUNT, (fCoarseTime * 1000000000.0) / BENCH_COUNT,
+			(fMonotonic * 1000000000.0) / BENCH_COUNT, (fCoarseMonotonic * 1000000000.0) / BENCH_COUNT, 
+			resolution * 1000.0 );
+	}
+
+	static const int BENCH_COUNT = 1000000;
+};
+
+TestTime TEST_TIME;
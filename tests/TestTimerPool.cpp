@@ -21,7 +21,11 @@
 #include "utils/TimerPool.h"
 #include "utils/Time.h"
 
+#include "boost/atomic.hpp"
 #include "boost/thread.hpp"
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
 
 class TestTimerPool : UnitTest
 {
@@ -51,10 +55,245 @@ public:
 			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
 		}
 
-		delete m_ThreadPool;
 		delete m_TimerPool;
+		m_TimerPool = NULL;
+
+		// starting and abandoning many timeouts, like IService::Request does
+		double fMultiSet = StartStop( TimerPool::QUEUE_MULTISET, MULTISET_TIMERS );
+		double fWheel = StartStop( TimerPool::QUEUE_WHEEL, WHEEL_TIMERS );
+		Log::Status( "TestTimerPool", "Start/stop of %d timers: multiset %.3f seconds, %d timers: wheel %.3f seconds",
+			MULTISET_TIMERS, fMultiSet, WHEEL_TIMERS, fWheel );
+
+		// the wheel fires each timer once, never early, including timers that cascade down from the higher levels
+		m_TimerPool = new TimerPool( TimerPool::QUEUE_WHEEL );
+		Test( m_TimerPool->GetQueueType() == TimerPool::QUEUE_WHEEL );
+		std::vector<TimerPool::ITimer::SP> timers;
+		double startTime = Time::GetMonotonicTime();
+		for(int i=0;i<WHEEL_TESTS;++i)
+		{
+			m_Fired[i] = 0.0;
+			timers.push_back( m_TimerPool->StartTimer<int>( DELEGATE( TestTimerPool, RecordFire, int, this ), i, WHEEL_INTERVALS[i], false, false ) );
+		}
+		TimerPool::ITimer::SP spStopped = m_TimerPool->StartTimer<int>( DELEGATE( TestTimerPool, RecordFire, int, this ), WHEEL_TESTS, 0.1, false, false );
+		m_Fired[WHEEL_TESTS] = 0.0;
+		Test( m_TimerPool->StopTimer( spStopped ) );
+		Test(! m_TimerPool->StopTimer( spStopped ) );
+
+		m_RecurringCounts = 0;
+		TimerPool::ITimer::SP spRecurring = m_TimerPool->StartTimer<int>( DELEGATE( TestTimerPool, ThreadInvoke, int, this), 0, 0.05, false, true );
+		while( m_Fired[WHEEL_TESTS - 1] == 0.0 && (Time::GetMonotonicTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+
+		for(int i=0;i<WHEEL_TESTS;++i)
+		{
+			double fDelay = m_Fired[i] - startTime;
+			Log::Status( "TestTimerPool", "Wheel timer %.3f fired after %.3f seconds", WHEEL_INTERVALS[i], fDelay );
+			Test( fDelay >= WHEEL_INTERVALS[i] && fDelay < WHEEL_INTERVALS[i] + 0.5 );
+		}
+		Test( m_Fired[WHEEL_TESTS] == 0.0 );
+		Test( m_RecurringCounts >= 20 );
+		Test( m_TimerPool->StopTimer( spRecurring ) );
+		Test( m_TimerPool->GetPendingTimers() == 0 );
+
+		delete m_TimerPool;
+		m_TimerPool = NULL;
+
+		// timers with slack share wake ups and are dispatched to the pool together
+		Test( TimerPool::AlignToSlack( 10.1, 0.0 ) == 10.1 );
+		Test( TimerPool::AlignToSlack( 10.1, 0.25 ) == 10.25 );
+		Test( TimerPool::AlignToSlack( 10.3, 0.3 ) == 10.5 );
+		Test( TimerPool::AlignToSlack( 10.0, 0.25 ) == 10.0 );
+
+		unsigned int nDispatches[2];
+		for(int k=0;k<2;++k)
+		{
+			m_TimerPool = new TimerPool( TimerPool::QUEUE_WHEEL );
+			m_Coalesced = 0;
+			std::vector<TimerPool::ITimer::SP> slackTimers;
+			for(int i=0;i<COALESCE_TIMERS;++i)
+			{
+				slackTimers.push_back( m_TimerPool->StartTimer( VOID_DELEGATE( TestTimerPool, CountCoalesced, this ), 
+					0.2 + (0.5 * i) / COALESCE_TIMERS, false, false, NULL, k == 0 ? 0.0 : TimerPool::TIMEOUT_SLACK ) );
+			}
+			startTime = Time::GetMonotonicTime();
+			while( m_Coalesced < COALESCE_TIMERS && (Time::GetMonotonicTime() - startTime) < 10.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+			Test( m_Coalesced == COALESCE_TIMERS );
+			nDispatches[k] = m_TimerPool->GetDispatches();
+			Log::Status( "TestTimerPool", "%d timeouts with %.2f slack: %u wake ups, %u dispatches", COALESCE_TIMERS,
+				k == 0 ? 0.0 : TimerPool::TIMEOUT_SLACK, m_TimerPool->GetWakeups(), nDispatches[k] );
+
+			delete m_TimerPool;
+			m_TimerPool = NULL;
+		}
+		Test( nDispatches[0] == COALESCE_TIMERS );
+		Test( nDispatches[1] <= 8 );
+
+		// inline timers run on the timer thread, no task is queued for them
+		m_TimerPool = new TimerPool( TimerPool::QUEUE_WHEEL );
+		m_InlineCount = 0;
+		m_InlineThread = tthread::thread::id();
+		TimerPool::ITimer::SP spInline = m_TimerPool->StartInlineTimer( VOID_DELEGATE( TestTimerPool, InlineInvoke, this ), 0.01, true );
+		startTime = Time::GetMonotonicTime();
+		while( m_InlineCount < 20 && (Time::GetMonotonicTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Test( m_TimerPool->StopTimer( spInline ) );
+		Test( m_InlineCount >= 20 );
+		Test( m_InlineThread != tthread::thread::id() && m_InlineThread != tthread::this_thread::get_id() );
+		Test( m_TimerPool->GetDispatches() == 0 );
+		Test( m_TimerPool->GetInlineOverruns() == 0 );
+
+		// a slow inline callback trips the watchdog
+		m_TimerPool->SetInlineBudget( 0.001 );
+		m_InlineCount = 0;
+		TimerPool::ITimer::SP spSlow = m_TimerPool->StartInlineTimer<int>( DELEGATE( TestTimerPool, SlowInlineInvoke, int, this ), 5, 0.0, false );
+		startTime = Time::GetMonotonicTime();
+		while( m_TimerPool->GetInlineOverruns() < 1 && (Time::GetMonotonicTime() - startTime) < 10.0 )
+			tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+		Test( m_InlineCount == 1 );
+		Test( m_TimerPool->GetInlineOverruns() == 1 );
+
+		delete m_TimerPool;
+		m_TimerPool = NULL;
+
+		// lateness of recurring timers, measured from the ideal schedule to the callback running on a pool thread
+		Lateness( TimerPool::QUEUE_MULTISET, false, 0.01 );
+		Lateness( TimerPool::QUEUE_WHEEL, false, 0.01 );
+		Lateness( TimerPool::QUEUE_MULTISET, true, 0.001 );
+		int nFired = Lateness( TimerPool::QUEUE_WHEEL, true, 0.0005 );
+		Test( nFired >= (int)(BENCH_TIME / 0.0005) / 2 );
+
+		StepClock();
+
+		delete m_ThreadPool;
 		m_ThreadPool = NULL;
+	}
+
+	//! Steps the system clock back while a timer is pending, the timer should still fire on schedule. This steps
+	//! the clock of every process on the machine, so it only runs when TEST_STEP_CLOCK is set in the environment
+	//! and the test has permission to set the clock.
+	void StepClock()
+	{
+#ifndef _WIN32
+		if ( getenv( "TEST_STEP_CLOCK" ) == NULL )
+		{
+			Log::Status( "TestTimerPool", "TEST_STEP_CLOCK isn't set, skipping the clock step test." );
+			return;
+		}
+
+		m_TimerPool = new TimerPool( TimerPool::QUEUE_WHEEL );
+		m_Fired[0] = 0.0;
+		double startTime = Time::GetMonotonicTime();
+		TimerPool::ITimer::SP spTimer = m_TimerPool->StartTimer<int>( DELEGATE( TestTimerPool, RecordFire, int, this ), 0, 0.2, false, false );
+		tthread::this_thread::sleep_for(tthread::chrono::milliseconds(50));
+
+		struct timespec before;
+		clock_gettime( CLOCK_REALTIME, &before );
+		double stepTime = Time::GetMonotonicTime();
+
+		struct timespec ts = before;
+		ts.tv_sec -= CLOCK_STEP;
+		if ( clock_settime( CLOCK_REALTIME, &ts ) == 0 )
+		{
+			while( m_Fired[0] == 0.0 && (Time::GetMonotonicTime() - startTime) < CLOCK_STEP + 5.0 )
+				tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+
+			// put the clock back where it would be now, including the time spent while it was stepped..
+			boost::uint64_t elapsed = (boost::uint64_t)((Time::GetMonotonicTime() - stepTime) * 1000000000.0) + before.tv_nsec;
+			ts.tv_sec = before.tv_sec + (time_t)(elapsed / 1000000000);
+			ts.tv_nsec = (long)(elapsed % 1000000000);
+			clock_settime( CLOCK_REALTIME, &ts );
+
+			double fDelay = m_Fired[0] - startTime;
+			Log::Status( "TestTimerPool", "Timer 0.200 fired after %.3f seconds with the clock stepped back %d seconds", fDelay, CLOCK_STEP );
+			Test( m_Fired[0] > 0.0 && fDelay < 1.0 );
+		}
+		else
+			Log::Status( "TestTimerPool", "Can't set the system clock, skipping the clock step test." );
+
+		m_TimerPool->StopTimer( spTimer );
+		delete m_TimerPool;
+		m_TimerPool = NULL;
+#endif
+	}
+
+	int Lateness( TimerPool::QueueType a_Type, bool a_bHighResolution, double a_Interval )
+	{
+		m_TimerPool = new TimerPool( a_Type, a_bHighResolution );
+		Test( m_TimerPool->IsHighResolution() == a_bHighResolution );
+
+		m_BenchCount = 0;
+		m_BenchLateSum = 0.0;
+		m_BenchLateMax = 0.0;
+		m_BenchInterval = a_Interval;
+		m_BenchStart = Time::GetMonotonicTime();
+		TimerPool::ITimer::SP spTimer = m_TimerPool->StartTimer<int>( DELEGATE( TestTimerPool, MeasureLateness, int, this), 0, a_Interval, false, true );
+
+		tthread::this_thread::sleep_for(tthread::chrono::milliseconds( (int)(BENCH_TIME * 1000) ));
+		m_TimerPool->StopTimer( spTimer );
+		delete m_TimerPool;
+		m_TimerPool = NULL;
+
+		boost::lock_guard<boost::mutex> lock( m_BenchLock );
+		Log::Status( "TestTimerPool", "%s%s %.1f ms timer: %d fired, average lateness %.0f us, max %.0f us",
+			a_Type == TimerPool::QUEUE_WHEEL ? "Wheel" : "Multiset", a_bHighResolution ? " high resolution" : "",
+			a_Interval * 1000.0, m_BenchCount, m_BenchCount > 0 ? (m_BenchLateSum / m_BenchCount) * 1000000.0 : 0.0,
+			m_BenchLateMax * 1000000.0 );
+		return m_BenchCount;
+	}
+
+	void MeasureLateness( int )
+	{
+		double now = Time::GetMonotonicTime();
+
+		boost::lock_guard<boost::mutex> lock( m_BenchLock );
+		m_BenchCount += 1;
+		double late = now - (m_BenchStart + (m_BenchCount * m_BenchInterval));
+		m_BenchLateSum += late;
+		if ( late > m_BenchLateMax )
+			m_BenchLateMax = late;
+	}
+
+	double StartStop( TimerPool::QueueType a_Type, int a_Count )
+	{
+		m_TimerPool = new TimerPool( a_Type );
+
+		std::vector<TimerPool::ITimer::SP> timers;
+		double startTime = Time().GetEpochTime();
+		for(int i=0;i<a_Count;++i)
+			timers.push_back( m_TimerPool->StartTimer<int>( DELEGATE( TestTimerPool, RecordFire, int, this ), 0, 30.0, false, false ) );
+		Test( m_TimerPool->GetPendingTimers() == (size_t)a_Count );
+		// newest first, so the multiset has to walk past every older timer
+		for(int i=a_Count - 1;i>=0;--i)
+			m_TimerPool->StopTimer( timers[i] );
+		double elapsed = Time().GetEpochTime() - startTime;
+		Test( m_TimerPool->GetPendingTimers() == 0 );
+
+		delete m_TimerPool;
 		m_TimerPool = NULL;
+		return elapsed;
+	}
+
+	void InlineInvoke()
+	{
+		m_InlineThread = tthread::this_thread::get_id();
+		m_InlineCount += 1;
+	}
+
+	void SlowInlineInvoke( int a_MS )
+	{
+		boost::this_thread::sleep( boost::posix_time::milliseconds( a_MS ) );
+		m_InlineCount += 1;
+	}
+
+	void CountCoalesced()
+	{
+		m_Coalesced += 1;
+	}
+
+	void RecordFire( int v )
+	{
+		m_Fired[v] = Time::GetMonotonicTime();
 	}
 
 	void ThreadInvoke(int v )
@@ -69,14 +308,35 @@ public:
 		m_MainTimerTested = true;
 	}
 
+	static const int MULTISET_TIMERS = 10000;
+	static const int WHEEL_TIMERS = 100000;
+	static const int WHEEL_TESTS = 6;
+	static const int COALESCE_TIMERS = 2000;
+	static const int CLOCK_STEP = 10;
+	static const double WHEEL_INTERVALS[ WHEEL_TESTS ];
+	static const double BENCH_TIME;
+
 	ThreadPool * m_ThreadPool;
 	TimerPool * m_TimerPool;
+	volatile double m_Fired[ WHEEL_TESTS + 1 ];
+	boost::atomic<int> m_Coalesced;
+	boost::atomic<int> m_InlineCount;
+	tthread::thread::id m_InlineThread;
+	boost::mutex m_BenchLock;
+	double m_BenchStart;
+	double m_BenchInterval;
+	int m_BenchCount;
+	double m_BenchLateSum;
+	double m_BenchLateMax;
 
 	volatile bool m_EndTest;
 	volatile bool m_MainTimerTested;
 	int m_RecurringCounts;
 };
 
+const double TestTimerPool::BENCH_TIME = 0.5;
+const double TestTimerPool::WHEEL_INTERVALS[ TestTimerPool::WHEEL_TESTS ] = { 0.0, 0.005, 0.05, 0.3, 1.0, 2.5 };
+
 TestTimerPool TEST_TIMERPOOL;
 
 
@@ -19,9 +19,12 @@
 #include "UnitTest.h"
 #include "utils/IWebClient.h"
 #include "utils/IWebServer.h"
+#include "utils/IService.h"
 #include "utils/Log.h"
 #include "utils/ThreadPool.h"
 #include "utils/Time.h"
+#include "utils/TimerPool.h"
+#include "utils/WebClientService.h"
 
 class TestWebServer : UnitTest
 {
@@ -30,7 +33,11 @@ public:
 	TestWebServer() : UnitTest("TestWebServer"), 
 		m_bHTTPTested(false), 
 		m_bWSTested(false),
-		m_bClientClosed( false )
+		m_bClientClosed( false ),
+		m_bKeepAliveDone( false ),
+		m_KeepAliveResponses( 0 ),
+		m_bTimeoutCallback( false ),
+		m_bTimeoutOnExecutor( false )
 	{}
 
 	virtual void RunTest()
@@ -42,6 +49,8 @@ public:
 		IWebServer * pServer = IWebServer::Create( "", 8080 );
 		pServer->AddEndpoint("/test_http", DELEGATE(TestWebServer, OnTestHTTP, IWebServer::RequestSP, this));
 		pServer->AddEndpoint("/test_ws", DELEGATE(TestWebServer, OnTestWS, IWebServer::RequestSP, this));
+		pServer->AddEndpoint("/test_keepalive", DELEGATE(TestWebServer, OnTestKeepAlive, IWebServer::RequestSP, this), false);
+		pServer->AddEndpoint("/test_timeout", DELEGATE(TestWebServer, OnTestTimeout, IWebServer::RequestSP, this));
 		Test(pServer->Start());
 
 		// test web requests
@@ -90,9 +99,206 @@ public:
 		}
 
 		spClient.reset();
+
+		// the same requests with and without reusing connections..
+		size_t maxIdle = IWebClient::GetMaxIdleConnections();
+		unsigned int reused = IWebClient::sm_ConnectionsReused;
+		double fClose = KeepAliveRequests( pool, 0 );
+		Test( IWebClient::sm_ConnectionsReused == reused );
+		double fKeepAlive = KeepAliveRequests( pool, 4 );
+		Test( IWebClient::sm_ConnectionsReused - reused == KEEP_ALIVE_REQUESTS - 1 );
+		Test( IWebClient::GetIdleConnections() == 1 );
+
+		// a request body the handler doesn't read is skipped before the next request on the connection..
+		std::string responses( UnreadBodyRequests() );
+		size_t firstResponse = responses.find( "HTTP/1.1 200 OK" );
+		Test( firstResponse != std::string::npos && responses.find( "HTTP/1.1 200 OK", firstResponse + 1 ) != std::string::npos );
+		Test( responses.find( "HTTP/1.1 500" ) == std::string::npos );
+
+		// idle connections are closed once they time out..
+		double idleTimeout = IWebClient::GetIdleTimeout();
+		IWebClient::SetIdleTimeout( 0.0 );
+		Test( IWebClient::EvictIdleConnections() == 1 );
+		Test( IWebClient::GetIdleConnections() == 0 );
+		IWebClient::SetIdleTimeout( idleTimeout );
+
+		// a request that times out still invokes its callback on the executor..
+		m_TestThread = boost::this_thread::get_id();
+		TimerPool * pTimers = new TimerPool();
+		ThreadPool * pExecutor = new ThreadPool( 1, "test-timeout" );
+		IService::Request * pRequest = new IService::Request( "http://127.0.0.1:8080/test_timeout", "GET", IService::Headers(), "",
+			DELEGATE( TestWebServer, OnTimeoutResponse, IService::Request *, this ), 1.0f );
+		pRequest->SetExecutor( pExecutor );
+		double startTime = Time::GetMonotonicTime();
+		while(! m_bTimeoutCallback && (Time::GetMonotonicTime() - startTime) < 10.0 )
+		{
+			pool.ProcessMainThread();
+			boost::this_thread::sleep( boost::posix_time::milliseconds(10) );
+		}
+		Test( m_bTimeoutCallback );
+		Test( m_bTimeoutOnExecutor );
+		m_spTimeoutRequest.reset();
+		delete pExecutor;
+		delete pTimers;
+
+		// a host with an address that doesn't answer is connected through the next address after the connect 
+		// delay, instead of after the connect times out. A listening socket with a full backlog drops the SYN..
+		boost::asio::io_service & service = WebClientService::Instance()->GetService();
+		boost::asio::ip::tcp::acceptor blackhole( service );
+		blackhole.open( boost::asio::ip::tcp::v4() );
+		blackhole.bind( boost::asio::ip::tcp::endpoint( boost::asio::ip::address_v4::loopback(), 0 ) );
+		blackhole.listen( 0 );
+		std::vector< boost::shared_ptr<boost::asio::ip::tcp::socket> > backlog;
+		for(int i=0;i<4;++i)
+		{
+			backlog.push_back( boost::shared_ptr<boost::asio::ip::tcp::socket>( new boost::asio::ip::tcp::socket( service ) ) );
+			backlog.back()->async_connect( blackhole.local_endpoint(), boost::bind( &TestWebServer::OnBacklogConnect, boost::asio::placeholders::error ) );
+		}
+		boost::this_thread::sleep( boost::posix_time::milliseconds(100) );
+
+		DnsCache::Endpoints endpoints;
+		endpoints.push_back( blackhole.local_endpoint() );
+		endpoints.push_back( boost::asio::ip::tcp::endpoint( boost::asio::ip::address_v4::loopback(), 8080 ) );
+		WebClientService::Instance()->GetDnsCache().SetEndpoints( "happy-eyeballs.test", 8080, endpoints );
+
+		IWebClient::SetMaxIdleConnections( 0 );
+		m_bKeepAliveDone = false;
+		startTime = Time::GetMonotonicTime();
+		spClient = IWebClient::Create( URL( "http://happy-eyeballs.test:8080/test_keepalive" ) );
+		spClient->SetDataReceiver( DELEGATE( TestWebServer, OnKeepAliveResponse, IWebClient::RequestData *, this ) );
+		Test( spClient->Send() );
+		while(! m_bKeepAliveDone && (Time::GetMonotonicTime() - startTime) < 10.0 )
+		{
+			pool.ProcessMainThread();
+			boost::this_thread::sleep( boost::posix_time::milliseconds(1) );
+		}
+		double fRace = Time::GetMonotonicTime() - startTime;
+		Test( m_bKeepAliveDone );
+		Test( fRace < IWebClient::GetConnectDelay() + 1.0 );
+		IWebClient::Free( spClient );
+		spClient.reset();
+
+		for(size_t i=0;i<backlog.size();++i)
+			backlog[i]->close();
+		blackhole.close();
+		WebClientService::Instance()->GetDnsCache().Clear();
+		IWebClient::SetMaxIdleConnections( maxIdle );
+
+		// many clients at once on one io_service, then with connections spread over an io_service per core..
+		double fOneService = ConcurrentRequests( pool );
+		int serviceCount = WebClientService::sm_ServiceCount;
+		delete WebClientService::Instance();
+		WebClientService::sm_ServiceCount = 4;
+		WebClientService * pService = WebClientService::Instance();
+		Test( pService->GetServiceCount() == 4 );
+		double fServices = ConcurrentRequests( pool );
+
+		Test( &pService->AssignService( "127.0.0.1" ) != &pService->AssignService( "127.0.0.1" ) );
+		WebClientService::sm_AssignMode = WebClientService::ASSIGN_HOST_HASH;
+		Test( &pService->AssignService( "127.0.0.1" ) == &pService->AssignService( "127.0.0.1" ) );
+		WebClientService::sm_AssignMode = WebClientService::ASSIGN_ROUND_ROBIN;
+
+		delete pService;
+		WebClientService::sm_ServiceCount = serviceCount;
+
+		Log::Status( "TestWebServer", "%d requests: %.0f requests/sec with keep-alive, %.0f requests/sec without",
+			KEEP_ALIVE_REQUESTS, KEEP_ALIVE_REQUESTS / fKeepAlive, KEEP_ALIVE_REQUESTS / fClose );
+		Log::Status( "TestWebServer", "Connected past an address that doesn't answer in %.3f seconds", fRace );
+		Log::Status( "TestWebServer", "%d clients at once: %.0f requests/sec with 1 io_service, %.0f requests/sec with 4 (%u cores)",
+			CONCURRENT_CLIENTS, (CONCURRENT_CLIENTS * CONCURRENT_ROUNDS) / fOneService, 
+			(CONCURRENT_CLIENTS * CONCURRENT_ROUNDS) / fServices, boost::thread::hardware_concurrency() );
 		delete pServer;
 	}
 
+	//! Sends requests one after another, returns the seconds taken
+	double KeepAliveRequests( ThreadPool & a_Pool, size_t a_MaxIdle )
+	{
+		IWebClient::SetMaxIdleConnections( a_MaxIdle );
+
+		int completed = 0;
+		double startTime = Time::GetMonotonicTime();
+		for(int i=0;i<KEEP_ALIVE_REQUESTS;++i)
+		{
+			m_bKeepAliveDone = false;
+			IWebClient::SP spClient = IWebClient::Create( URL( "http://127.0.0.1:8080/test_keepalive" ) );
+			spClient->SetDataReceiver( DELEGATE( TestWebServer, OnKeepAliveResponse, IWebClient::RequestData *, this ) );
+			Test( spClient->Send() );
+
+			double start = Time::GetMonotonicTime();
+			while(! m_bKeepAliveDone && (Time::GetMonotonicTime() - start) < 5.0 )
+			{
+				a_Pool.ProcessMainThread();
+				boost::this_thread::yield();
+			}
+			if ( m_bKeepAliveDone )
+				completed += 1;
+			IWebClient::Free( spClient );
+		}
+		Test( completed == KEEP_ALIVE_REQUESTS );
+
+		return Time::GetMonotonicTime() - startTime;
+	}
+
+	//! Sends a request with a body the handler ignores and a second request on the same connection, returns
+	//! what the server sent back
+	std::string UnreadBodyRequests()
+	{
+		boost::asio::io_service service;
+		boost::asio::ip::tcp::socket socket( service );
+		boost::system::error_code error;
+		socket.connect( boost::asio::ip::tcp::endpoint( boost::asio::ip::address_v4::loopback(), 8080 ), error );
+
+		// the body looks like a request, so it's answered if it isn't skipped..
+		std::string body( "GET /no_such_endpoint HTTP/1.1\r\n\r\n" );
+		std::string requests( StringUtil::Format( "POST /test_keepalive HTTP/1.1\r\nContent-Length: %u\r\n\r\n", (unsigned int)body.size() ) );
+		requests += body;
+		requests += "GET /test_keepalive HTTP/1.1\r\n\r\n";
+		if (! error )
+			boost::asio::write( socket, boost::asio::buffer( requests ), error );
+
+		std::string responses;
+		char buffer[ 1024 ];
+		while(! error && responses.find( "Hello World" ) == responses.rfind( "Hello World" ) )
+		{
+			size_t read = socket.read_some( boost::asio::buffer( buffer ), error );
+			responses.append( buffer, read );
+		}
+		return responses;
+	}
+
+	//! Sends requests from many clients at once, returns the seconds taken
+	double ConcurrentRequests( ThreadPool & a_Pool )
+	{
+		double startTime = Time::GetMonotonicTime();
+		for(int r=0;r<CONCURRENT_ROUNDS;++r)
+		{
+			m_KeepAliveResponses = 0;
+			std::vector<IWebClient::SP> clients;
+			for(int i=0;i<CONCURRENT_CLIENTS;++i)
+			{
+				clients.push_back( IWebClient::Create( URL( "http://127.0.0.1:8080/test_keepalive" ) ) );
+				clients.back()->SetDataReceiver( DELEGATE( TestWebServer, OnKeepAliveResponse, IWebClient::RequestData *, this ) );
+				Test( clients.back()->Send() );
+			}
+
+			double start = Time::GetMonotonicTime();
+			while( m_KeepAliveResponses < CONCURRENT_CLIENTS && (Time::GetMonotonicTime() - start) < 5.0 )
+			{
+				a_Pool.ProcessMainThread();
+				boost::this_thread::yield();
+			}
+			Test( m_KeepAliveResponses == CONCURRENT_CLIENTS );
+
+			for(size_t i=0;i<clients.size();++i)
+				IWebClient::Free( clients[i] );
+		}
+
+		return Time::GetMonotonicTime() - startTime;
+	}
+
+	static void OnBacklogConnect( const boost::system::error_code & )
+	{}
+
 	void OnTestHTTP(IWebServer::RequestSP a_spRequest)
 	{
 		Log::Debug("TestWebServer", "OnTestHTTP()");
@@ -102,6 +308,17 @@ public:
 		a_spRequest->m_spConnection->SendAsync("HTTP/1.1 200 Hello World\r\nConnection: close\r\n\r\n");
 	}
 
+	void OnTestKeepAlive(IWebServer::RequestSP a_spRequest)
+	{
+		a_spRequest->m_spConnection->SendResponse(200, "OK", "Hello World", false);
+	}
+
+	void OnTestTimeout(IWebServer::RequestSP a_spRequest)
+	{
+		// hold the request without responding, so the client times out..
+		m_spTimeoutRequest = a_spRequest;
+	}
+
 	void OnTestWS(IWebServer::RequestSP a_spRequest)
 	{
 		Log::Debug("TestWebServer", "OnTestWS()");
@@ -170,9 +387,36 @@ public:
 	}
 
 
+	void OnKeepAliveResponse(IWebClient::RequestData * a_pResponse)
+	{
+		Test(a_pResponse->m_StatusCode == 200 && a_pResponse->m_Content == "Hello World");
+		if ( a_pResponse->m_bDone )
+		{
+			m_bKeepAliveDone = true;
+			m_KeepAliveResponses++;
+		}
+	}
+
+	void OnTimeoutResponse(IService::Request * a_pRequest)
+	{
+		Test( a_pRequest->IsError() );
+		m_bTimeoutOnExecutor = boost::this_thread::get_id() != m_TestThread;
+		m_bTimeoutCallback = true;
+	}
+
+	static const int KEEP_ALIVE_REQUESTS = 500;
+	static const int CONCURRENT_CLIENTS = 16;
+	static const int CONCURRENT_ROUNDS = 20;
+
 	bool m_bHTTPTested;
 	bool m_bWSTested;
 	bool m_bClientClosed;
+	volatile bool m_bKeepAliveDone;
+	volatile int m_KeepAliveResponses;
+	IWebServer::RequestSP m_spTimeoutRequest;
+	volatile bool m_bTimeoutCallback;
+	volatile bool m_bTimeoutOnExecutor;
+	boost::thread::id m_TestThread;
 };
 
 TestWebServer TEST_WEB_SERVER;
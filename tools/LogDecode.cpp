@@ -0,0 +1,56 @@
+/**
+* Copyright 2017 IBM Corp. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+
+#include <stdio.h>
+#include <fstream>
+#include <iostream>
+
+#include "utils/BinaryLog.h"
+
+//! Decodes a log written by BinaryReactor into the text format of FileReactor.
+int main( int argc, char ** argv )
+{
+	if ( argc < 2 || argc > 3 )
+	{
+		std::cout << "Usage: log_decode <binary log> [output file]\r\n"
+			"Writes the decoded log to the output file, or to stdout if no output file is given.\r\n";
+		return 1;
+	}
+
+	bool bSuccess = false;
+	if ( argc == 3 )
+	{
+		std::ofstream output( argv[2], std::ios::out | std::ios::binary );
+		if (! output.is_open() )
+		{
+			printf( "ERROR: Failed to open %s for writing.\r\n", argv[2] );
+			return 1;
+		}
+		bSuccess = BinaryReactor::Decode( argv[1], output );
+	}
+	else
+		bSuccess = BinaryReactor::Decode( argv[1], std::cout );
+
+	if (! bSuccess )
+	{
+		printf( "ERROR: %s is not a binary log, or it is truncated.\r\n", argv[1] );
+		return 1;
+	}
+
+	return 0;
+}